@@ -0,0 +1,477 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "iommu.h"
+#include "tables_api.h"
+// Trace driven benchmark. A system image with a set of devices, each with a
+// set of processes, is built using libtables. Every process has its own
+// S-stage (or VS-stage if G-stage is enabled) page table mapping a footprint
+// of 4 KiB pages. A trace of untranslated read requests is generated by one
+// of the traffic patterns and then replayed through iommu_translate_iova().
+// The translation rate, the IOMMU cache hit rates counted using the HPM
+// counters, and the memory reads per translation are reported. When no
+// pattern is selected all patterns are run and the geometric mean of the
+// translation rates is reported as the score.
+#define SEQUENTIAL  0
+#define RANDOM      1
+#define STRIDED     2
+#define ZIPFIAN     3
+#define MULTI_DEV   4
+#define PASID_HEAVY 5
+#define NUM_PATTERNS 6
+static const char *pattern_names[NUM_PATTERNS] = {
+    "sequential", "random", "strided", "zipfian", "multi-device", "pasid-heavy"
+};
+// HPM counters programmed to count the cache events
+#define NUM_BENCH_EVENTS 6
+static const uint16_t bench_events[NUM_BENCH_EVENTS] = {
+    UNTRANSLATED_REQUEST, IOATC_TLB_MISS, DDT_CACHE_HIT, DDT_CACHE_MISS,
+    PDT_CACHE_HIT, PDT_CACHE_MISS
+};
+// Data pages are mapped at these addresses. The physical addresses are
+// offset by a page so that the tables use 4 KiB leaf PTEs.
+#define DATA_VA_BASE    0x10000000UL
+#define DATA_GPA_BASE   0x1000000000UL
+#define DATA_SPA_BASE   0x4000000000UL
+typedef struct {
+    uint32_t device_id;
+    uint32_t process_id;
+    uint64_t iova;
+} bench_req_t;
+typedef struct {
+    uint32_t num_devices;
+    uint32_t num_processes;
+    uint64_t footprint;
+    uint64_t stride;
+    double   zipf_skew;
+    uint8_t  g_stage;
+    uint64_t seed;
+} bench_cfg_t;
+typedef struct {
+    uint64_t translations;
+    uint64_t failures;
+    double   seconds;
+    uint64_t events[NUM_BENCH_EVENTS];
+    uint64_t cost_requests;
+    uint64_t mem_reads;
+} bench_result_t;
+
+char *memory;
+static uint64_t mem_size;
+static uint64_t rng_state;
+
+uint8_t
+read_memory(
+    uint64_t addr, uint8_t size, char *data) {
+    if ( (addr + size) > mem_size ) return ACCESS_FAULT;
+    memcpy(data, &memory[addr], size);
+    return 0;
+}
+uint8_t
+read_memory_for_AMO(
+    uint64_t addr, uint8_t size, char *data) {
+    return read_memory(addr, size, data);
+}
+uint8_t
+write_memory(
+    char *data, uint64_t addr, uint8_t size) {
+    if ( (addr + size) > mem_size ) return ACCESS_FAULT;
+    memcpy(&memory[addr], data, size);
+    return 0;
+}
+void
+iommu_to_hb_do_global_observability_sync(
+    uint8_t PR, uint8_t PW) {
+    return;
+}
+void
+send_msg_iommu_to_hb(
+    ats_msg_t *msg) {
+    return;
+}
+
+static uint64_t
+next_random(
+    void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DUL;
+}
+static uint64_t
+random_below(
+    uint64_t n) {
+    return next_random() % n;
+}
+static double
+elapsed_seconds(
+    struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1e9);
+}
+static uint32_t
+bench_device_id(
+    uint32_t d) {
+    // Spread the devices over the leaf DDT pages
+    return (d << 7) | (d & 0x7F);
+}
+// Build the device contexts, the process contexts and the page tables
+static int8_t
+build_system(
+    bench_cfg_t *cfg) {
+    device_context_t DC;
+    process_context_t PC;
+    iosatp_t iosatp;
+    gpte_t gpte;
+    pte_t pte;
+    ddtp_t ddtp;
+    uint32_t d, p;
+    uint64_t spa;
+
+    ddtp.raw = 0;
+    ddtp.ppn = get_free_ppn(1);
+    ddtp.iommu_mode = DDT_3LVL;
+    write_register(DDTP_OFFSET, 8, ddtp.raw);
+    do {
+        ddtp.raw = read_register(DDTP_OFFSET, 8);
+    } while ( ddtp.busy == 1 );
+
+    for ( d = 0; d < cfg->num_devices; d++ ) {
+        memset(&DC, 0, sizeof(DC));
+        DC.tc.V = 1;
+        if ( cfg->g_stage == 1 ) {
+            DC.iohgatp.MODE = IOHGATP_Sv48x4;
+            DC.iohgatp.GSCID = d + 1;
+            if ( (DC.iohgatp.PPN = get_free_ppn(4)) == INVALID_PPN ) return -1;
+            gpte.raw = 0;
+            gpte.V = gpte.R = gpte.W = gpte.U = gpte.A = gpte.D = 1;
+            gpte.PBMT = PMA;
+            if ( map_g_stage_range(DC.iohgatp, DATA_GPA_BASE, (DATA_SPA_BASE + PAGESIZE),
+                                   (cfg->footprint * PAGESIZE), gpte) < 0 )
+                return -1;
+        }
+        DC.tc.PDTV = 1;
+        DC.fsc.pdtp.MODE = ( cfg->num_processes < 256 ) ? PD8 : PD17;
+        if ( cfg->g_stage == 1 ) {
+            DC.fsc.pdtp.PPN = get_free_gppn(1, DC.iohgatp);
+            gpte.raw = 0;
+            gpte.V = gpte.R = gpte.W = gpte.U = 1;
+            gpte.PBMT = PMA;
+            gpte.PPN = get_free_ppn(1);
+            add_g_stage_pte(DC.iohgatp, (DC.fsc.pdtp.PPN * PAGESIZE), gpte, 0);
+        } else {
+            DC.fsc.pdtp.PPN = get_free_ppn(1);
+        }
+        add_dev_context(&DC, bench_device_id(d));
+
+        for ( p = 0; p < cfg->num_processes; p++ ) {
+            memset(&PC, 0, sizeof(PC));
+            PC.ta.V = 1;
+            PC.ta.PSCID = p + 1;
+            iosatp.raw = 0;
+            iosatp.MODE = IOSATP_Sv48;
+            pte.raw = 0;
+            pte.V = pte.R = pte.W = pte.U = pte.A = pte.D = 1;
+            pte.PBMT = PMA;
+            if ( cfg->g_stage == 1 ) {
+                iosatp.PPN = get_free_gppn(1, DC.iohgatp);
+                gpte.raw = 0;
+                gpte.V = gpte.R = gpte.W = gpte.U = 1;
+                gpte.PBMT = PMA;
+                gpte.PPN = get_free_ppn(1);
+                add_g_stage_pte(DC.iohgatp, (iosatp.PPN * PAGESIZE), gpte, 0);
+                if ( map_vs_stage_range(iosatp, DATA_VA_BASE, DATA_GPA_BASE,
+                                        (cfg->footprint * PAGESIZE), pte, DC.iohgatp) < 0 )
+                    return -1;
+            } else {
+                iosatp.PPN = get_free_ppn(1);
+                spa = DATA_SPA_BASE + PAGESIZE + ((uint64_t)p * cfg->footprint * PAGESIZE);
+                if ( map_s_stage_range(iosatp, DATA_VA_BASE, spa,
+                                       (cfg->footprint * PAGESIZE), pte) < 0 )
+                    return -1;
+            }
+            PC.fsc.iosatp = iosatp;
+            if ( add_process_context(&DC, &PC, (p + 1)) == 1 ) return -1;
+        }
+    }
+    return 0;
+}
+// Generate a trace of num_reqs requests using the pattern
+static int8_t
+generate_trace(
+    bench_cfg_t *cfg, uint8_t pattern, bench_req_t *reqs, uint64_t num_reqs) {
+    uint64_t i, j, page, lo, hi, mid;
+    uint64_t *perm = NULL;
+    double *cdf = NULL;
+    double sum;
+
+    if ( pattern == ZIPFIAN ) {
+        // Ranks are assigned to pages in a random order
+        cdf = malloc(cfg->footprint * sizeof(double));
+        perm = malloc(cfg->footprint * sizeof(uint64_t));
+        if ( cdf == NULL || perm == NULL ) {
+            free(cdf);
+            free(perm);
+            return -1;
+        }
+        for ( sum = 0, i = 0; i < cfg->footprint; i++ ) {
+            sum += 1.0 / pow((double)(i + 1), cfg->zipf_skew);
+            cdf[i] = sum;
+            perm[i] = i;
+        }
+        for ( i = cfg->footprint - 1; i > 0; i-- ) {
+            j = random_below(i + 1);
+            page = perm[i];
+            perm[i] = perm[j];
+            perm[j] = page;
+        }
+    }
+    for ( i = 0; i < num_reqs; i++ ) {
+        reqs[i].device_id = bench_device_id(0);
+        reqs[i].process_id = 1;
+        switch ( pattern ) {
+            case SEQUENTIAL:
+                // Stream through the pages a cache line at a time
+                page = (i / (PAGESIZE / 64)) % cfg->footprint;
+                break;
+            case RANDOM:
+                page = random_below(cfg->footprint);
+                break;
+            case STRIDED:
+                page = (i * cfg->stride) % cfg->footprint;
+                break;
+            case ZIPFIAN:
+                sum = (next_random() >> 11) * (cdf[cfg->footprint - 1] / (double)(1UL << 53));
+                for ( lo = 0, hi = cfg->footprint - 1; lo < hi; ) {
+                    mid = (lo + hi) / 2;
+                    if ( cdf[mid] < sum ) lo = mid + 1;
+                    else hi = mid;
+                }
+                page = perm[lo];
+                break;
+            case MULTI_DEV:
+                reqs[i].device_id = bench_device_id(random_below(cfg->num_devices));
+                page = random_below(cfg->footprint);
+                break;
+            default:
+                reqs[i].device_id = bench_device_id(random_below(cfg->num_devices));
+                reqs[i].process_id = random_below(cfg->num_processes) + 1;
+                page = random_below(cfg->footprint);
+                break;
+        }
+        reqs[i].iova = DATA_VA_BASE + (page * PAGESIZE);
+        if ( pattern == SEQUENTIAL )
+            reqs[i].iova += (i % (PAGESIZE / 64)) * 64;
+        else
+            reqs[i].iova += random_below(PAGESIZE / 64) * 64;
+    }
+    free(cdf);
+    free(perm);
+    return 0;
+}
+static void
+replay_trace(
+    bench_req_t *reqs, uint64_t num_reqs, uint64_t *failures) {
+    hb_to_iommu_req_t req;
+    iommu_to_hb_rsp_t rsp;
+    uint64_t i;
+
+    memset(&req, 0, sizeof(req));
+    req.pid_valid = 1;
+    req.tr.at = ADDR_TYPE_UNTRANSLATED;
+    req.tr.length = 64;
+    req.tr.read_writeAMO = READ;
+    for ( i = 0; i < num_reqs; i++ ) {
+        req.device_id = reqs[i].device_id;
+        req.process_id = reqs[i].process_id;
+        req.tr.iova = reqs[i].iova;
+        iommu_translate_iova(&req, &rsp);
+        if ( rsp.status != SUCCESS ) (*failures)++;
+    }
+    return;
+}
+// Reset the IOMMU and the memory and build the system image
+static int8_t
+reset_bench(
+    bench_cfg_t *cfg) {
+    capabilities_t cap = {0};
+    fctrl_t fctrl = {0};
+    iohpmevt_t iohpmevt;
+    uint32_t i;
+
+    // The G-stage translations cached by the table builders are stale
+    memset(memory, 0, mem_size);
+    init_page_pool(0, (mem_size / PAGESIZE));
+    flush_gpa_cache();
+    cap.version = 0x10;
+    cap.Sv39 = cap.Sv48 = cap.Sv57 = cap.Sv39x4 = cap.Sv48x4 = cap.Sv57x4 = 1;
+    cap.amo = cap.ats = cap.hpm = 1;
+    cap.pas = 50;
+    if ( reset_iommu((NUM_BENCH_EVENTS + 1), 40, 0x7fff, 4, Off, cap, fctrl) < 0 )
+        return -1;
+    for ( i = 0; i < NUM_BENCH_EVENTS; i++ ) {
+        iohpmevt.raw = 0;
+        iohpmevt.eventID = bench_events[i];
+        write_register((IOHPMEVT1_OFFSET + (i * 8)), 8, iohpmevt.raw);
+    }
+    rng_state = cfg->seed;
+    return build_system(cfg);
+}
+static int8_t
+run_pattern(
+    bench_cfg_t *cfg, uint8_t pattern, uint64_t num_reqs, uint64_t num_warmup,
+    bench_result_t *res) {
+    struct timespec start, end;
+    bench_req_t *reqs;
+    uint64_t warmup_failures = 0;
+    uint32_t i;
+    cost_hist_t h;
+    uint8_t ttyp;
+
+    memset(res, 0, sizeof(*res));
+    if ( reset_bench(cfg) < 0 ) return -1;
+    if ( (reqs = malloc((num_reqs + num_warmup) * sizeof(bench_req_t))) == NULL ) return -1;
+    if ( generate_trace(cfg, pattern, reqs, (num_reqs + num_warmup)) < 0 ) {
+        free(reqs);
+        return -1;
+    }
+    replay_trace(reqs, num_warmup, &warmup_failures);
+    for ( i = 0; i < NUM_BENCH_EVENTS; i++ )
+        write_register((IOHPMCTR1_OFFSET + (i * 8)), 8, 0);
+    iommu_clear_cost_stats();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    replay_trace(&reqs[num_warmup], num_reqs, &res->failures);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    res->translations = num_reqs;
+    res->seconds = elapsed_seconds(&start, &end);
+    for ( i = 0; i < NUM_BENCH_EVENTS; i++ )
+        res->events[i] = read_register((IOHPMCTR1_OFFSET + (i * 8)), 8);
+    // No requests are recorded when the cost statistics are compiled out
+    for ( ttyp = 0; ttyp < COST_STATS_MAX_TTYP; ttyp++ ) {
+        if ( iommu_get_ttyp_cost(ttyp, &h) != 0 ) continue;
+        res->cost_requests += h.requests;
+        res->mem_reads += h.mem_reads;
+    }
+    free(reqs);
+    return 0;
+}
+static double
+ratio(
+    uint64_t num, uint64_t den) {
+    return ( den == 0 ) ? 0.0 : ((double)num / (double)den);
+}
+static void
+print_result(
+    uint8_t pattern, bench_result_t *res) {
+    uint64_t *e = res->events;
+
+    printf("%-14s %12.0f %10.1f %9.2f%% %9.2f%% %9.2f%% %10.2f %8"PRIu64"\n",
+           pattern_names[pattern],
+           ratio(res->translations, 1) / res->seconds,
+           (res->seconds * 1e9) / res->translations,
+           100.0 * (1.0 - ratio(e[1], e[0])),
+           100.0 * ratio(e[2], (e[2] + e[3])),
+           100.0 * ratio(e[4], (e[4] + e[5])),
+           ratio(res->mem_reads, res->cost_requests),
+           res->failures);
+    return;
+}
+static void
+usage(
+    const char *name) {
+    printf("Usage: %s [options]\n", name);
+    printf("  -p <pattern>  sequential, random, strided, zipfian, multi-device or\n");
+    printf("                pasid-heavy. All patterns are run if not specified.\n");
+    printf("  -n <num>      translations to time (default 1000000)\n");
+    printf("  -w <num>      translations to warm up the caches with (default 0)\n");
+    printf("  -d <num>      devices (default 16)\n");
+    printf("  -P <num>      processes per device (default 16)\n");
+    printf("  -f <pages>    pages mapped per process (default 4096)\n");
+    printf("  -s <pages>    stride of the strided pattern (default 17)\n");
+    printf("  -z <skew>     skew of the zipfian pattern (default 0.99)\n");
+    printf("  -g            use two stage address translation\n");
+    printf("  -m <GiB>      memory for the tables (default 1)\n");
+    printf("  -S <seed>     random seed (default 1)\n");
+    return;
+}
+int
+main(
+    int argc, char **argv) {
+    bench_cfg_t cfg;
+    bench_result_t res;
+    uint64_t num_reqs = 1000000, num_warmup = 0;
+    int pattern = -1, p, opt, num_run = 0;
+    double log_sum = 0;
+
+    cfg.num_devices = 16;
+    cfg.num_processes = 16;
+    cfg.footprint = 4096;
+    cfg.stride = 17;
+    cfg.zipf_skew = 0.99;
+    cfg.g_stage = 0;
+    cfg.seed = 1;
+    mem_size = 1024UL * 1024UL * 1024UL;
+    while ( (opt = getopt(argc, argv, "p:n:w:d:P:f:s:z:gm:S:h")) != -1 ) {
+        switch ( opt ) {
+            case 'p':
+                for ( p = 0; p < NUM_PATTERNS; p++ )
+                    if ( strcmp(optarg, pattern_names[p]) == 0 ) pattern = p;
+                if ( pattern < 0 ) {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'n': num_reqs = strtoull(optarg, NULL, 0); break;
+            case 'w': num_warmup = strtoull(optarg, NULL, 0); break;
+            case 'd': cfg.num_devices = strtoul(optarg, NULL, 0); break;
+            case 'P': cfg.num_processes = strtoul(optarg, NULL, 0); break;
+            case 'f': cfg.footprint = strtoull(optarg, NULL, 0); break;
+            case 's': cfg.stride = strtoull(optarg, NULL, 0); break;
+            case 'z': cfg.zipf_skew = strtod(optarg, NULL); break;
+            case 'g': cfg.g_stage = 1; break;
+            case 'm': mem_size = strtoull(optarg, NULL, 0) * 1024UL * 1024UL * 1024UL; break;
+            case 'S': cfg.seed = strtoull(optarg, NULL, 0); break;
+            default:
+                usage(argv[0]);
+                return ( opt == 'h' ) ? 0 : -1;
+        }
+    }
+    if ( num_reqs == 0 || cfg.num_devices == 0 || cfg.num_devices > 65536 ||
+         cfg.num_processes == 0 || cfg.num_processes >= (1 << 17) || cfg.footprint == 0 ||
+         cfg.seed == 0 || mem_size == 0 ) {
+        usage(argv[0]);
+        return -1;
+    }
+    if ( (memory = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED ) {
+        printf("Could not allocate memory\n");
+        return -1;
+    }
+
+    printf("devices %u, processes %u, footprint %"PRIu64" pages, %s translation\n",
+           cfg.num_devices, cfg.num_processes, cfg.footprint,
+           ( cfg.g_stage == 1 ) ? "two stage" : "single stage");
+    printf("%-14s %12s %10s %10s %10s %10s %10s %8s\n", "pattern", "trans/sec",
+           "ns/trans", "TLB hit", "DDT hit", "PDT hit", "reads/tr", "failures");
+    for ( p = 0; p < NUM_PATTERNS; p++ ) {
+        if ( pattern >= 0 && p != pattern ) continue;
+        if ( run_pattern(&cfg, p, num_reqs, num_warmup, &res) < 0 ) {
+            printf("Could not build the tables or the trace for %s\n", pattern_names[p]);
+            return -1;
+        }
+        print_result(p, &res);
+        log_sum += log(res.translations / res.seconds);
+        num_run++;
+    }
+    printf("score: %.0f translations/sec\n", exp(log_sum / num_run));
+    return 0;
+}
@@ -0,0 +1,27 @@
+# Build configuration shared by the libraries, the test, the tools and the
+# benchmark. Select the configuration with BUILD=release, debug or coverage.
+# The libraries of each configuration are built in a directory named after
+# the configuration, e.g. libiommu/release/libiommu.a and libiommu.so.
+BUILD ?= coverage
+CC := gcc
+AR := gcc-ar
+RANLIB := gcc-ranlib
+BUILD_CFLAGS := -fPIC -Wformat-security -D_FORTIFY_SOURCE=2 -Wall -Werror -fcf-protection=full -pthread
+ifeq ($(BUILD),release)
+BUILD_CFLAGS += -O2 -g -flto=auto -ffat-lto-objects -fstack-protector-strong
+BUILD_LDFLAGS := -O2 -flto=auto
+else ifeq ($(BUILD),debug)
+BUILD_CFLAGS += -O0 -g -ftrapv -fstack-protector-all
+BUILD_LDFLAGS :=
+else ifeq ($(BUILD),coverage)
+BUILD_CFLAGS += -O0 -g -ftrapv -fstack-protector-all -fprofile-arcs -ftest-coverage
+BUILD_LDFLAGS := -lgcov --coverage
+else
+$(error BUILD must be one of release, debug or coverage)
+endif
+
+# Set COST_STATS=0 to compile out the translation cost statistics
+COST_STATS ?= 1
+ifeq ($(COST_STATS),1)
+BUILD_CFLAGS += -DIOMMU_COST_STATS
+endif
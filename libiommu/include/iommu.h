@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 #include "iommu_registers.h"
 #include "iommu_data_structures.h"
 #include "iommu_req_rsp.h"
@@ -20,6 +21,11 @@
 #include "iommu_ats.h"
 #include "iommu_atc.h"
 #include "iommu_hpm.h"
+#include "iommu_clock.h"
+#include "iommu_cost.h"
+#include "iommu_trace.h"
+#include "iommu_debug.h"
+#include "iommu_record.h"
 #include "iommu_ref_api.h"
 
 
@@ -56,6 +56,8 @@ typedef struct {
 #define IOATC_MISS  0
 #define IOATC_HIT   1
 #define IOATC_FAULT 2
+// Debug translations in the non-caching mode do not lookup or fill the IOATC
+#define IOATC_BYPASS() (g_dbg_tr_flags & DBG_TR_NO_CACHE)
 
 extern ddt_cache_t ddt_cache[DDT_CACHE_SIZE];
 extern pdt_cache_t pdt_cache[PDT_CACHE_SIZE];
@@ -10,8 +10,8 @@ typedef union {
         uint64_t PID:20;
         uint64_t PV:1;
         uint64_t PRIV:1;
-        uint64_t X:5;
-        uint64_t reserved:16;
+        uint64_t X:1;
+        uint64_t reserved:17;
         uint64_t PAYLOAD;
     };
     uint64_t raw[2];
@@ -66,16 +66,38 @@ typedef struct {
 #define INVALID_REQUEST  0x1
 #define RESPONSE_FAILURE 0xF
 
+// The busy state of the ITAGs is held in the g_itag_busy bitmap - bit N
+// set indicates ITAG N is allocated to an outstanding invalidation request.
+// The tracker holds the requester identity used to validate completions
+// and the count of completions received so far for the ITAG.
 typedef struct {
-    uint8_t  free;
     uint8_t  DSV;
     uint8_t  DSEG;
     uint16_t RID;
-    uint8_t  num_rsp_rcvd;
+    _Atomic uint8_t num_rsp_rcvd;
+    uint64_t deadline;
+    uint8_t  timer_slot;
 } itag_tracker_t;
 
 #define MAX_ITAGS 32
+#define ALL_ITAGS_BUSY ((uint32_t)((1ULL << MAX_ITAGS) - 1))
+extern _Atomic uint32_t g_itag_busy;
 extern uint8_t allocate_itag(uint8_t DSV, uint8_t DSEG, uint16_t RID, uint8_t *itag);
 extern void send_msg_iommu_to_hb(ats_msg_t *msg);
 extern uint8_t any_ats_invalidation_requests_pending(void);
+extern void handle_page_request(ats_msg_t *pr);
+extern void handle_page_requests(ats_msg_t *prs, uint32_t num_msgs);
+
+// Page requests are ingested in batches of up to PR_BATCH_MAX messages and
+// written to the page-request queue in bursts of up to PQ_BURST_RECORDS
+#define PR_BATCH_MAX     256
+#define PQ_BURST_RECORDS 8
+
+// Invalidation request timeouts are tracked in a timer wheel. Each slot
+// holds a bitmap of the ITAGs whose deadline falls in that slot. The slot
+// width is chosen such that the timeout spans less than one revolution of
+// the wheel.
+#define ATS_TIMER_WHEEL_SLOTS 64
+extern uint64_t g_ats_inv_req_timeout_ticks;
+extern void ats_timer_tick(uint64_t now);
 #endif //__IOMMU_ATS_H__
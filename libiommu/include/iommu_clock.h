@@ -0,0 +1,13 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#ifndef __IOMMU_CLOCK_H__
+#define __IOMMU_CLOCK_H__
+// The reference model has no notion of time of its own. Time is modeled
+// by a virtual clock that is advanced by the embedder. The unit of a
+// tick is defined by the embedder. Timed activities in the model, such
+// as the ATS invalidation request timeouts, are evaluated when the clock
+// is advanced.
+extern uint64_t g_iommu_clock;
+#endif // __IOMMU_CLOCK_H__
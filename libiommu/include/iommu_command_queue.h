@@ -80,6 +80,8 @@ void do_ats_msg( uint8_t MSGCODE, uint8_t TAG, uint8_t DSV, uint8_t DSEG, uint16
 uint8_t do_iofence_c(uint8_t PR, uint8_t PW, uint8_t AV, uint8_t WIS_BIT, uint64_t ADDR, uint32_t DATA);
 void do_pending_iofence();
 void queue_any_blocked_ats_inval_req();
-extern uint8_t g_ats_inv_req_timeout;
+void resume_itag_waiters();
+extern _Atomic uint8_t g_ats_inv_req_timeout;
+extern atomic_flag g_cq_lock;
 #endif // __IOMMU_COMMAND_QUEUE_H__
 
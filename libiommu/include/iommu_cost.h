@@ -0,0 +1,50 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#ifndef __IOMMU_COST_H__
+#define __IOMMU_COST_H__
+// Contents of this file are not architectural
+// The translation cost statistics record the cost of each request processed
+// by iommu_translate_iova() in model units - the number of memory reads
+// made to walk the directory and page tables, the number of G-stage walks
+// made and the number of A/D bit update AMOs. The cost of a request is the
+// number of memory reads and AMOs made to process it. The costs are kept as
+// log2 histograms per transaction type and per device_id. Bucket 0 counts
+// requests with cost 0 and bucket N counts requests with cost in the range
+// 2^(N-1) to 2^N - 1.
+// The statistics are compiled in when IOMMU_COST_STATS is defined. When not
+// defined the cost accounting compiles to nothing, the get functions return
+// 1 as no requests were recorded and the dump writes nothing.
+#define COST_HIST_BUCKETS       16
+#define COST_STATS_MAX_TTYP     16
+#define COST_STATS_MAX_DEVICES  64
+typedef struct {
+    uint32_t mem_reads;
+    uint32_t g_walks;
+    uint32_t ad_amos;
+} iommu_cost_t;
+typedef struct {
+    uint64_t requests;
+    uint64_t mem_reads;
+    uint64_t g_walks;
+    uint64_t ad_amos;
+    uint64_t hist[COST_HIST_BUCKETS];
+} cost_hist_t;
+
+#ifdef IOMMU_COST_STATS
+extern iommu_cost_t g_cost;
+extern void record_cost(uint8_t TTYP, uint32_t device_id);
+#define COST_BEGIN()      memset(&g_cost, 0, sizeof(g_cost))
+#define COST_MEM_READ()   (g_cost.mem_reads++)
+#define COST_G_WALK()     (g_cost.g_walks++)
+#define COST_AD_AMO()     (g_cost.ad_amos++)
+#define COST_END(__TTYP, __DID) record_cost(__TTYP, __DID)
+#else
+#define COST_BEGIN()
+#define COST_MEM_READ()
+#define COST_G_WALK()
+#define COST_AD_AMO()
+#define COST_END(__TTYP, __DID)
+#endif // IOMMU_COST_STATS
+#endif // __IOMMU_COST_H__
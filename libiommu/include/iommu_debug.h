@@ -0,0 +1,25 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#ifndef __IOMMU_DEBUG_H__
+#define __IOMMU_DEBUG_H__
+// Contents of this file are not architectural
+// Debug translations are requested through the tr_req_iova/tr_req_ctrl
+// registers or in batches through iommu_debug_translate(). A batch of
+// requests is translated without emulating the register accesses for
+// each request, for example to audit the translation tables.
+// When DBG_TR_NO_CACHE is set, the translation neither looks up nor fills
+// the IOATC. Debug translations made in this mode do not perturb the state
+// of the IOATC and provide the translation in the in-memory tables.
+#define DBG_TR_NO_CACHE 0x01
+// Faults are not reported through the fault-queue
+#define DBG_TR_NO_FAULT 0x02
+typedef struct {
+    tr_req_iova_t iova;
+    tr_req_ctrl_t ctrl;
+} dbg_tr_req_t;
+
+extern uint8_t g_dbg_tr_flags;
+extern void debug_translate(tr_req_iova_t iova, tr_req_ctrl_t ctrl, tr_response_t *rsp);
+#endif // __IOMMU_DEBUG_H__
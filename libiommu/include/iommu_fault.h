@@ -59,6 +59,27 @@ typedef union {
 #define ACCESS_FAULT    0x01
 #define DATA_CORRUPTION 0x02
 
+// Fault suppression filter - a direct mapped table of recently reported
+// faults indexed by a hash of the device_id, process_id, cause and the
+// iotval page.
+#define FSUPP_FILTER_SIZE 64
+typedef struct {
+    uint8_t  valid;
+    uint8_t  PV;
+    uint16_t cause;
+    uint32_t DID;
+    uint32_t PID;
+    uint64_t iotval_page;
+    uint64_t start;            // Time the window started
+    uint32_t count;            // Faults suppressed in the window
+} fsupp_entry_t;
+extern fsupp_entry_t fsupp_filter[FSUPP_FILTER_SIZE];
+
+// Largest burst of write-combined fault records - 4 records of 32 bytes
+#define FQ_WC_MAX_RECORDS 4
+extern uint8_t g_fq_wc_records;
+extern void flush_fault_queue(void);
+
 extern void report_fault(uint16_t cause, uint64_t iotval, uint64_t iotval2, uint8_t TTYP, uint8_t dtf,
                   uint32_t device_id, uint8_t pid_valid, uint32_t process_id, uint8_t priv_req);
 #endif // __IOMMU_FAULT_H__
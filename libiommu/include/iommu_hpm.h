@@ -25,7 +25,42 @@
 #define PDT_WALKS            6
 #define S_VS_PT_WALKS        7
 #define G_PT_WALKS           8
+// The following custom events are counted by the reference model. These
+// use the event IDs 16384 - 32767 designated for custom use.
+// | *eventID*     | *Event counted*                          | *IDT settings supported*
+// | 16384         | Device context cache hits                | 0
+// | 16385         | Device context cache misses              | 0
+// | 16386         | Process context cache hits               | 0
+// | 16387         | Process context cache misses             | 0
+// | 16388         | MSI PTE translation cache hits           | 0/1
+// | 16389         | MSI PTE translation cache misses         | 0/1
+// | 16390         | G-stage only translation cache hits      | 0/1
+// | 16391         | A/D bit update writes                    | 0/1
+// | 16392         | Fault records written                    | 0
+// | 16393         | Fault records suppressed                 | 0
+// | 16394         | Command queue stalls for ITAG            | 0
+// | 16400 - 16404 | S/VS-stage PTE reads at level 0 - 4      | 0/1
+// | 16408 - 16412 | G-stage PTE reads at level 0 - 4         | 0/1
+#define DDT_CACHE_HIT        16384
+#define DDT_CACHE_MISS       16385
+#define PDT_CACHE_HIT        16386
+#define PDT_CACHE_MISS       16387
+#define MSI_PTE_CACHE_HIT    16388
+#define MSI_PTE_CACHE_MISS   16389
+#define G_STAGE_CACHE_HIT    16390
+#define AD_UPDATE_WRITES     16391
+#define FAULTS_WRITTEN       16392
+#define FAULTS_SUPPRESSED    16393
+#define ITAG_STALLS          16394
+#define S_VS_PT_WALK_LEVEL0  16400
+#define G_PT_WALK_LEVEL0     16408
 
+extern uint32_t g_hpm_event_ctrs[1 << 15];
+
+void update_hpm_event_map(void);
+void update_iohpmcycles(void);
+void reset_hpm(void);
+void hpm_clock_tick(uint64_t now);
 void count_events(uint8_t PV, uint32_t PID, uint8_t PSCV, uint32_t PSCID, 
-    uint8_t DID, uint8_t GSCV, uint32_t GSCID, uint16_t eventID);
+    uint32_t DID, uint8_t GSCV, uint32_t GSCID, uint16_t eventID);
 #endif // __IOMMU_PMU_H__
@@ -12,5 +12,27 @@
 
 #define MSI_VEC_CTRL_MASK_BIT 1
 
+// Contents below are not architectural
+// An embedder may provide a sink to receive the interrupts signaled by the
+// IOMMU instead of the MSIs being written to memory. MSIs are delivered
+// in batches through send_msis(); the sink sets status of a message to
+// ACCESS_FAULT if the write faulted. Wire based interrupts are level
+// signaled through set_wire().
+#define MAX_MSI_BATCH 64
+typedef struct {
+    uint64_t addr;
+    uint32_t data;
+    uint8_t  vec;
+    uint8_t  status;
+} iommu_msi_t;
+typedef struct {
+    void (*send_msis)(iommu_msi_t *msis, uint32_t num_msis);
+    void (*set_wire)(uint8_t vec, uint8_t level);
+} iommu_intr_sink_t;
+
+extern imod_t g_imod[16];
 extern void generate_interrupt(uint8_t unit);
+extern void reset_interrupts(void);
+extern void update_interrupt_wires(void);
+extern void interrupt_clock_tick(uint64_t now);
 #endif // __IOMMU_INTERRUPT_H__
@@ -0,0 +1,137 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#ifndef __IOMMU_RECORD_H__
+#define __IOMMU_RECORD_H__
+// Contents of this file are not architectural
+// A transaction recording captures the requests presented to the IOMMU,
+// the register writes, the commands made available to the command queue,
+// the advances of the clock, the ATS invalidation completions and timeouts
+// the resets and the changes of the invalidation request timeout in the
+// order they occurred, such that they may be replayed
+// to the IOMMU later. The recording starts from the state captured in a
+// table image (see save_table_image() in libtables) and the header holds
+// the arguments of the reset of the IOMMU in effect when it was started.
+//
+// The recording file is laid out as follows:
+//   - The header
+//   - The chunks of encoded records
+//   - The index of the chunks
+// Each chunk has a chunk header followed by the encoded records, padded to
+// a multiple of 8 bytes. The IOVA of a request is encoded as the difference
+// from the IOVA of the previous request in the chunk, so a chunk may be
+// decoded without decoding the chunks before it. The index holds the
+// offset and the number of the first record of each chunk for seeking.
+//
+// Each record starts with a tag byte - bits 2:0 hold the record type and
+// bits 7:3 the flags. Integers are encoded as LEB128 varints and signed
+// integers are zigzag encoded before the varint encoding.
+// | *type*       | *flags*                        | *fields*
+// | UNTRANSLATED | pid_valid, no_write, exec_req, | device_id, process_id (if pid_valid),
+// | ATS_REQUEST  | priv_req, read_writeAMO        | iova delta (signed), length << 1 | is_cxl_dev,
+// | TRANSLATED   |                                | msi_wr_data (if read_writeAMO is WRITE)
+// | MMIO         | bit 0: 8 byte write            | offset, data
+// | COMMANDS     | 0                              | cqt index, count, count x 16 byte commands
+// | PROCESS      | 0                              | -
+// | EVENT        | RESET                          | num_hpm, hpmctr_bits, eventID_mask, num_vec_bits,
+// |              |                                | reset_iommu_mode, capabilities, fctrl
+// |              | CLOCK                          | ticks
+// |              | INV_COMPLETION                 | RID, DSEG << 1 | DSV, PAYLOAD
+// |              | ATS_TIMER_EXPIRY               | itag_vector
+// |              | ATS_TIMEOUT                    | ticks
+// The request record types are the addr_type_t of the request.
+#define REC_UNTRANSLATED   ADDR_TYPE_UNTRANSLATED
+#define REC_ATS_REQUEST    ADDR_TYPE_PCIE_ATS_TRANSLATION_REQUEST
+#define REC_TRANSLATED     ADDR_TYPE_TRANSLATED
+#define REC_MMIO           3
+#define REC_COMMANDS       4
+#define REC_PROCESS        5
+#define REC_EVENT          6
+// The events recorded by the EVENT records
+#define REC_EV_RESET            0
+#define REC_EV_CLOCK            1
+#define REC_EV_INV_COMPLETION   2
+#define REC_EV_ATS_TIMER_EXPIRY 3
+#define REC_EV_ATS_TIMEOUT      4
+#define REC_MAGIC          0x44524F4345524D49UL
+#define REC_VERSION        2
+#define REC_CHUNK_SIZE     65536
+// Commands are recorded in records of at most this many commands
+#define REC_MAX_COMMANDS   256
+// The arguments of reset_iommu()
+typedef struct {
+    uint8_t  num_hpm;
+    uint8_t  hpmctr_bits;
+    uint16_t eventID_mask;
+    uint8_t  num_vec_bits;
+    uint8_t  reset_iommu_mode;
+    uint16_t reserved;
+    uint32_t fctrl;
+    uint32_t reserved1;
+    uint64_t capabilities;
+} rec_reset_t;
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    rec_reset_t reset;
+    uint64_t num_records;
+    uint64_t num_chunks;
+    uint64_t index_offset;
+} rec_hdr_t;
+typedef struct {
+    uint32_t num_records;
+    uint32_t num_bytes;
+} rec_chunk_hdr_t;
+typedef struct {
+    uint64_t offset;
+    uint64_t first_record;
+} rec_index_t;
+// A decoded record
+typedef struct {
+    uint8_t  type;
+    // Request - for the request record types
+    hb_to_iommu_req_t req;
+    // Register write - for MMIO
+    uint16_t offset;
+    uint8_t  num_bytes;
+    uint64_t data;
+    // Commands written to the command queue at cq_index - for COMMANDS.
+    // The commands point into the mapped recording and may not be aligned.
+    uint32_t cq_index;
+    uint32_t num_commands;
+    const uint8_t *commands;
+    // Event - for EVENT. The clock ticks, the ITAG vector of a timer
+    // expiry and the invalidation request timeout are in data.
+    uint8_t  event;
+    rec_reset_t reset;
+    ats_msg_t inv_cc;
+} rec_t;
+// A recording mapped for replay
+typedef struct {
+    const uint8_t *base;
+    uint64_t size;
+    const rec_hdr_t *hdr;
+    const rec_index_t *index;
+    uint64_t chunk;
+    uint64_t record;
+    const uint8_t *pos;
+    const uint8_t *end;
+    uint32_t chunk_records;
+    uint64_t prev_iova;
+} rec_reader_t;
+
+extern uint8_t g_recording;
+extern void record_request(hb_to_iommu_req_t *req);
+extern void record_register_write(uint16_t offset, uint8_t num_bytes, uint64_t data);
+extern void record_process_commands(void);
+extern void record_reset(void);
+extern void record_event(uint8_t event, uint64_t data);
+extern void record_invalidation_completion(ats_msg_t *inv_cc);
+#define RECORD(__CALL)\
+    do {\
+        if ( g_recording )\
+            __CALL;\
+    } while (0)
+#endif // __IOMMU_RECORD_H__
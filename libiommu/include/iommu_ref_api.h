@@ -17,8 +17,37 @@ extern int reset_iommu(uint8_t num_hpm, uint8_t hpmctr_bits, uint16_t eventID_ma
 extern void iommu_translate_iova(hb_to_iommu_req_t *req, iommu_to_hb_rsp_t *rsp_msg);
 extern void iommu_handle_message(hb_to_iommu_req_t req, iommu_to_hb_rsp_t *rsp_msg);
 extern void process_commands(void);
+extern uint64_t iommu_get_clock(void);
+extern void iommu_advance_clock(uint64_t ticks);
+extern void iommu_set_hpm_cycles_clock(uint64_t (*clock)(void));
+extern void iommu_set_ats_inv_req_timeout(uint64_t ticks);
+extern uint8_t iommu_set_fault_write_combining(uint8_t num_records);
+extern void flush_fault_queue(void);
+extern uint8_t handle_invalidation_completion(ats_msg_t *inv_cc);
+extern void do_ats_timer_expiry(uint32_t itag_vector);
+extern void handle_page_request(ats_msg_t *pr);
+extern void handle_page_requests(ats_msg_t *prs, uint32_t num_msgs);
+extern uint8_t iommu_set_interrupt_sink(iommu_intr_sink_t *sink, uint32_t batch_size);
+extern void iommu_flush_interrupts(void);
+extern uint8_t iommu_trace_init(trace_rec_t *ring, uint32_t num_records, uint8_t type_mask);
+extern uint32_t iommu_trace_drain(trace_rec_t *recs, uint32_t max_records);
+extern uint64_t iommu_trace_dropped(void);
+extern uint8_t iommu_record_start(const char *path);
+extern uint8_t iommu_record_stop(void);
+extern uint8_t iommu_replay_open(rec_reader_t *r, const char *path);
+extern uint8_t iommu_replay_seek(rec_reader_t *r, uint64_t rec_num);
+extern uint8_t iommu_replay_next(rec_reader_t *r, rec_t *rec);
+extern void iommu_replay_apply(rec_t *rec, iommu_to_hb_rsp_t *rsp_msg);
+extern void iommu_replay_close(rec_reader_t *r);
+extern uint32_t iommu_debug_translate(dbg_tr_req_t *reqs, tr_response_t *rsps,
+                                      uint32_t num_reqs, uint8_t flags);
 
 extern void iommu_to_hb_do_global_observability_sync(uint8_t PR, uint8_t PW);
 extern void send_msg_iommu_to_hb(ats_msg_t *prgr);
 
+extern uint8_t iommu_get_ttyp_cost(uint8_t TTYP, cost_hist_t *h);
+extern uint8_t iommu_get_device_cost(uint32_t device_id, cost_hist_t *h);
+extern void iommu_clear_cost_stats(void);
+extern void iommu_dump_cost_stats(FILE *fp);
+
 #endif // __IOMMU_REF_API_H__
@@ -483,7 +483,9 @@ typedef union {
                                // translation request.
         uint64_t PID:20;       // When PV is 1 this field provides the process_id for 
                                // this translation request.
-        uint64_t custom:4;     // Reserved for custom use
+        uint64_t NoCache:1;    // _Custom_: When set to 1 the translation does not
+                               // lookup or fill the IOATC.
+        uint64_t custom:3;     // Reserved for custom use
     };
     uint64_t raw;
 } tr_req_ctrl_t;
@@ -552,6 +554,21 @@ typedef union {
     };
     uint64_t raw;
 } msi_addr_t;
+// The fault-suppression control register is a custom 64-bit register that
+// controls the filter that suppresses repeated fault records. When enabled,
+// a fault that matches the device_id, process_id, cause and the page of
+// iotval of a fault reported within the last `window` ticks of the clock is
+// counted in fsupp_count and not written to the fault-queue. The first fault
+// reported after the window expires is written and the number of faults
+// suppressed for that tuple is reported in the custom field of the record.
+typedef union {
+    struct {
+        uint64_t en:1;         // Enable fault suppression
+        uint64_t reserved:15;
+        uint64_t window:48;    // Suppression window in ticks of the clock
+    };
+    uint64_t raw;
+} fsupp_ctrl_t;
 typedef union {
     struct {
         uint32_t m:1;
@@ -559,6 +576,33 @@ typedef union {
     };
     uint32_t raw;
 } msi_vec_ctrl_t;
+// The interrupt moderation registers are custom registers that control the
+// moderation of the interrupts signaled on each vector. The `imod_sel`
+// register selects the vector whose moderation controls are accessed
+// through the `imod` register. An interrupt that becomes pending on a vector
+// is signaled when `interval` ticks of the clock have elapsed since the
+// last interrupt signaled on the vector or when `threshold`, if not 0,
+// interrupt events have been counted on the vector since then. An event is
+// counted each time an interrupt condition is raised on the vector and not
+// for each record: a fault record written without write combining, a flush
+// of the write-combined fault records, a burst of page-request records, a
+// queue error, or a command-queue or HPM interrupt condition. An interval
+// of 0 signals interrupts without moderation.
+typedef union {
+    struct {
+        uint32_t vec:4;        // Vector whose moderation controls are accessed
+        uint32_t reserved:28;
+    };
+    uint32_t raw;
+} imod_sel_t;
+typedef union {
+    struct {
+        uint64_t interval:32;  // Minimum ticks between interrupts on the vector
+        uint64_t threshold:16; // Number of events that signal the interrupt early
+        uint64_t reserved:16;
+    };
+    uint64_t raw;
+} imod_t;
 typedef struct {
     msi_addr_t msi_addr;
     uint32_t msi_data;
@@ -598,7 +642,13 @@ typedef union {                        // |Ofst|Name            |Size|Descriptio
         tr_req_ctrl_t  tr_req_ctrl;    // |608 |`tr_req_ctrl`   |8   |Translation-request control
         tr_response_t  tr_response;    // |616 |`tr_response`   |8   |Translation-request response
         uint8_t        reserved0[58];  // |624 |Reserved        |82  |Reserved for future use (`WPRI`)
-        uint8_t        custom1[78];    // |682 |_custom_        |78  |Reserved for custom use (`WARL`)_
+        uint8_t        custom1[6];     // |682 |_custom_        |6   |Reserved for custom use (`WARL`)_
+        fsupp_ctrl_t   fsupp_ctrl;     // |688 |_fsupp_ctrl_    |8   |Fault suppression control
+        uint64_t       fsupp_count;    // |696 |_fsupp_count_   |8   |Number of faults suppressed
+        imod_sel_t     imod_sel;       // |704 |_imod_sel_      |4   |Interrupt moderation vector select
+        uint32_t       custom2;        // |708 |_custom_        |4   |Reserved for custom use (`WARL`)_
+        imod_t         imod;           // |712 |_imod_          |8   |Interrupt moderation control
+        uint8_t        custom3[40];    // |720 |_custom_        |40  |Reserved for custom use (`WARL`)_
         icvec_t        icvec;          // |760 |`icvec`         |4   |Interrupt cause to vector register
         msi_cfg_tbl_t  msi_cfg_tbl[16];// |768 |`msi_cfg_tbl`   |256 |MSI Configuration Table
         uint8_t        reserved1[3072];// |1024|Reserved        |3072|Reserved for future use (`WPRI`)
@@ -698,6 +748,10 @@ typedef union {                        // |Ofst|Name            |Size|Descriptio
 #define TR_RESPONSE_OFFSET   616
 #define RESERVED_OFFSET      624
 #define CUSTOM_OFFSET        682
+#define FSUPP_CTRL_OFFSET    688
+#define FSUPP_COUNT_OFFSET   696
+#define IMOD_SEL_OFFSET      704
+#define IMOD_OFFSET          712
 #define ICVEC_OFFSET         760
 
 #define MSI_ADDR_0_OFFSET      768 + 0 * 16 + 0
@@ -766,9 +820,28 @@ typedef union {                        // |Ofst|Name            |Size|Descriptio
 extern iommu_regs_t g_reg_file;
 extern uint8_t g_num_hpm;
 extern uint8_t g_hpmctr_bits;
-extern uint8_t g_eventID_mask;
+extern uint16_t g_eventID_mask;
 extern uint8_t g_num_vec_bits;
-extern uint8_t offset_to_size[4096];
+extern uint8_t g_reset_iommu_mode;
+extern fctrl_t g_reset_fctrl;
+
+// Register access descriptors. The descriptor of each 4 byte aligned offset
+// provides the size of the register that holds the offset - 0 if the offset
+// is not accessible, the bits of the register that are writable (WARL) and
+// the bits that are RW1C. The other bits are read-only. Registers whose
+// writes have side effects have a write handler that replaces the update of
+// the writable bits. Registers that are computed when read have a read
+// handler that updates the register file before it is read. The descriptors
+// are built by reset_iommu() from the capabilities and the parameters of
+// the design.
+typedef struct {
+    uint8_t  size;
+    uint64_t rw_mask;
+    uint64_t w1c_mask;
+    void     (*write)(uint16_t offset, uint64_t data);
+    void     (*read)(void);
+} reg_desc_t;
+extern reg_desc_t g_reg_desc[1024];
 
 extern void process_commands(void);
 #endif //_IOMMU_REGS_H_
@@ -0,0 +1,59 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#ifndef __IOMMU_TRACE_H__
+#define __IOMMU_TRACE_H__
+// Contents of this file are not architectural
+// The trace ring holds fixed size binary records of the activity of the
+// IOMMU. The ring is a multi-producer single-consumer lock-free ring. The
+// IOMMU produces the records, from each thread presenting requests or
+// signaling events, and the embedder drains them. When the ring is full new
+// records are dropped and counted.
+// Record types
+#define TRACE_REQUEST    0
+#define TRACE_RESULT     1
+#define TRACE_COMMAND    2
+#define TRACE_FAULT      3
+#define TRACE_INTERRUPT  4
+#define TRACE_ALL        ((1 << TRACE_REQUEST) | (1 << TRACE_RESULT) | (1 << TRACE_COMMAND) |\
+                          (1 << TRACE_FAULT) | (1 << TRACE_INTERRUPT))
+// Where the translation of a result was found
+#define TRACE_IOATC_NONE 0
+#define TRACE_IOATC_HIT  1
+#define TRACE_IOATC_MISS 2
+// Trace record fields
+// | *type*    | *a*      | *b*                 | *device_id* | *process_id* | *c*              | *d0*      | *d1*
+// | REQUEST   | at       | flags (1)           | device_id   | process_id   | length           | iova      | msi_wr_data
+// | RESULT    | status   | permissions (2)     | device_id   | process_id   | IOATC hit/miss   | PA        | page size
+// | COMMAND   | opcode   | func3               | 0           | 0            | cqh              | low dword | high dword
+// | FAULT     | TTYP     | cause               | device_id   | process_id   | flags (3)        | iotval    | iotval2
+// | INTERRUPT | unit     | vector              | 0           | 0            | fctrl.wis        | 0         | 0
+// (1) bit 0: pid_valid, 1: no_write, 2: exec_req, 3: priv_req, 4: read_writeAMO
+// (2) bit 0: R, 1: W, 2: X, 3: U
+// (3) bit 0: pid_valid, 1: priv_req, 2: dtf
+typedef struct {
+    uint64_t clock;
+    uint8_t  type;
+    uint8_t  a;
+    uint16_t b;
+    uint32_t device_id;
+    uint32_t process_id;
+    uint32_t c;
+    uint64_t d0;
+    uint64_t d1;
+    // Sequence of the slot in the ring - used by the ring and not a field
+    // of the record
+    uint64_t seq;
+} trace_rec_t;
+
+extern uint8_t g_trace_mask;
+extern uint8_t g_trace_ioatc;
+extern void trace_record(uint8_t type, uint8_t a, uint16_t b, uint32_t device_id,
+    uint32_t process_id, uint32_t c, uint64_t d0, uint64_t d1);
+#define TRACE(__TYPE, __A, __B, __DID, __PID, __C, __D0, __D1)\
+    do {\
+        if ( g_trace_mask & (1 << __TYPE) )\
+            trace_record(__TYPE, __A, __B, __DID, __PID, __C, __D0, __D1);\
+    } while (0)
+#endif // __IOMMU_TRACE_H__
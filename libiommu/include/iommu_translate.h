@@ -81,6 +81,30 @@ typedef union {
     } mrif;
     uint64_t raw[2];
 } msipte_t;
+// Reasons a page table entry is not a valid entry to translate through
+typedef enum {
+    PTE_OK,
+    PTE_NOT_VALID,
+    PTE_W_WITHOUT_R,
+    PTE_RESERVED,
+    PTE_BAD_PBMT,
+    PTE_BAD_NAPOT,
+    PTE_NOT_LEAF,
+    PTE_NOT_USER,
+    PTE_MISALIGNED
+} pte_check_t;
+
+extern uint8_t
+is_dc_misconfigured(device_context_t *DC);
+
+extern uint8_t
+is_pc_misconfigured(process_context_t *PC);
+
+extern pte_check_t
+check_s_vs_pte(pte_t pte, uint8_t i, uint8_t MODE);
+
+extern pte_check_t
+check_g_pte(gpte_t gpte, uint8_t i, uint8_t MODE);
 
 extern uint8_t 
 locate_device_context(device_context_t *DC, uint32_t device_id, uint8_t pid_valid, 
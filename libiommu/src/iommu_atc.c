@@ -13,6 +13,8 @@ cache_ioatc_dc(
     uint32_t device_id, device_context_t *DC) {
     uint8_t i, replace = 0;
     
+    if ( IOATC_BYPASS() )
+        return;
     for ( i = 0; i < 1; i++ ) {
         if ( ddt_cache[i].valid == 0 ) {
             replace = i; 
@@ -34,6 +36,8 @@ uint8_t
 lookup_ioatc_dc(
     uint32_t device_id, device_context_t *DC) {
     uint8_t i;
+    if ( IOATC_BYPASS() )
+        return IOATC_MISS;
     for ( i = 0; i < 1; i++ ) {
         if ( ddt_cache[i].valid == 1 && ddt_cache[i].DID == device_id ) {
             *DC = ddt_cache[i].DC;
@@ -53,6 +57,8 @@ cache_ioatc_pc(
     uint32_t device_id, uint32_t process_id, process_context_t *PC) {
     uint8_t i, replace = 0;
     
+    if ( IOATC_BYPASS() )
+        return;
     for ( i = 0; i < 1; i++ ) {
         if ( pdt_cache[i].valid == 0 ) {
             replace = i; 
@@ -74,6 +80,8 @@ uint8_t
 lookup_ioatc_pc(
     uint32_t device_id, uint32_t process_id, process_context_t *PC) {
     uint8_t i;
+    if ( IOATC_BYPASS() )
+        return IOATC_MISS;
     for ( i = 0; i < 1; i++ ) {
         if ( pdt_cache[i].valid == 1 && 
              pdt_cache[i].DID == device_id &&
@@ -99,6 +107,9 @@ cache_ioatc_iotlb(
 
     uint8_t i, replace = 0;
 
+    if ( IOATC_BYPASS() )
+        return;
+
     for ( i = 0; i < 1; i++ ) {
         if ( tlb[i].valid == 0 ) {
             replace = i; 
@@ -142,6 +153,9 @@ lookup_ioatc_iotlb(
 
     uint8_t i, hit;
 
+    if ( IOATC_BYPASS() )
+        return IOATC_MISS;
+
     hit = 0xFF;
     for ( i = 0; i < 1; i++ ) {
         if ( tlb[i].valid == 1 && 
@@ -152,7 +166,11 @@ lookup_ioatc_iotlb(
             break;
         }
     }
-    if ( hit == 0xFF ) return IOATC_MISS;
+    if ( hit == 0xFF ) {
+        g_trace_ioatc = TRACE_IOATC_MISS;
+        return IOATC_MISS;
+    }
+    g_trace_ioatc = TRACE_IOATC_HIT;
 
     // Age the entries
     tlb[0].lru = (hit == 0) ? 0 : 1;
@@ -4,232 +4,232 @@
 // Author: ved@rivosinc.com
 #include "iommu.h"
 
-itag_tracker_t itag_tracker[MAX_ITAGS] = {0};
+// ITAG N is busy when bit N of g_itag_busy is set. ITAGs are allocated only
+// by the command-queue but may be freed by invalidation completions or by
+// timeouts signaled on other threads. The bitmap is thus updated using atomic
+// operations and is published with release semantics after the tracker
+// fields of a newly allocated ITAG are initialized.
+_Atomic uint32_t g_itag_busy = 0;
+itag_tracker_t itag_tracker[MAX_ITAGS];
+
+// Invalidation request timeout in ticks of the virtual clock. When 0, the
+// timer is disabled and timeouts are signaled by the embedder using
+// do_ats_timer_expiry(). The wheel is operated on with the g_cq_lock held -
+// by the command processing when arming the ITAGs and by ats_timer_tick()
+// when expiring them.
+uint64_t g_ats_inv_req_timeout_ticks = 0;
+uint8_t  g_ats_timer_shift = 0;
+uint64_t g_ats_timer_last = 0;
+uint32_t g_ats_timer_armed = 0;
+uint64_t g_ats_timer_occupied = 0;
+uint32_t ats_timer_wheel[ATS_TIMER_WHEEL_SLOTS];
+static void expire_itags(uint32_t itag_vector);
+
+static void
+ats_timer_insert(
+    uint8_t itag) {
+    uint8_t slot;
+    slot = (itag_tracker[itag].deadline >> g_ats_timer_shift) & (ATS_TIMER_WHEEL_SLOTS - 1);
+    itag_tracker[itag].timer_slot = slot;
+    ats_timer_wheel[slot] |= (1UL << itag);
+    g_ats_timer_occupied |= (1ULL << slot);
+    g_ats_timer_armed |= (1UL << itag);
+    return;
+}
+static void
+ats_timer_remove(
+    uint8_t itag) {
+    uint8_t slot = itag_tracker[itag].timer_slot;
+    ats_timer_wheel[slot] &= ~(1UL << itag);
+    if ( ats_timer_wheel[slot] == 0 )
+        g_ats_timer_occupied &= ~(1ULL << slot);
+    g_ats_timer_armed &= ~(1UL << itag);
+    return;
+}
+void
+iommu_set_ats_inv_req_timeout(
+    uint64_t ticks) {
+    uint32_t armed;
+    uint8_t i;
+
+    RECORD(record_event(REC_EV_ATS_TIMEOUT, ticks));
+    while ( atomic_flag_test_and_set_explicit(&g_cq_lock, memory_order_acquire) )
+        ;
+    g_ats_inv_req_timeout_ticks = ticks;
+    // Size the slots such that the timeout spans less than one revolution
+    // of the wheel
+    g_ats_timer_shift = 0;
+    while ( (ticks >> g_ats_timer_shift) >= (ATS_TIMER_WHEEL_SLOTS - 1) )
+        g_ats_timer_shift++;
+    // Requests already pending retain their deadline but are rehashed to
+    // the slots for the new slot width
+    for ( armed = g_ats_timer_armed; armed != 0; armed &= (armed - 1) ) {
+        i = __builtin_ctz(armed);
+        ats_timer_remove(i);
+        ats_timer_insert(i);
+    }
+    atomic_flag_clear_explicit(&g_cq_lock, memory_order_release);
+    return;
+}
+// Expire the ITAGs whose deadline is at or before now. Only the slots
+// between the time of the last tick and now that hold ITAGs are visited.
+// If the command-queue is being processed by another thread then the
+// expiry is deferred to the next tick.
+void
+ats_timer_tick(
+    uint64_t now) {
+    uint64_t slots, range;
+    uint32_t busy, due, stale, pending, expired;
+    uint8_t first, last, s, i;
+
+    if ( atomic_flag_test_and_set_explicit(&g_cq_lock, memory_order_acquire) )
+        return;
+    if ( g_ats_timer_armed == 0 ) {
+        g_ats_timer_last = now;
+        atomic_flag_clear_explicit(&g_cq_lock, memory_order_release);
+        return;
+    }
+    if ( ((now >> g_ats_timer_shift) - (g_ats_timer_last >> g_ats_timer_shift)) >= 
+         (ATS_TIMER_WHEEL_SLOTS - 1) ) {
+        range = ~0ULL;
+    } else {
+        first = (g_ats_timer_last >> g_ats_timer_shift) & (ATS_TIMER_WHEEL_SLOTS - 1);
+        last = (now >> g_ats_timer_shift) & (ATS_TIMER_WHEEL_SLOTS - 1);
+        range = (first <= last) ? ((~0ULL >> (63 - last)) & (~0ULL << first)) :
+                                  ((~0ULL >> (63 - last)) | (~0ULL << first));
+    }
+    busy = atomic_load_explicit(&g_itag_busy, memory_order_acquire);
+    expired = 0;
+    for ( slots = g_ats_timer_occupied & range; slots != 0; slots &= (slots - 1) ) {
+        s = __builtin_ctzll(slots);
+        // ITAGs that completed since being armed are dropped from the wheel
+        stale = ats_timer_wheel[s] & ~busy;
+        due = 0;
+        for ( pending = ats_timer_wheel[s] & busy; pending != 0; pending &= (pending - 1) ) {
+            i = __builtin_ctz(pending);
+            if ( itag_tracker[i].deadline <= now )
+                due |= (1UL << i);
+        }
+        ats_timer_wheel[s] &= ~(stale | due);
+        if ( ats_timer_wheel[s] == 0 )
+            g_ats_timer_occupied &= ~(1ULL << s);
+        g_ats_timer_armed &= ~(stale | due);
+        expired |= due;
+    }
+    g_ats_timer_last = now;
+    if ( expired != 0 ) {
+        expire_itags(expired);
+        resume_itag_waiters();
+    }
+    atomic_flag_clear_explicit(&g_cq_lock, memory_order_release);
+    return;
+}
 
 uint8_t
 allocate_itag(
     uint8_t DSV, uint8_t DSEG, uint16_t RID, uint8_t *itag) { 
+    uint32_t busy;
     uint8_t i;
-    for ( i = 0; i < MAX_ITAGS; i++ )
-        if ( itag_tracker[i].free == 1 ) break;
 
-    if ( i == MAX_ITAGS )
+    // Bits are only cleared by the completion and timeout paths so a ITAG
+    // observed free here remains free till allocated below
+    busy = atomic_load_explicit(&g_itag_busy, memory_order_acquire);
+    if ( busy == ALL_ITAGS_BUSY )
         return 1;
+    i = __builtin_ctz(~busy);
 
-    itag_tracker[i].free = 0;
     itag_tracker[i].DSV = DSV;
     itag_tracker[i].DSEG = DSEG;
     itag_tracker[i].RID = RID;
-    itag_tracker[i].num_rsp_rcvd = 0;
+    atomic_store_explicit(&itag_tracker[i].num_rsp_rcvd, 0, memory_order_relaxed);
+
+    // Arm the timeout for the request. The ITAG may still be in the wheel
+    // if it completed since it was last armed.
+    if ( g_ats_timer_armed & (1UL << i) )
+        ats_timer_remove(i);
+    if ( g_ats_inv_req_timeout_ticks != 0 ) {
+        if ( g_ats_timer_armed == 0 )
+            g_ats_timer_last = g_iommu_clock;
+        itag_tracker[i].deadline = g_iommu_clock + g_ats_inv_req_timeout_ticks;
+        ats_timer_insert(i);
+    }
+    atomic_fetch_or_explicit(&g_itag_busy, (1UL << i), memory_order_release);
     *itag = i;
     return 0;
 }
 uint8_t
 any_ats_invalidation_requests_pending() {
-    uint8_t i;
-    for ( i = 0; i < MAX_ITAGS; i++ )
-        if ( itag_tracker[i].free != 0 ) 
-            return 1;
-    return 0;
+    return ( atomic_load_explicit(&g_itag_busy, memory_order_acquire) != 0 ) ? 1 : 0;
 }
 uint8_t
 handle_invalidation_completion(
     ats_msg_t *inv_cc) {
 
-    uint32_t itag_vector;
-    uint8_t cc, i;
+    uint32_t itag_vector, busy, pending, done;
+    uint8_t cc, i, count;
+
+    RECORD(record_invalidation_completion(inv_cc));
     itag_vector = get_bits(31, 0, inv_cc->PAYLOAD);
     cc = get_bits(34, 32, inv_cc->PAYLOAD);
-    for ( i = 0; i < MAX_ITAGS; i++ ) {
-        if ( itag_vector & (1UL << i) ) {
-            if ( itag_tracker[i].free == 1 ) 
-                return 1; // Unexpected completion
-            if ( (itag_tracker[i].DSV == 1) &&
-                 (inv_cc->DSV != 1 || inv_cc->DSEG != itag_tracker[i].DSEG) )
-                return 1; // Unexpected completion
-            if ( itag_tracker[i].RID != inv_cc->RID )
-                return 1; // Unexpected completion
-            itag_tracker[i].num_rsp_rcvd = 
-                (itag_tracker[i].num_rsp_rcvd + 1) & 0x07;
-            if ( itag_tracker[i].num_rsp_rcvd == cc )  {
-                itag_tracker[i].free = 1;
-            }
-        }
-    }
-    // If there were ATS.INVAL_REQ waiting on free
-    // itags then unblock them if any itag is now
-    // available
-    queue_any_blocked_ats_inval_req();
 
-    // Check if there are more pending invalidations
-    for ( i = 0; i < MAX_ITAGS; i++ ) {
-        if ( itag_tracker[i].free == 0 ) 
-            return 0;
+    // A completion for a ITAG that is not busy is unexpected
+    busy = atomic_load_explicit(&g_itag_busy, memory_order_acquire);
+    if ( itag_vector & ~busy )
+        return 1; // Unexpected completion
+
+    // Only the ITAGs in the vector are visited
+    for ( pending = itag_vector; pending != 0; pending &= (pending - 1) ) {
+        i = __builtin_ctz(pending);
+        if ( (itag_tracker[i].DSV == 1) &&
+             (inv_cc->DSV != 1 || inv_cc->DSEG != itag_tracker[i].DSEG) )
+            return 1; // Unexpected completion
+        if ( itag_tracker[i].RID != inv_cc->RID )
+            return 1; // Unexpected completion
     }
-    // No more pending invalidations - continue any pending IOFENCE.C
-    do_pending_iofence();
+    done = 0;
+    for ( pending = itag_vector; pending != 0; pending &= (pending - 1) ) {
+        i = __builtin_ctz(pending);
+        count = atomic_fetch_add_explicit(&itag_tracker[i].num_rsp_rcvd, 1,
+                                          memory_order_relaxed);
+        if ( ((count + 1) & 0x07) == cc )
+            done |= (1UL << i);
+    }
+    if ( done == 0 )
+        return 0;
+    // Only the completion is published here. A ATS.INVAL_REQ waiting on a
+    // free ITAG and a IOFENCE.C waiting for the invalidations to complete
+    // are resumed by the next invocation of process_commands().
+    atomic_fetch_and_explicit(&g_itag_busy, ~done, memory_order_acq_rel);
     return 0;
 }
-void
-do_ats_timer_expiry(uint32_t itag_vector) {
-    uint8_t i;
-    for ( i = 0; i < MAX_ITAGS; i++ ) {
-        if ( itag_vector & (1UL << i) ) {
-            itag_tracker[i].free = 1;
-        }
-    }
+// Expire the ITAGs. The expiries detected by ats_timer_tick() are not
+// recorded as they are replayed by the clock advances. As for completions,
+// the commands waiting on the ITAGs are resumed by process_commands().
+static void
+expire_itags(
+    uint32_t itag_vector) {
+    // A expiry for ITAGs that have all completed in the meanwhile is ignored
+    if ( (atomic_fetch_and_explicit(&g_itag_busy, ~itag_vector, 
+                                    memory_order_acq_rel) & itag_vector) == 0 )
+        return;
     g_ats_inv_req_timeout = 1;
-
-    // Check if there are more pending invalidations
-    for ( i = 0; i < MAX_ITAGS; i++ ) {
-        if ( itag_tracker[i].free == 0 ) 
-            return;
-    }
-    // No more pending invalidations - continue any pending IOFENCE.C
-    do_pending_iofence();
     return;
 }
 void
-handle_page_request(
-    ats_msg_t *pr) {
+do_ats_timer_expiry(uint32_t itag_vector) {
+    RECORD(record_event(REC_EV_ATS_TIMER_EXPIRY, itag_vector));
+    expire_itags(itag_vector);
+    return;
+}
+// Generate a "Page Request Group Response" for a "Page Request" that could
+// not be queued into the page-request queue.
+static void
+send_prgr(
+    ats_msg_t *pr, uint8_t response_code, uint8_t PRPR) {
     ats_msg_t prgr;
-    device_context_t DC;
-    page_rec_t prec;
     uint8_t L;
     uint16_t PRGI;
-    uint32_t device_id, cause, status, response_code;
-    uint64_t prec_addr;
-    uint64_t pqb;
-    uint32_t pqh;
-    uint32_t pqt;
-
-    // To process a "Page Request" or "Stop Marker" message, the IOMMU first
-    // locates the device-context to determine if ATS and PRI are enabled for
-    // the requestor. 
-    device_id =  ( pr->DSV == 1 ) ? (pr->RID | (pr->DSEG << 16)) : pr->RID;
-    if ( locate_device_context(&DC, device_id, pr->PV, pr->PID, &cause) ) {
-        report_fault(cause, PAGE_REQ_MSG_CODE, 0, MESSAGE_REQUEST, 0, 
-                     device_id, pr->PV, pr->PID, pr->PRIV);
-        response_code = RESPONSE_FAILURE;
-        goto send_prgr;
-    }
-    if ( DC.tc.EN_ATS == 0 || DC.tc.EN_PRI == 0 ) {
-        report_fault(cause, PAGE_REQ_MSG_CODE, 0, MESSAGE_REQUEST, 0, 
-                     device_id, pr->PV, pr->PID, pr->PRIV);
-        response_code = INVALID_REQUEST;
-        goto send_prgr;
-    }
-    // If ATS and PRI are enabled, i.e. EN_ATS and EN_PRI are both set to 1, 
-    // the IOMMU queues the message into an in-memory queue called the page 
-    // request-queue (PQ) (See Section 3.3). 
-    // When PRI is enabled for a device, the IOMMU may still be unable to report
-    // "Page Request" or "Stop Marker" messages through the PQ due to error 
-    // conditions such as the queue being disabled, queue being full, or the 
-    // IOMMU encountering access faults when attempting to access queue memory.
 
-    // The page-request-queue enable bit enables the 
-    // page-request-queue when set to 1. 
-    // The page-request-queue is active if pqon reads 1. 
-    // The IOMMU may respond to “Page Request” messages received
-    // when page-request-queue is off or in the process of being turned
-    // off, as specified in Section 2.8.
-    if ( g_reg_file.pqcsr.pqon == 0 || g_reg_file.pqcsr.pqen == 0 ) {
-        response_code = RESPONSE_FAILURE;
-        goto send_prgr;
-    }
-
-    // The pqmf bit is set to 1 if the IOMMU encounters an access fault
-    // when storing a page-request to the page-request queue. 
-    // The "Page Request" message that caused the pqmf or pqof error and
-    // all subsequent page-request messages are discarded till software
-    // clears the pqof and/or pqmf bits by writing 1 to it.
-    // The IOMMU may respond to “Page Request” messages that caused
-    // the pqof or pqmf bit to be set and all subsequent “Page Request”
-    // messages received while these bits are 1 as specified in Section 2.8.
-    if ( g_reg_file.pqcsr.pqmf == 1 ) {
-        response_code = RESPONSE_FAILURE;
-        goto send_prgr;
-    }
-
-    // The page-request-queue-overflow bit is set to 1 if the page-request
-    // queue overflows i.e. IOMMU needs to queue a page-request
-    // message but the page-request queue is full (i.e., pqh == pqt - 1).
-    // When pqof is set to 1, an interrupt is generated if not already
-    // pending (i.e. ipsr.pip == 1) and not masked (i.e. pqsr.pie == 1).
-    // The "Page Request" message that caused the pqmf or pqof error and
-    // all subsequent page-request messages are discarded till software
-    // clears the pqof and/or pqmf bits by writing 1 to it.
-    // The IOMMU may respond to “Page Request” messages that caused
-    // the pqof or pqmf bit to be set and all subsequent “Page Request”
-    // messages received while these bits are 1 as specified in Section 2.8.
-    if ( g_reg_file.pqcsr.pqof == 1 ) {
-        response_code = SUCCESS;
-        goto send_prgr;
-    }
-
-    // Page-request queue is an in-memory queue data structure used to report 
-    // PCIe ATS “Page Request” and "Stop Marker" messages to software. The base 
-    // PPN of this in-memory queue and the size of the queue is configured into 
-    // a memory-mapped register called page-request queue base (pqb). Each Page 
-    // Request record is 16 bytes.  The tail of the queue resides in a IOMMU 
-    // controlled read-only memory-mapped register called pqt.  The pqt holds an 
-    // index into the queue where the next page-request message will be written 
-    // by the IOMMU. Subsequent to writing the message, the IOMMU advances the pqt by 1.
-    // The head of the queue resides in a software controlled read/write memory-mapped 
-    // register called pqh. The pqh holds an index into the queue where the next 
-    // page-request message will be received by software. Subsequent to processing 
-    // the message(s) software advances the pqh by the count of the number of messages 
-    // processed.
-    // If pqh == pqt, the page-request queue is empty.
-    // If pqt == (pqh - 1) the page-request queue is full.
-    // The IOMMU may be unable to report "Page Request" messages through the queue 
-    // due to error conditions such as the queue being disabled, queue being full, or 
-    // the IOMMU encountering access faults when attempting to access queue memory. A 
-    // memory-mapped page-request queue control and status register (pqcsr) is used to 
-    // hold information about such faults. On a page queue full condition the 
-    // page-request-queue overflow (pqof) bit is set in pqcsr. If the IOMMU encountered 
-    // a fault in accessing the queue memory, page-request-queue memory access fault 
-    // (pqmf) bit in pqcsr. While either error bits are set in pqcsr, the IOMMU discards
-    // all subsequent "Page Request" messages; including the message that caused the error
-    // bits to be set. "Page request" messages that do not require a response, i.e. those 
-    // with the "Last Request in PRG" field is 0, are silently discarded. "Page request"
-    // messages that require a response, i.e. those with "Last Request in PRG" field set 
-    // to 1 and are not Stop Marker messages, may be auto-completed by an IOMMU generated 
-    // “Page Request Group Response” message as specified in Section 2.8.
-    // When an error bit is in the pqcsr changes state from 0 to 1 or when a new message
-    // is produced in the queue, page-request-queue interrupt pending (pip) bit is set 
-    // in the pqcsr
-    pqh = g_reg_file.pqh.index;
-    pqt = g_reg_file.pqt.index;
-    pqb = g_reg_file.pqb.ppn;
-    if ( pqt == (pqh - 1) ) {
-        g_reg_file.pqcsr.pqof = 1;
-        generate_interrupt(PAGE_QUEUE);
-        response_code = SUCCESS;
-        goto send_prgr;
-    }
-    prec.DID      = device_id;
-    prec.PID      = pr->PID;
-    prec.PV       = pr->PV;
-    prec.PRIV     = (pr->PV == 1) ? 0 : pr->PRIV;
-    prec.X        = (pr->PV == 1) ? 0 : pr->EXEC_REQ;
-    prec.PAYLOAD  = pr->PAYLOAD;
-    prec.reserved = 0;
-    prec_addr = ((pqb * 4096) | (pqt * 16));
-    status = write_memory((char *)&prec, prec_addr, 16);
-    if ( (status & ACCESS_FAULT) || (status & DATA_CORRUPTION) ) {
-        g_reg_file.pqcsr.pqmf = 1;
-        generate_interrupt(PAGE_QUEUE);
-        response_code = RESPONSE_FAILURE;
-        goto send_prgr;
-    }
-
-    pqt = (pqt + 1) & ((1UL << (g_reg_file.pqb.log2szm1 + 1)) - 1);
-    g_reg_file.pqt.index = pqt;
-    generate_interrupt(PAGE_QUEUE);
-    return;
-
-send_prgr:
     // If EN_PRI is set to 0, or EN_ATS is set to 0, or if the IOMMU is unable to 
     // locate the DC to determine the EN_PRI configuration, or the request could not 
     // be queued into PQ then the IOMMU behavior depends on the type of "Page Request".
@@ -276,7 +276,7 @@ send_prgr:
     // Group Response" with response code set to Response Failure, if the "Page Request" 
     // had a PASID then response is generated with a PASID.
     if ( response_code == INVALID_REQUEST || response_code == SUCCESS ) {
-        if ( DC.tc.PRPR == 1 ) {
+        if ( PRPR == 1 ) {
             prgr.PV = pr->PV;
             prgr.PID = pr->PID;
         } else {
@@ -292,8 +292,242 @@ send_prgr:
     // 0Ch|      Destination device ID        |  Resp  |RSVD | PRGI              |
     //    |                                   |  Code                            |
     // 08h|                  Reserved                                            |
-    prgr.PAYLOAD = (pr->RID << 16) | (response_code << 9) | PRGI;
+    prgr.PAYLOAD = (pr->RID << 16) | (response_code << 12) | PRGI;
     send_msg_iommu_to_hb(&prgr);
     return;
 }
+// Write the staged page-request records to the page-request queue. If the
+// write encounters a memory fault then the records preceding the faulting
+// record are retained and the "Page Request" messages for the faulting and
+// following records are responded to with Response Failure. Returns the
+// number of records written.
+static uint8_t
+write_page_records(
+    page_rec_t *prec, ats_msg_t **prs, uint8_t num_recs, uint32_t pqt) {
+    uint64_t prec_addr;
+    uint8_t status, i;
+
+    prec_addr = ((g_reg_file.pqb.ppn * 4096) | (pqt * 16));
+    status = write_memory((char *)prec, prec_addr, (num_recs * 16));
+    if ( (status & ACCESS_FAULT) == 0 && (status & DATA_CORRUPTION) == 0 )
+        return num_recs;
+    for ( i = 0; i < num_recs; i++ ) {
+        status = write_memory((char *)&prec[i], prec_addr + (i * 16), 16);
+        if ( (status & ACCESS_FAULT) || (status & DATA_CORRUPTION) )
+            break;
+    }
+    g_reg_file.pqcsr.pqmf = 1;
+    for ( status = i; status < num_recs; status++ )
+        send_prgr(prs[status], RESPONSE_FAILURE, 0);
+    return i;
+}
+void
+handle_page_request(
+    ats_msg_t *pr) {
+    handle_page_requests(pr, 1);
+    return;
+}
+// Process a batch of "Page Request" messages. The messages are grouped by the
+// device and the page request group such that the device context is located
+// once per device and the requests of a PRG are queued contiguously. A "Stop
+// Marker" must not pass the messages received before it, so the messages are
+// only grouped within the runs between Stop Markers. The records are written
+// to the page-request queue in bursts, the pqt is updated once and a single
+// interrupt is generated for the batch. Batches larger than PR_BATCH_MAX
+// messages are processed as multiple batches.
+void
+handle_page_requests(
+    ats_msg_t *prs, uint32_t num_msgs) {
+    ats_msg_t *pr, *burst_prs[PQ_BURST_RECORDS];
+    device_context_t DC;
+    page_rec_t burst[PQ_BURST_RECORDS];
+    uint16_t order[PR_BATCH_MAX];
+    uint64_t key[PR_BATCH_MAX], k, run;
+    uint32_t device_id, cause, dc_device_id, dc_status;
+    uint32_t pqh, pqt, i, j, n, qmask;
+    uint8_t num_burst, pq_updated;
 
+    while ( num_msgs > PR_BATCH_MAX ) {
+        handle_page_requests(prs, PR_BATCH_MAX);
+        prs += PR_BATCH_MAX;
+        num_msgs -= PR_BATCH_MAX;
+    }
+    // Group the messages by device and PRGI. The order of messages within a
+    // group is retained. A Stop Marker (L=1, W=0, R=0) is an ordering barrier
+    // - it is placed in a run of its own that follows the messages before it
+    // and precedes the messages after it.
+    run = 0;
+    for ( i = 0; i < num_msgs; i++ ) {
+        device_id = ( prs[i].DSV == 1 ) ? (prs[i].RID | (prs[i].DSEG << 16)) : prs[i].RID;
+        if ( get_bits(2, 0, prs[i].PAYLOAD) == 4 ) run++;
+        k = (run << 33) | ((uint64_t)device_id << 9) | get_bits(11, 3, prs[i].PAYLOAD);
+        if ( get_bits(2, 0, prs[i].PAYLOAD) == 4 ) run++;
+        for ( j = i; j > 0 && key[j - 1] > k; j-- ) {
+            key[j] = key[j - 1];
+            order[j] = order[j - 1];
+        }
+        key[j] = k;
+        order[j] = i;
+    }
+
+    qmask = ((1UL << (g_reg_file.pqb.log2szm1 + 1)) - 1);
+    pqh = g_reg_file.pqh.index;
+    pqt = g_reg_file.pqt.index;
+    num_burst = 0;
+    pq_updated = 0;
+    dc_device_id = 0;
+    dc_status = 0;
+    cause = 0;
+    for ( n = 0; n < num_msgs; n++ ) {
+        pr = &prs[order[n]];
+        // To process a "Page Request" or "Stop Marker" message, the IOMMU first
+        // locates the device-context to determine if ATS and PRI are enabled for
+        // the requestor. 
+        device_id =  ( pr->DSV == 1 ) ? (pr->RID | (pr->DSEG << 16)) : pr->RID;
+        if ( n == 0 || device_id != dc_device_id || dc_status != 0 ) {
+            dc_device_id = device_id;
+            dc_status = locate_device_context(&DC, device_id, pr->PV, pr->PID, &cause);
+        } else {
+            // The device context located for a previous message of this device
+            // is reused - count the lookup this message would have made
+            count_events(pr->PV, pr->PID, 0, 0, device_id, 0, 0, DDT_CACHE_HIT);
+        }
+        if ( dc_status ) {
+            report_fault(cause, PAGE_REQ_MSG_CODE, 0, MESSAGE_REQUEST, 0, 
+                         device_id, pr->PV, pr->PID, pr->PRIV);
+            send_prgr(pr, RESPONSE_FAILURE, 0);
+            continue;
+        }
+        if ( DC.tc.EN_ATS == 0 || DC.tc.EN_PRI == 0 ) {
+            // Transaction type disallowed
+            report_fault(260, PAGE_REQ_MSG_CODE, 0, MESSAGE_REQUEST, 0, 
+                         device_id, pr->PV, pr->PID, pr->PRIV);
+            send_prgr(pr, INVALID_REQUEST, DC.tc.PRPR);
+            continue;
+        }
+        // If ATS and PRI are enabled, i.e. EN_ATS and EN_PRI are both set to 1, 
+        // the IOMMU queues the message into an in-memory queue called the page 
+        // request-queue (PQ) (See Section 3.3). 
+        // When PRI is enabled for a device, the IOMMU may still be unable to report
+        // "Page Request" or "Stop Marker" messages through the PQ due to error 
+        // conditions such as the queue being disabled, queue being full, or the 
+        // IOMMU encountering access faults when attempting to access queue memory.
+
+        // The page-request-queue enable bit enables the 
+        // page-request-queue when set to 1. 
+        // The page-request-queue is active if pqon reads 1. 
+        // The IOMMU may respond to “Page Request” messages received
+        // when page-request-queue is off or in the process of being turned
+        // off, as specified in Section 2.8.
+        if ( g_reg_file.pqcsr.pqon == 0 || g_reg_file.pqcsr.pqen == 0 ) {
+            send_prgr(pr, RESPONSE_FAILURE, DC.tc.PRPR);
+            continue;
+        }
+
+        // The pqmf bit is set to 1 if the IOMMU encounters an access fault
+        // when storing a page-request to the page-request queue. 
+        // The "Page Request" message that caused the pqmf or pqof error and
+        // all subsequent page-request messages are discarded till software
+        // clears the pqof and/or pqmf bits by writing 1 to it.
+        // The IOMMU may respond to “Page Request” messages that caused
+        // the pqof or pqmf bit to be set and all subsequent “Page Request”
+        // messages received while these bits are 1 as specified in Section 2.8.
+        if ( g_reg_file.pqcsr.pqmf == 1 ) {
+            send_prgr(pr, RESPONSE_FAILURE, DC.tc.PRPR);
+            continue;
+        }
+
+        // The page-request-queue-overflow bit is set to 1 if the page-request
+        // queue overflows i.e. IOMMU needs to queue a page-request
+        // message but the page-request queue is full (i.e., pqh == pqt - 1).
+        // When pqof is set to 1, an interrupt is generated if not already
+        // pending (i.e. ipsr.pip == 1) and not masked (i.e. pqsr.pie == 1).
+        // The "Page Request" message that caused the pqmf or pqof error and
+        // all subsequent page-request messages are discarded till software
+        // clears the pqof and/or pqmf bits by writing 1 to it.
+        // The IOMMU may respond to “Page Request” messages that caused
+        // the pqof or pqmf bit to be set and all subsequent “Page Request”
+        // messages received while these bits are 1 as specified in Section 2.8.
+        if ( g_reg_file.pqcsr.pqof == 1 ) {
+            send_prgr(pr, SUCCESS, DC.tc.PRPR);
+            continue;
+        }
+
+        // Page-request queue is an in-memory queue data structure used to report 
+        // PCIe ATS “Page Request” and "Stop Marker" messages to software. The base 
+        // PPN of this in-memory queue and the size of the queue is configured into 
+        // a memory-mapped register called page-request queue base (pqb). Each Page 
+        // Request record is 16 bytes.  The tail of the queue resides in a IOMMU 
+        // controlled read-only memory-mapped register called pqt.  The pqt holds an 
+        // index into the queue where the next page-request message will be written 
+        // by the IOMMU. Subsequent to writing the message, the IOMMU advances the pqt by 1.
+        // The head of the queue resides in a software controlled read/write memory-mapped 
+        // register called pqh. The pqh holds an index into the queue where the next 
+        // page-request message will be received by software. Subsequent to processing 
+        // the message(s) software advances the pqh by the count of the number of messages 
+        // processed.
+        // If pqh == pqt, the page-request queue is empty.
+        // If pqt == (pqh - 1) the page-request queue is full.
+        // The IOMMU may be unable to report "Page Request" messages through the queue 
+        // due to error conditions such as the queue being disabled, queue being full, or 
+        // the IOMMU encountering access faults when attempting to access queue memory. A 
+        // memory-mapped page-request queue control and status register (pqcsr) is used to 
+        // hold information about such faults. On a page queue full condition the 
+        // page-request-queue overflow (pqof) bit is set in pqcsr. If the IOMMU encountered 
+        // a fault in accessing the queue memory, page-request-queue memory access fault 
+        // (pqmf) bit in pqcsr. While either error bits are set in pqcsr, the IOMMU discards
+        // all subsequent "Page Request" messages; including the message that caused the error
+        // bits to be set. "Page request" messages that do not require a response, i.e. those 
+        // with the "Last Request in PRG" field is 0, are silently discarded. "Page request"
+        // messages that require a response, i.e. those with "Last Request in PRG" field set 
+        // to 1 and are not Stop Marker messages, may be auto-completed by an IOMMU generated 
+        // “Page Request Group Response” message as specified in Section 2.8.
+        // When an error bit is in the pqcsr changes state from 0 to 1 or when a new message
+        // is produced in the queue, page-request-queue interrupt pending (pip) bit is set 
+        // in the pqcsr
+        if ( ((pqt + num_burst) & qmask) == ((pqh - 1) & qmask) ) {
+            // Write the records queued ahead of this one. If that encounters
+            // a memory fault then this request is discarded due to the pqmf.
+            if ( num_burst != 0 ) {
+                pqt = (pqt + write_page_records(burst, burst_prs, num_burst, pqt)) & qmask;
+                num_burst = 0;
+                pq_updated = 1;
+                if ( g_reg_file.pqcsr.pqmf == 1 ) {
+                    send_prgr(pr, RESPONSE_FAILURE, DC.tc.PRPR);
+                    continue;
+                }
+            }
+            g_reg_file.pqcsr.pqof = 1;
+            pq_updated = 1;
+            send_prgr(pr, SUCCESS, DC.tc.PRPR);
+            continue;
+        }
+        burst[num_burst].DID      = device_id;
+        burst[num_burst].PID      = pr->PID;
+        burst[num_burst].PV       = pr->PV;
+        burst[num_burst].PRIV     = (pr->PV == 1) ? 0 : pr->PRIV;
+        burst[num_burst].X        = (pr->PV == 1) ? 0 : pr->EXEC_REQ;
+        burst[num_burst].PAYLOAD  = pr->PAYLOAD;
+        burst[num_burst].reserved = 0;
+        burst_prs[num_burst] = pr;
+        num_burst++;
+        // A burst is written when full or when the queue wraps
+        if ( num_burst == PQ_BURST_RECORDS || ((pqt + num_burst) & qmask) == 0 ) {
+            pqt = (pqt + write_page_records(burst, burst_prs, num_burst, pqt)) & qmask;
+            num_burst = 0;
+            pq_updated = 1;
+        }
+    }
+    if ( num_burst != 0 ) {
+        pqt = (pqt + write_page_records(burst, burst_prs, num_burst, pqt)) & qmask;
+        pq_updated = 1;
+    }
+    // When an error bit in the pqcsr changes state from 0 to 1 or when new
+    // messages are produced in the queue, the page-request-queue interrupt
+    // is generated
+    if ( pq_updated ) {
+        g_reg_file.pqt.index = pqt;
+        generate_interrupt(PAGE_QUEUE);
+    }
+    return;
+}
@@ -0,0 +1,26 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include "iommu.h"
+uint64_t g_iommu_clock = 0;
+
+uint64_t
+iommu_get_clock(
+    void) {
+    return g_iommu_clock;
+}
+// Advance the virtual clock by the specified number of ticks and process
+// the timed events that are now due. Must be invoked from the thread that
+// invokes process_commands().
+void
+iommu_advance_clock(
+    uint64_t ticks) {
+    RECORD(record_event(REC_EV_CLOCK, ticks));
+    g_iommu_clock += ticks;
+    ats_timer_tick(g_iommu_clock);
+    hpm_clock_tick(g_iommu_clock);
+    interrupt_clock_tick(g_iommu_clock);
+    flush_fault_queue();
+    return;
+}
@@ -4,7 +4,7 @@
 // Author: ved@rivosinc.com
 #include "iommu.h"
 uint8_t g_command_queue_stall_for_itag = 0;
-uint8_t g_ats_inv_req_timeout = 0;
+_Atomic uint8_t g_ats_inv_req_timeout = 0;
 uint8_t g_iofence_wait_pending_inv = 0;
 uint8_t g_iofence_pending_PR, g_iofence_pending_PW, g_iofence_pending_AV, g_iofence_pending_WIS_BIT; 
 uint64_t g_iofence_pending_ADDR; 
@@ -17,8 +17,28 @@ uint8_t g_pending_inval_req_PV;
 uint32_t g_pending_inval_req_PID;
 uint64_t g_pending_inval_req_PAYLOAD;
 
+// Held while the command-queue state is being operated on. Invalidation
+// completions and timeouts may be signaled from threads other than the one
+// invoking process_commands() but only publish the freed ITAGs. The commands
+// waiting on ITAGs are resumed with this lock held by process_commands() and
+// by the ATS timer when the clock advances.
+atomic_flag g_cq_lock = ATOMIC_FLAG_INIT;
+
+static void process_command(void);
+
 void
 process_commands(
+    void) {
+    RECORD(record_process_commands());
+    if ( atomic_flag_test_and_set_explicit(&g_cq_lock, memory_order_acquire) )
+        return;
+    resume_itag_waiters();
+    process_command();
+    atomic_flag_clear_explicit(&g_cq_lock, memory_order_release);
+    return;
+}
+static void
+process_command(
     void) {
     uint8_t status, opcode, func3, GV, AV, PSCV, DV, DSV, PV, DSEG, PR, PW, WIS_BIT, itag;
     uint16_t RID;
@@ -87,6 +107,7 @@ process_commands(
     // or more of those fields may be used by the specific function invoked.
     opcode = get_bits(6, 0, command.low);
     func3  = get_bits(9, 7, command.low);
+    TRACE(TRACE_COMMAND, opcode, func3, 0, 0, g_reg_file.cqh.index, command.low, command.high);
 
     switch ( opcode ) {
         case IOTINVAL:
@@ -95,7 +116,8 @@ process_commands(
             GV       = get_bits(12, 12, command.low);
             PSCID    = get_bits(35, 16, command.low);
             GSCID    = get_bits(55, 40, command.low);
-            ADDR     = get_bits(52,  0, command.high);
+            // The ADDR operand holds bits 63:12 of the address
+            ADDR     = get_bits(51,  0, command.high) * PAGESIZE;
             reserved = get_bits(15, 13, command.low);
             reserved|= get_bits(39, 36, command.low);
             reserved|= get_bits(63, 56, command.low);
@@ -196,6 +218,8 @@ process_commands(
                         g_pending_inval_req_PID = PID;
                         g_pending_inval_req_PAYLOAD = PAYLOAD;
                         g_command_queue_stall_for_itag = 1;
+                        count_events(PV, PID, 0, 0, ((DSV == 1) ? (RID | (DSEG << 16)) : RID),
+                                     0, 0, ITAG_STALLS);
                     } else {
                         // ITAG allocated successfully, send invalidate request
                         do_ats_msg(INVAL_REQ_MSG_CODE, itag, DSV, DSEG, RID, PV, PID, PAYLOAD);
@@ -206,6 +230,7 @@ process_commands(
                     break;
                 default: goto command_illegal;
             }
+            break;
         default: goto command_illegal;
     }
     // The head of the command-queue resides in a read-only memory-mapped IOMMU
@@ -503,21 +528,33 @@ do_iofence_c(
 // Retry a pending IOFENCE if all invalidations received
 void
 do_pending_iofence() {
-    if ( g_iofence_wait_pending_inv == 1 ) {
-        do_iofence_c(g_iofence_pending_PR, g_iofence_pending_PW, g_iofence_pending_AV, 
-                     g_iofence_pending_WIS_BIT, g_iofence_pending_ADDR, g_iofence_pending_DATA);
-    }
-    // If not still pending then advance the CQH
-    if ( g_iofence_wait_pending_inv == 1 ) {
+    if ( g_iofence_wait_pending_inv == 0 )
+        return;
+    // If the IOFENCE.C completed then advance the CQH. If it encountered a
+    // memory fault or timeout then the CQH continues to point to it.
+    if ( do_iofence_c(g_iofence_pending_PR, g_iofence_pending_PW, g_iofence_pending_AV, 
+                      g_iofence_pending_WIS_BIT, g_iofence_pending_ADDR, 
+                      g_iofence_pending_DATA) == 0 ) {
         g_reg_file.cqh.index =  
             (g_reg_file.cqh.index + 1) & ((1UL << (g_reg_file.cqb.log2szm1 + 1)) - 1);
     }
     return;
 }
+// Resume commands waiting on ITAGs - a ATS.INVAL waiting for a free ITAG
+// and a IOFENCE.C waiting for all invalidations to complete. Must be
+// invoked with the g_cq_lock held.
+void
+resume_itag_waiters() {
+    if ( g_command_queue_stall_for_itag != 0 )
+        queue_any_blocked_ats_inval_req();
+    if ( g_iofence_wait_pending_inv != 0 && any_ats_invalidation_requests_pending() == 0 )
+        do_pending_iofence();
+    return;
+}
 void 
 queue_any_blocked_ats_inval_req() {
     uint8_t itag;
-    if ( g_command_queue_stall_for_itag == 0 ) {
+    if ( g_command_queue_stall_for_itag == 1 ) {
         // Allocate a ITAG for the request
         if ( allocate_itag(g_pending_inval_req_DSV, g_pending_inval_req_DSEG, 
                            g_pending_inval_req_RID, &itag) )
@@ -0,0 +1,159 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include <inttypes.h>
+#include "iommu.h"
+#ifdef IOMMU_COST_STATS
+// Cost accumulated by the request being processed
+iommu_cost_t g_cost;
+// Histograms per transaction type
+static cost_hist_t ttyp_cost[COST_STATS_MAX_TTYP];
+// Histograms per device_id. The devices are tracked in a open addressed
+// hash table. Requests from devices that do not fit in the table are
+// accumulated in the overflow histogram.
+static struct {
+    uint32_t    device_id;
+    uint8_t     valid;
+    cost_hist_t cost;
+} dev_cost[COST_STATS_MAX_DEVICES];
+static cost_hist_t dev_overflow_cost;
+
+static void
+add_cost(
+    cost_hist_t *h, uint32_t cost) {
+    uint8_t bucket;
+
+    bucket = ( cost == 0 ) ? 0 : (32 - __builtin_clz(cost));
+    if ( bucket >= COST_HIST_BUCKETS ) bucket = COST_HIST_BUCKETS - 1;
+    h->requests++;
+    h->mem_reads += g_cost.mem_reads;
+    h->g_walks += g_cost.g_walks;
+    h->ad_amos += g_cost.ad_amos;
+    h->hist[bucket]++;
+    return;
+}
+static cost_hist_t *
+find_device_cost(
+    uint32_t device_id, uint8_t allocate) {
+    uint8_t i, n;
+
+    i = (device_id * 2654435761U) >> 26;
+    for ( n = 0; n < COST_STATS_MAX_DEVICES; n++ ) {
+        if ( dev_cost[i].valid == 0 ) {
+            if ( allocate == 0 ) return NULL;
+            dev_cost[i].valid = 1;
+            dev_cost[i].device_id = device_id;
+            return &dev_cost[i].cost;
+        }
+        if ( dev_cost[i].device_id == device_id )
+            return &dev_cost[i].cost;
+        i = (i + 1) % COST_STATS_MAX_DEVICES;
+    }
+    return ( allocate == 0 ) ? NULL : &dev_overflow_cost;
+}
+// Record the cost accumulated by the request that completed
+void
+record_cost(
+    uint8_t TTYP, uint32_t device_id) {
+    uint32_t cost;
+
+    cost = g_cost.mem_reads + g_cost.ad_amos;
+    add_cost(&ttyp_cost[TTYP % COST_STATS_MAX_TTYP], cost);
+    add_cost(find_device_cost(device_id, 1), cost);
+    return;
+}
+// Get the cost histogram of a transaction type. Returns 1 if the
+// transaction type is not valid.
+uint8_t
+iommu_get_ttyp_cost(
+    uint8_t TTYP, cost_hist_t *h) {
+    if ( TTYP >= COST_STATS_MAX_TTYP )
+        return 1;
+    *h = ttyp_cost[TTYP];
+    return 0;
+}
+// Get the cost histogram of a device. Returns 1 if no requests from
+// the device were recorded.
+uint8_t
+iommu_get_device_cost(
+    uint32_t device_id, cost_hist_t *h) {
+    cost_hist_t *dh;
+
+    if ( (dh = find_device_cost(device_id, 0)) == NULL )
+        return 1;
+    *h = *dh;
+    return 0;
+}
+void
+iommu_clear_cost_stats(
+    void) {
+    memset(ttyp_cost, 0, sizeof(ttyp_cost));
+    memset(dev_cost, 0, sizeof(dev_cost));
+    memset(&dev_overflow_cost, 0, sizeof(dev_overflow_cost));
+    return;
+}
+static void
+dump_cost_hist(
+    FILE *fp, cost_hist_t *h) {
+    uint8_t i;
+
+    fprintf(fp, "{\"requests\": %" PRIu64 ", \"mem_reads\": %" PRIu64
+            ", \"g_walks\": %" PRIu64 ", \"ad_amos\": %" PRIu64 ", \"hist\": [",
+            h->requests, h->mem_reads, h->g_walks, h->ad_amos);
+    for ( i = 0; i < COST_HIST_BUCKETS; i++ )
+        fprintf(fp, "%s%" PRIu64, (i == 0) ? "" : ", ", h->hist[i]);
+    fprintf(fp, "]}");
+    return;
+}
+// Dump the cost statistics as a JSON object
+void
+iommu_dump_cost_stats(
+    FILE *fp) {
+    uint8_t i, first;
+
+    fprintf(fp, "{\n  \"ttyp\": {");
+    first = 1;
+    for ( i = 0; i < COST_STATS_MAX_TTYP; i++ ) {
+        if ( ttyp_cost[i].requests == 0 ) continue;
+        fprintf(fp, "%s\n    \"%u\": ", (first == 1) ? "" : ",", i);
+        dump_cost_hist(fp, &ttyp_cost[i]);
+        first = 0;
+    }
+    fprintf(fp, "\n  },\n  \"device\": {");
+    first = 1;
+    for ( i = 0; i < COST_STATS_MAX_DEVICES; i++ ) {
+        if ( dev_cost[i].valid == 0 ) continue;
+        fprintf(fp, "%s\n    \"0x%06x\": ", (first == 1) ? "" : ",", dev_cost[i].device_id);
+        dump_cost_hist(fp, &dev_cost[i].cost);
+        first = 0;
+    }
+    if ( dev_overflow_cost.requests != 0 ) {
+        fprintf(fp, "%s\n    \"other\": ", (first == 1) ? "" : ",");
+        dump_cost_hist(fp, &dev_overflow_cost);
+    }
+    fprintf(fp, "\n  }\n}\n");
+    return;
+}
+#else
+uint8_t
+iommu_get_ttyp_cost(
+    uint8_t TTYP, cost_hist_t *h) {
+    return 1;
+}
+uint8_t
+iommu_get_device_cost(
+    uint32_t device_id, cost_hist_t *h) {
+    return 1;
+}
+void
+iommu_clear_cost_stats(
+    void) {
+    return;
+}
+void
+iommu_dump_cost_stats(
+    FILE *fp) {
+    return;
+}
+#endif // IOMMU_COST_STATS
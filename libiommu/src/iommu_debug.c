@@ -0,0 +1,68 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include "iommu.h"
+// Controls for the debug translation in progress
+uint8_t g_dbg_tr_flags = 0;
+
+// Translate the IOVA as an untranslated request with the attributes in ctrl
+// and provide the results in the format of the tr_response register
+void
+debug_translate(
+    tr_req_iova_t iova, tr_req_ctrl_t ctrl, tr_response_t *rsp) {
+    hb_to_iommu_req_t req; 
+    iommu_to_hb_rsp_t rsp_msg;
+    uint8_t flags, recording;
+
+    // The request is not recorded as replaying the write to tr_req_ctrl
+    // that initiated it makes the request again
+    flags = g_dbg_tr_flags;
+    recording = g_recording;
+    g_recording = 0;
+    if ( ctrl.NoCache == 1 )
+        g_dbg_tr_flags |= DBG_TR_NO_CACHE;
+
+    req.device_id = ctrl.DID;
+    req.pid_valid = ctrl.PV;
+    req.process_id = ctrl.PID;
+    req.no_write = 0;
+    req.exec_req = ctrl.Exe;
+    req.priv_req = ctrl.Priv;
+    req.is_cxl_dev = 0;
+    req.tr.at = ADDR_TYPE_UNTRANSLATED;
+    req.tr.iova = iova.raw;
+    req.tr.length = 1;
+    req.tr.read_writeAMO = (ctrl.RWn == 1) ? READ : WRITE;
+    req.tr.msi_wr_data = 0;
+
+    iommu_translate_iova(&req, &rsp_msg);
+
+    rsp->raw = 0;
+    rsp->fault = (rsp_msg.status == SUCCESS) ? 0 : 1;
+    rsp->PPN = rsp_msg.trsp.PPN;
+    rsp->S = rsp_msg.trsp.S;
+    rsp->PBMT = rsp_msg.trsp.PBMT;
+
+    g_dbg_tr_flags = flags;
+    g_recording = recording;
+    return;
+}
+// Translate a batch of num_reqs debug translation requests. The result of
+// each request is provided in rsps in the format of the tr_response
+// register. The flags are a combination of DBG_TR_NO_CACHE and
+// DBG_TR_NO_FAULT. Returns the number of requests that faulted.
+uint32_t
+iommu_debug_translate(
+    dbg_tr_req_t *reqs, tr_response_t *rsps, uint32_t num_reqs, uint8_t flags) {
+    uint32_t i, faults;
+
+    g_dbg_tr_flags = flags & (DBG_TR_NO_CACHE | DBG_TR_NO_FAULT);
+    faults = 0;
+    for ( i = 0; i < num_reqs; i++ ) {
+        debug_translate(reqs[i].iova, reqs[i].ctrl, &rsps[i]);
+        faults += rsps[i].fault;
+    }
+    g_dbg_tr_flags = 0;
+    return faults;
+}
@@ -5,6 +5,101 @@
 
 #include "iommu.h"
 
+// Determine if the device context is misconfigured - steps 10 and 11 of the
+// process to locate the device context. Returns 1 if the DC is misconfigured.
+uint8_t
+is_dc_misconfigured(
+    device_context_t *DC) {
+    //10. If any bits or encoding that are reserved for future standard use are set
+    //    within `DC`, stop and report "DDT entry misconfigured" (cause = 259).
+    if ( ((g_reg_file.capabilities.msi_flat == 1) && (DC->reserved != 0)) ||
+         ((g_reg_file.capabilities.msi_flat == 1) && (DC->msiptp.reserved != 0)) ||
+         ((g_reg_file.capabilities.msi_flat == 1) && (DC->msi_addr_mask.reserved != 0)) ||
+         ((g_reg_file.capabilities.msi_flat == 1) && (DC->msi_addr_pattern.reserved != 0)) ||
+         (DC->tc.reserved != 0) ||
+         (DC->fsc.pdtp.reserved != 0 && DC->tc.PDTV == 1) ||
+         (DC->fsc.iosatp.reserved != 0 && DC->tc.PDTV == 0) ||
+         (DC->ta.reserved != 0) ) {
+        return 1;
+    }
+    if ( (DC->iohgatp.MODE != IOHGATP_Bare) &&
+         (DC->iohgatp.MODE != IOHGATP_Sv32x4) &&
+         (DC->iohgatp.MODE != IOHGATP_Sv39x4) &&
+         (DC->iohgatp.MODE != IOHGATP_Sv48x4) &&
+         (DC->iohgatp.MODE != IOHGATP_Sv57x4) ) {
+        return 1;
+    }
+    if ( (DC->tc.PDTV == 0) && 
+         ((DC->fsc.iosatp.MODE != IOSATP_Bare) &&
+          (DC->fsc.iosatp.MODE != IOSATP_Sv32) &&
+          (DC->fsc.iosatp.MODE != IOSATP_Sv39) &&
+          (DC->fsc.iosatp.MODE != IOSATP_Sv48) &&
+          (DC->fsc.iosatp.MODE != IOSATP_Sv57)) ) {
+        return 1;
+    }
+    //11. If any of the following conditions are true then stop and report 
+    //    "DDT entry misconfigured" (cause = 259).
+    //    a. `capabilities.ATS` is 0 and `DC.tc.EN_ATS`, or `DC.tc.EN_PRI`, 
+    //       or `DC.tc.PRPR` is 1
+    //    b. `DC.tc.EN_ATS` is 0 and `DC.tc.T2GPA` is 1
+    //    c. `DC.tc.EN_ATS` is 0 and `DC.tc.EN_PRI` is 1
+    //    d. `DC.tc.EN_PRI` is 0 and `DC.tc.PRPR` is 1
+    //    e. `capabilities.T2GPA` is 0 and `DC.tc.T2GPA` is 1
+    if ( ((DC->tc.EN_ATS || DC->tc.EN_PRI || DC->tc.PRPR) &&
+          (g_reg_file.capabilities.ats == 0)) ||
+         ((DC->tc.EN_ATS == 0) && (DC->tc.T2GPA == 1 || DC->tc.EN_PRI == 1)) ||
+         ((DC->tc.EN_PRI == 0) && (DC->tc.PRPR == 1)) ||
+         (DC->tc.T2GPA && (g_reg_file.capabilities.t2gpa == 0)) ) {
+        return 1;
+    }
+    //11. If any of the following conditions are true then stop and report 
+    //    "DDT entry misconfigured" (cause = 259).
+    //    f. `DC.tc.PDTV` is 1 and `DC.fsc.pdtp.MODE` is not a supported mode
+    //        (Table 2)
+    if ( (DC->tc.PDTV == 1) && 
+         ((DC->fsc.pdtp.MODE != PDTP_Bare) &&
+          (DC->fsc.pdtp.MODE != PD20) &&
+          (DC->fsc.pdtp.MODE != PD17) &&
+          (DC->fsc.pdtp.MODE != PD8)) ) {
+        return 1;
+    }
+    //11. If any of the following conditions are true then stop and report 
+    //    "DDT entry misconfigured" (cause = 259).
+    //    g. DC.tc.PDTV is 0 and DC.fsc.iosatp.MODE is not one of the supported modes
+    //         i. capabilities.Sv32 is 0 and DC.fsc.iosatp.MODE is Sv32
+    //        ii. capabilities.Sv39 is 0 and DC.fsc.iosatp.MODE is Sv39
+    //       iii. capabilities.Sv48 is 0 and DC.fsc.iosatp.MODE is Sv48
+    //        iv. capabilities.Sv57 is 0 and DC.fsc.iosatp.MODE is Sv57
+    if ( (DC->tc.PDTV == 0) && 
+         (((DC->fsc.iosatp.MODE == IOSATP_Sv32) && (g_reg_file.capabilities.Sv32 == 0)) ||
+          ((DC->fsc.iosatp.MODE == IOSATP_Sv39) && (g_reg_file.capabilities.Sv39 == 0)) ||
+          ((DC->fsc.iosatp.MODE == IOSATP_Sv48) && (g_reg_file.capabilities.Sv48 == 0)) ||
+          ((DC->fsc.iosatp.MODE == IOSATP_Sv57) && (g_reg_file.capabilities.Sv57 == 0))) ) {
+        return 1;
+    }
+    //11. If any of the following conditions are true then stop and report 
+    //    "DDT entry misconfigured" (cause = 259).
+    //    h. `capabilities.Sv32x4` is 0 and `DC.iohgatp.MODE` is `Sv32x4`
+    //    i. `capabilities.Sv39x4` is 0 and `DC.iohgatp.MODE` is `Sv39x4`
+    //    j. `capabilities.Sv48x4` is 0 and `DC.iohgatp.MODE` is `Sv48x4`
+    //    k. `capabilities.Sv57x4` is 0 and `DC.iohgatp.MODE` is `Sv57x4`
+    if ( ((DC->iohgatp.MODE == IOHGATP_Sv32x4) && (g_reg_file.capabilities.Sv32x4 == 0)) ||
+         ((DC->iohgatp.MODE == IOHGATP_Sv39x4) && (g_reg_file.capabilities.Sv39x4 == 0)) ||
+         ((DC->iohgatp.MODE == IOHGATP_Sv48x4) && (g_reg_file.capabilities.Sv48x4 == 0)) ||
+         ((DC->iohgatp.MODE == IOHGATP_Sv57x4) && (g_reg_file.capabilities.Sv57x4 == 0)) ) {
+        return 1;
+    }
+    //11. If any of the following conditions are true then stop and report 
+    //    "DDT entry misconfigured" (cause = 259).
+    //    l. `capabilities.MSI_FLAT` is 1 and `DC.msiptp.MODE` is not `Bare` 
+    //       and not `Flat`  
+    if ( (g_reg_file.capabilities.msi_flat == 1) && 
+         ((DC->msiptp.MODE != MSIPTP_Bare) &&
+          (DC->msiptp.MODE != MSIPTP_Flat)) ) {
+        return 1;
+    }
+    return 0;
+}
 uint8_t
 locate_device_context(
     device_context_t *DC, uint32_t device_id, 
@@ -83,8 +178,11 @@ locate_device_context(
     }
 
     // Determine if there is a cached device context
-    if ( lookup_ioatc_dc(device_id, DC) == IOATC_HIT )
+    if ( lookup_ioatc_dc(device_id, DC) == IOATC_HIT ) {
+        count_events(pid_valid, process_id, 0, 0, device_id, 0, 0, DDT_CACHE_HIT);
         return 0;
+    }
+    count_events(pid_valid, process_id, 0, 0, device_id, 0, 0, DDT_CACHE_MISS);
 
     // The process to locate the Device-context for transaction 
     // using its `device_id` is as follows:
@@ -107,6 +205,7 @@ step_2:
     // 3. Let `ddte` be value of eight bytes at address `a + DDI[i] x 8`. If accessing
     //    `ddte` violates a PMA or PMP check, then stop and report "DDT entry load
     //     access fault" (cause = 257).
+    COST_MEM_READ();
     status = read_memory((a + (DDI[i] * 8)), 8, (char *)&ddte.raw);
     if ( status & ACCESS_FAULT ) {
         *cause = 257;     // DDT entry load access fault
@@ -152,6 +251,7 @@ step_8:
     //    (cause = 268). This fault is detected if the IOMMU supports the RAS capability
     //    (`capabilities.RAS == 1`).
     DC_SIZE = ( g_reg_file.capabilities.msi_flat == 1 ) ? EXT_FORMAT_DC_SIZE : BASE_FORMAT_DC_SIZE;
+    COST_MEM_READ();
     status = read_memory((a + (DDI[0] * DC_SIZE)), DC_SIZE, (char *)DC);
     if ( status & ACCESS_FAULT ) {
         *cause = 257;     // DDT entry load access fault
@@ -168,97 +268,9 @@ step_8:
     }
     //10. If any bits or encoding that are reserved for future standard use are set
     //    within `DC`, stop and report "DDT entry misconfigured" (cause = 259).
-    if ( ((g_reg_file.capabilities.msi_flat == 1) && (DC->reserved != 0)) ||
-         ((g_reg_file.capabilities.msi_flat == 1) && (DC->msiptp.reserved != 0)) ||
-         ((g_reg_file.capabilities.msi_flat == 1) && (DC->msi_addr_mask.reserved != 0)) ||
-         ((g_reg_file.capabilities.msi_flat == 1) && (DC->msi_addr_pattern.reserved != 0)) ||
-         (DC->tc.reserved != 0) ||
-         (DC->fsc.pdtp.reserved != 0 && DC->tc.PDTV == 1) ||
-         (DC->fsc.iosatp.reserved != 0 && DC->tc.PDTV == 0) ||
-         (DC->ta.reserved != 0) ) {
-        *cause = 259;     // DDT entry misconfigured
-        return 1;
-    }
-    if ( (DC->iohgatp.MODE != IOHGATP_Bare) &&
-         (DC->iohgatp.MODE != IOHGATP_Sv32x4) &&
-         (DC->iohgatp.MODE != IOHGATP_Sv39x4) &&
-         (DC->iohgatp.MODE != IOHGATP_Sv48x4) &&
-         (DC->iohgatp.MODE != IOHGATP_Sv57x4) ) {
-        *cause = 259;     // DDT entry misconfigured
-        return 1;
-    }
-    if ( (DC->tc.PDTV == 0) && 
-         ((DC->fsc.iosatp.MODE != IOSATP_Bare) &&
-          (DC->fsc.iosatp.MODE != IOSATP_Sv32) &&
-          (DC->fsc.iosatp.MODE != IOSATP_Sv39) &&
-          (DC->fsc.iosatp.MODE != IOSATP_Sv48) &&
-          (DC->fsc.iosatp.MODE != IOSATP_Sv57)) ) {
-        *cause = 259;     // DDT entry misconfigured
-        return 1;
-    }
-    //11. If any of the following conditions are true then stop and report 
-    //    "DDT entry misconfigured" (cause = 259).
-    //    a. `capabilities.ATS` is 0 and `DC.tc.EN_ATS`, or `DC.tc.EN_PRI`, 
-    //       or `DC.tc.PRPR` is 1
-    //    b. `DC.tc.EN_ATS` is 0 and `DC.tc.T2GPA` is 1
-    //    c. `DC.tc.EN_ATS` is 0 and `DC.tc.EN_PRI` is 1
-    //    d. `DC.tc.EN_PRI` is 0 and `DC.tc.PRPR` is 1
-    //    e. `capabilities.T2GPA` is 0 and `DC.tc.T2GPA` is 1
-    if ( ((DC->tc.EN_ATS || DC->tc.EN_PRI || DC->tc.PRPR) &&
-          (g_reg_file.capabilities.ats == 0)) ||
-         ((DC->tc.EN_ATS == 0) && (DC->tc.T2GPA == 1 || DC->tc.EN_PRI == 1)) ||
-         ((DC->tc.EN_PRI == 0) && (DC->tc.PRPR == 1)) ||
-         (DC->tc.T2GPA && (g_reg_file.capabilities.t2gpa == 0)) ) {
-        *cause = 259;     // DDT entry misconfigured
-        return 1;
-    }
-    //11. If any of the following conditions are true then stop and report 
-    //    "DDT entry misconfigured" (cause = 259).
-    //    f. `DC.tc.PDTV` is 1 and `DC.fsc.pdtp.MODE` is not a supported mode
-    //        (Table 2)
-    if ( (DC->tc.PDTV == 1) && 
-         ((DC->fsc.pdtp.MODE != PDTP_Bare) &&
-          (DC->fsc.pdtp.MODE != PD20) &&
-          (DC->fsc.pdtp.MODE != PD17) &&
-          (DC->fsc.pdtp.MODE != PD8)) ) {
-        *cause = 259;     // DDT entry misconfigured
-        return 1;
-    }
-    //11. If any of the following conditions are true then stop and report 
-    //    "DDT entry misconfigured" (cause = 259).
-    //    g. DC.tc.PDTV is 0 and DC.fsc.iosatp.MODE is not one of the supported modes
-    //         i. capabilities.Sv32 is 0 and DC.fsc.iosatp.MODE is Sv32
-    //        ii. capabilities.Sv39 is 0 and DC.fsc.iosatp.MODE is Sv39
-    //       iii. capabilities.Sv48 is 0 and DC.fsc.iosatp.MODE is Sv48
-    //        iv. capabilities.Sv57 is 0 and DC.fsc.iosatp.MODE is Sv57
-    if ( (DC->tc.PDTV == 0) && 
-         (((DC->fsc.iosatp.MODE == IOSATP_Sv32) && (g_reg_file.capabilities.Sv32 == 0)) ||
-          ((DC->fsc.iosatp.MODE == IOSATP_Sv39) && (g_reg_file.capabilities.Sv39 == 0)) ||
-          ((DC->fsc.iosatp.MODE == IOSATP_Sv48) && (g_reg_file.capabilities.Sv48 == 0)) ||
-          ((DC->fsc.iosatp.MODE == IOSATP_Sv57) && (g_reg_file.capabilities.Sv57 == 0))) ) {
-        *cause = 259;     // DDT entry misconfigured
-        return 1;
-    }
-    //11. If any of the following conditions are true then stop and report 
-    //    "DDT entry misconfigured" (cause = 259).
-    //    h. `capabilities.Sv32x4` is 0 and `DC.iohgatp.MODE` is `Sv32x4`
-    //    i. `capabilities.Sv39x4` is 0 and `DC.iohgatp.MODE` is `Sv39x4`
-    //    j. `capabilities.Sv48x4` is 0 and `DC.iohgatp.MODE` is `Sv48x4`
-    //    k. `capabilities.Sv57x4` is 0 and `DC.iohgatp.MODE` is `Sv57x4`
-    if ( ((DC->iohgatp.MODE == IOHGATP_Sv32x4) && (g_reg_file.capabilities.Sv32x4 == 0)) ||
-         ((DC->iohgatp.MODE == IOHGATP_Sv39x4) && (g_reg_file.capabilities.Sv39x4 == 0)) ||
-         ((DC->iohgatp.MODE == IOHGATP_Sv48x4) && (g_reg_file.capabilities.Sv48x4 == 0)) ||
-         ((DC->iohgatp.MODE == IOHGATP_Sv57x4) && (g_reg_file.capabilities.Sv57x4 == 0)) ) {
-        *cause = 259;     // DDT entry misconfigured
-        return 1;
-    }
-    //11. If any of the following conditions are true then stop and report 
-    //    "DDT entry misconfigured" (cause = 259).
-    //    l. `capabilities.MSI_FLAT` is 1 and `DC.msiptp.MODE` is not `Bare` 
-    //       and not `Flat`  
-    if ( (g_reg_file.capabilities.msi_flat == 1) && 
-         ((DC->msiptp.MODE != MSIPTP_Bare) &&
-          (DC->msiptp.MODE != MSIPTP_Flat)) ) {
+    //11. If any of the conditions listed in is_dc_misconfigured() are true then
+    //    stop and report "DDT entry misconfigured" (cause = 259).
+    if ( is_dc_misconfigured(DC) ) {
         *cause = 259;     // DDT entry misconfigured
         return 1;
     }
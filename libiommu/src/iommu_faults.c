@@ -5,6 +5,100 @@
 
 #include "iommu.h"
 
+// Fault records may optionally be write-combined. When enabled, records are
+// staged and written to the fault-queue in bursts of g_fq_wc_records records
+// that are aligned to the size of the burst. A burst is also written when the
+// queue wraps, when the queue is turned off, on a flush request and when the
+// clock is advanced. The fqt is advanced and an interrupt generated once per
+// burst. A value of 0 disables write combining.
+uint8_t     g_fq_wc_records = 0;
+uint8_t     g_fq_wc_count = 0;
+fault_rec_t fq_wc_buf[FQ_WC_MAX_RECORDS];
+
+fsupp_entry_t fsupp_filter[FSUPP_FILTER_SIZE];
+
+// Returns 1 if the fault is a repeat within the suppression window of a fault
+// reported earlier. If not suppressed, the number of repeats suppressed since
+// the last report of this fault is returned in suppressed.
+static uint8_t
+suppress_fault(
+    uint16_t cause, uint64_t iotval, uint32_t device_id, uint8_t pid_valid, 
+    uint32_t process_id, uint32_t *suppressed) {
+    fsupp_entry_t *e;
+    uint64_t page = iotval / PAGESIZE;
+    uint32_t h;
+
+    *suppressed = 0;
+    if ( g_reg_file.fsupp_ctrl.en == 0 )
+        return 0;
+    h = device_id ^ (process_id * 0x9E3779B1) ^ (cause * 0x85EBCA6B) ^ 
+        (uint32_t)(page ^ (page >> 32)) * 0xC2B2AE35;
+    e = &fsupp_filter[(h ^ (h >> 16)) & (FSUPP_FILTER_SIZE - 1)];
+    if ( e->valid == 1 && e->DID == device_id && e->PV == pid_valid && 
+         e->PID == process_id && e->cause == cause && e->iotval_page == page ) {
+        if ( (g_iommu_clock - e->start) < g_reg_file.fsupp_ctrl.window ) {
+            e->count++;
+            g_reg_file.fsupp_count++;
+            return 1;
+        }
+        *suppressed = e->count;
+    }
+    e->valid = 1;
+    e->DID = device_id;
+    e->PV = pid_valid;
+    e->PID = process_id;
+    e->cause = cause;
+    e->iotval_page = page;
+    e->start = g_iommu_clock;
+    e->count = 0;
+    return 0;
+}
+uint8_t
+iommu_set_fault_write_combining(
+    uint8_t num_records) {
+    // Bursts must be a power of 2 records that fits a single memory write
+    if ( num_records > FQ_WC_MAX_RECORDS || (num_records & (num_records - 1)) )
+        return 1;
+    flush_fault_queue();
+    g_fq_wc_records = num_records;
+    return 0;
+}
+void
+flush_fault_queue(
+    void) {
+    uint32_t fqt;
+    uint64_t frec_addr;
+    uint8_t status, i;
+
+    if ( g_fq_wc_count == 0 )
+        return;
+    fqt = g_reg_file.fqt.index;
+    frec_addr = ((g_reg_file.fqb.ppn * 4096) | (fqt * 32));
+    status = write_memory((char *)fq_wc_buf, frec_addr, (g_fq_wc_count * 32));
+    if ( (status & ACCESS_FAULT) || (status & DATA_CORRUPTION) ) {
+        // Determine the record that encountered the fault. The records
+        // preceding it are written and the rest discarded.
+        for ( i = 0; i < g_fq_wc_count; i++ ) {
+            status = write_memory((char *)&fq_wc_buf[i], frec_addr + (i * 32), 32);
+            if ( (status & ACCESS_FAULT) || (status & DATA_CORRUPTION) ) {
+                g_reg_file.fqcsr.fqmf = 1;
+                break;
+            }
+            fqt = (fqt + 1) & ((1UL << (g_reg_file.fqb.log2szm1 + 1)) - 1);
+        }
+    } else {
+        fqt = (fqt + g_fq_wc_count) & ((1UL << (g_reg_file.fqb.log2szm1 + 1)) - 1);
+        i = g_fq_wc_count;
+    }
+    // The records are counted once written
+    while ( i-- != 0 )
+        count_events(fq_wc_buf[i].PV, fq_wc_buf[i].PID, 0, 0, fq_wc_buf[i].DID, 0, 0,
+                     FAULTS_WRITTEN);
+    g_reg_file.fqt.index = fqt;
+    g_fq_wc_count = 0;
+    generate_interrupt(FAULT_QUEUE);
+    return;
+}
 void 
 report_fault(uint16_t cause, uint64_t iotval, uint64_t iotval2, uint8_t TTYP, uint8_t dtf,
              uint32_t device_id, uint8_t pid_valid, uint32_t process_id, uint8_t priv_req) {
@@ -13,8 +107,16 @@ report_fault(uint16_t cause, uint64_t iotval, uint64_t iotval2, uint8_t TTYP, ui
     uint32_t fqt;
     uint64_t fqb;
     uint64_t frec_addr;
+    uint32_t suppressed;
     uint8_t status;
 
+    TRACE(TRACE_FAULT, TTYP, cause, device_id, process_id, 
+          (pid_valid | (priv_req << 1) | (dtf << 2)), iotval, iotval2);
+
+    // Debug translations may be requested to not report faults
+    if ( g_dbg_tr_flags & DBG_TR_NO_FAULT )
+        return;
+
     // The fault-queue enable bit enables the fault-queue when set to 1. 
     // The fault-queue is active if fqon reads 1. 
     if ( g_reg_file.fqcsr.fqon == 0 || g_reg_file.fqcsr.fqen == 0 )
@@ -85,6 +187,12 @@ report_fault(uint16_t cause, uint64_t iotval, uint64_t iotval2, uint8_t TTYP, ui
     // If PV is 0, then PID and PRIV are 0. If PV is 1, the PID
     // holds a process_id of the transaction and if the privilege 
     // of the transaction was Supervisor then PRIV bit is 1 else its 0. 
+    // Repeats of a recently reported fault are counted and not written
+    if ( suppress_fault(cause, iotval, device_id, pid_valid, process_id, &suppressed) ) {
+        count_events(pid_valid, process_id, 0, 0, device_id, 0, 0, FAULTS_SUPPRESSED);
+        return;
+    }
+
     frec.DID = device_id;
     if ( pid_valid ) {
         frec.PID = process_id;
@@ -96,7 +204,7 @@ report_fault(uint16_t cause, uint64_t iotval, uint64_t iotval2, uint8_t TTYP, ui
         frec.PRIV = 0;
     }
     frec.reserved = 0;
-    frec.custom = 0;
+    frec.custom = suppressed;
     frec.iotval = iotval;
     frec.iotval2 = iotval2;
     frec.TTYP = TTYP;
@@ -118,7 +226,26 @@ report_fault(uint16_t cause, uint64_t iotval, uint64_t iotval2, uint8_t TTYP, ui
     fqh = g_reg_file.fqh.index;
     fqt = g_reg_file.fqt.index;
     fqb = g_reg_file.fqb.ppn;
-    if ( fqt == (fqh - 1) ) {
+    if ( g_fq_wc_records != 0 ) {
+        // The staged records are queued ahead of this record
+        fqt = (fqt + g_fq_wc_count) & ((1UL << (g_reg_file.fqb.log2szm1 + 1)) - 1);
+        if ( fqt == ((fqh - 1) & ((1UL << (g_reg_file.fqb.log2szm1 + 1)) - 1)) ) {
+            // Write the staged records. If that encounters a memory fault
+            // then this record is discarded due to the fqmf.
+            flush_fault_queue();
+            if ( g_reg_file.fqcsr.fqmf == 1 )
+                return;
+            g_reg_file.fqcsr.fqof = 1;
+            generate_interrupt(FAULT_QUEUE);
+            return;
+        }
+        fq_wc_buf[g_fq_wc_count++] = frec;
+        fqt = (fqt + 1) & ((1UL << (g_reg_file.fqb.log2szm1 + 1)) - 1);
+        if ( (fqt & (g_fq_wc_records - 1)) == 0 )
+            flush_fault_queue();
+        return;
+    }
+    if ( fqt == ((fqh - 1) & ((1UL << (g_reg_file.fqb.log2szm1 + 1)) - 1)) ) {
         g_reg_file.fqcsr.fqof = 1;
         generate_interrupt(FAULT_QUEUE);
         return;
@@ -141,6 +268,7 @@ report_fault(uint16_t cause, uint64_t iotval, uint64_t iotval2, uint8_t TTYP, ui
     } else {
         fqt = (fqt + 1) & ((1UL << (g_reg_file.fqb.log2szm1 + 1)) - 1);
         g_reg_file.fqt.index = fqt;
+        count_events(pid_valid, process_id, 0, 0, device_id, 0, 0, FAULTS_WRITTEN);
     }
     generate_interrupt(FAULT_QUEUE);
     return;
@@ -4,6 +4,68 @@
 // Author: ved@rivosinc.com
 
 #include "iommu.h"
+// Check a PTE read from level i of a G-stage page table of the MODE for the
+// conditions that cause a guest-page fault irrespective of the access type.
+pte_check_t
+check_g_pte(
+    gpte_t gpte, uint8_t i, uint8_t MODE) {
+    uint16_t ppn[5];
+
+    // 3. If pte.v = 0, or if pte.r = 0 and pte.w = 1, or if any bits or 
+    //    encodings that are reserved for future standard use are set within pte,
+    //    stop and raise a page-fault exception to the original access type.
+    if ( gpte.V == 0 ) return PTE_NOT_VALID;
+    if ( gpte.R == 0 && gpte.W == 1 ) return PTE_W_WITHOUT_R;
+    if ( ((gpte.PBMT != 0) && (g_reg_file.capabilities.Svpbmt == 0)) ||
+         (gpte.PBMT == 3) ) return PTE_BAD_PBMT;
+    if ( (gpte.reserved0 != 0) || (gpte.reserved1 != 0) ) return PTE_RESERVED;
+
+    // 4. Otherwise, the PTE is valid. If gpte.r = 1 or gpte.x = 1, go to step 5. 
+    //    Otherwise, this PTE is a pointer to the next level of the page table. 
+    //    Let i = i − 1. If i < 0, stop and raise a page-fault exception 
+    //    corresponding to the original access type.
+    if ( gpte.R == 0 && gpte.X == 0 )
+        return ( i == 0 ) ? PTE_NOT_LEAF : PTE_OK;
+
+    // The privilege mode is always taken to be U-mode for G-stage leaf PTEs
+    if ( gpte.U == 0 ) return PTE_NOT_USER;
+
+    ppn[4] = ppn[3] = ppn[2] = ppn[1] = ppn[0] = 0;
+    if ( MODE == IOHGATP_Sv32x4 ) {
+        ppn[0] = get_bits(19, 10, gpte.raw);
+        ppn[1] = get_bits(31, 20, gpte.raw);
+    }
+    if ( MODE == IOHGATP_Sv39x4 ) {
+        ppn[0] = get_bits(18, 10, gpte.raw);
+        ppn[1] = get_bits(27, 19, gpte.raw);
+        ppn[2] = get_bits(53, 28, gpte.raw);
+    }
+    if ( MODE == IOHGATP_Sv48x4 ) {
+        ppn[0] = get_bits(18, 10, gpte.raw);
+        ppn[1] = get_bits(27, 19, gpte.raw);
+        ppn[2] = get_bits(36, 28, gpte.raw);
+        ppn[3] = get_bits(53, 37, gpte.raw);
+    }
+    if ( MODE == IOHGATP_Sv57x4 ) {
+        ppn[0] = get_bits(18, 10, gpte.raw);
+        ppn[1] = get_bits(27, 19, gpte.raw);
+        ppn[2] = get_bits(36, 28, gpte.raw);
+        ppn[3] = get_bits(45, 37, gpte.raw);
+        ppn[4] = get_bits(53, 46, gpte.raw);
+    }
+    // 6. If i > 0 and gpte.ppn[i − 1 : 0] ̸= 0, this is a misaligned superpage; 
+    // stop and raise a page-fault exception corresponding to the original 
+    // access type.
+    if ( i > 0 ) {
+        switch ( (i - 1) ) {
+            case 3: if ( ppn[3] ) return PTE_MISALIGNED;
+            case 2: if ( ppn[2] ) return PTE_MISALIGNED;
+            case 1: if ( ppn[1] ) return PTE_MISALIGNED;
+            case 0: if ( ppn[0] ) return PTE_MISALIGNED;
+        }
+    }
+    return PTE_OK;
+}
 uint8_t
 g_stage_address_translation(
     uint64_t gpa, uint8_t is_read, uint8_t is_write, uint8_t is_exec, uint8_t implicit,
@@ -14,9 +76,9 @@ g_stage_address_translation(
     uint8_t GV, uint32_t GSCID, uint8_t TTYP) {
 
     uint16_t vpn[5];
-    uint16_t ppn[5];
     gpte_t gpte, amo_gpte;
     uint8_t i, PTESIZE, LEVELS, status, gpte_changed;
+    pte_check_t gpte_check;
     uint64_t a;
     uint64_t gpa_upper_bits;
     uint64_t pa_mask = ((1UL << (g_reg_file.capabilities.pas)) - 1);
@@ -91,10 +153,12 @@ g_stage_address_translation(
     // `UNSPECIFIED` and any address an IOMMU may compute and use for accessing an
     // entry in the root page table is also `UNSPECIFIED`.
     a = iohgatp.PPN * PAGESIZE;
+    COST_G_WALK();
 
 step_2:
     // Count G stage page walks
     count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, G_PT_WALKS);
+    count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, G_PT_WALK_LEVEL0 + i);
 
     // 2. Let gpte be the value of the PTE at address a+gpa.vpn[i]×PTESIZE. (For 
     //    Sv32x4 PTESIZE=4. and for all other modes PTESIZE=8). If accessing pte
@@ -104,17 +168,18 @@ step_2:
     //    then an access fault occurs
     if ( a & ~pa_mask ) goto access_fault;
     gpte.raw = 0;
+    COST_MEM_READ();
     status = read_memory((a | (vpn[i] * PTESIZE)), PTESIZE, (char *)&gpte.raw);
     if ( status != 0 ) goto access_fault;
 
     // 3. If pte.v = 0, or if pte.r = 0 and pte.w = 1, or if any bits or 
     //    encodings that are reserved for future standard use are set within pte,
     //    stop and raise a page-fault exception to the original access type.
-    if ( (gpte.V == 0) || (gpte.R == 0 && gpte.W == 1) || 
-         ((gpte.PBMT != 0) && (g_reg_file.capabilities.Svpbmt == 0)) ||
-         (gpte.PBMT == 3) ||
-         (gpte.reserved0 != 0) ||
-         (gpte.reserved1 != 0) )
+    //    The checks that do not depend on the access type are made by
+    //    check_g_pte(). The leaf checks are reported after the access fault
+    //    check of step 5.
+    gpte_check = check_g_pte(gpte, i, iohgatp.MODE);
+    if ( gpte_check != PTE_OK && gpte_check != PTE_NOT_USER && gpte_check != PTE_MISALIGNED )
         goto guest_page_fault;
 
     // 4. Otherwise, the PTE is valid. If gpte.r = 1 or gpte.x = 1, go to step 5. 
@@ -125,7 +190,6 @@ step_2:
     if ( gpte.R == 1 || gpte.X == 1 ) goto step_5;
 
     i = i - 1;
-    if ( i < 0 ) goto guest_page_fault;
     a = gpte.PPN * PAGESIZE;
     goto step_2;
 
@@ -155,41 +219,9 @@ step_5:
         if ( is_read  && (gpte.R == 0) ) goto guest_page_fault;
         if ( is_write && (gpte.W == 0) ) goto guest_page_fault;
     }
-    if ( gpte.U == 0 ) goto guest_page_fault;
+    if ( gpte_check != PTE_OK ) goto guest_page_fault;
 
-    ppn[4] = ppn[3] = ppn[2] = ppn[1] = ppn[0] = 0;
-    if ( iohgatp.MODE == IOHGATP_Sv32x4 ) {
-        ppn[0] = get_bits(19, 10, gpte.raw);
-        ppn[1] = get_bits(31, 20, gpte.raw);
-    }
-    if ( iohgatp.MODE == IOHGATP_Sv39x4 ) {
-        ppn[0] = get_bits(18, 10, gpte.raw);
-        ppn[1] = get_bits(27, 19, gpte.raw);
-        ppn[2] = get_bits(53, 28, gpte.raw);
-    }
-    if ( iohgatp.MODE == IOHGATP_Sv48x4 ) {
-        ppn[0] = get_bits(18, 10, gpte.raw);
-        ppn[1] = get_bits(27, 19, gpte.raw);
-        ppn[2] = get_bits(36, 28, gpte.raw);
-        ppn[3] = get_bits(53, 37, gpte.raw);
-    }
-    if ( iohgatp.MODE == IOHGATP_Sv57x4 ) {
-        ppn[0] = get_bits(18, 10, gpte.raw);
-        ppn[1] = get_bits(27, 19, gpte.raw);
-        ppn[2] = get_bits(36, 28, gpte.raw);
-        ppn[3] = get_bits(45, 37, gpte.raw);
-        ppn[4] = get_bits(53, 46, gpte.raw);
-    }
-    // 6. If i > 0 and gpte.ppn[i − 1 : 0] ̸= 0, this is a misaligned superpage; 
-    // stop and raise a page-fault exception corresponding to the original 
-    // access type.
     if ( i > 0 ) {
-        switch ( (i - 1) ) {
-            case 3: if ( ppn[3] ) goto guest_page_fault;
-            case 2: if ( ppn[2] ) goto guest_page_fault;
-            case 1: if ( ppn[1] ) goto guest_page_fault;
-            case 0: if ( ppn[0] ) goto guest_page_fault;
-        }
         // Determine page size
         if ( iohgatp.MODE == IOHGATP_Sv32x4 ) {
             *gst_page_sz = 4UL * 1024UL * 1024UL;  // 4M;
@@ -232,6 +264,7 @@ step_5:
     // Count G stage page walks
     count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, G_PT_WALKS);
 
+    COST_AD_AMO();
     status = read_memory_for_AMO((a + (vpn[i] * PTESIZE)), PTESIZE, (char *)&amo_gpte.raw);
 
     if ( status != 0 ) goto access_fault;
@@ -247,6 +280,10 @@ step_5:
 
     if ( status != 0 ) goto access_fault;
 
+    // Count A/D bit updates
+    if ( gpte_changed == 0 )
+        count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, AD_UPDATE_WRITES);
+
     if ( gpte_changed == 1) goto step_2;
 
 step_8:
@@ -3,37 +3,47 @@
 // SPDX-License-Identifier: Apache-2.0
 // Author: ved@rivosinc.com
 #include "iommu.h"
+// Counters armed to count an event. Bit X of the mask is set if iohpmctrX+1
+// is programmed to count the event and is not inhibited. The map is rebuilt
+// when iohpmevt or iocountinh are written.
+uint32_t g_hpm_event_ctrs[1 << 15];
+// Filters of each counter precomputed from iohpmevt so that an event is
+// matched without decoding the register. The DID_GSCID is held masked by the
+// match mask computed from the DMASK field.
+static struct {
+    uint8_t  idt;
+    uint8_t  pv_pscv;
+    uint8_t  dv_gscv;
+    uint32_t pid_pscid;
+    uint32_t did_gscid;
+    uint32_t did_mask;
+} hpm_filter[31];
+// Event IDs that are armed in the map
+static uint16_t hpm_armed_event[31];
+
 void
-count_events(
-    uint8_t PV, uint32_t PID, uint8_t PSCV, uint32_t PSCID, 
-    uint8_t DID, uint8_t GSCV, uint32_t GSCID, uint16_t eventID) {
+update_hpm_event_map(
+    void) {
     uint8_t i;
     uint32_t mask;
-    uint64_t count;
 
+    for ( i = 0; i < 31; i++ ) {
+        g_hpm_event_ctrs[hpm_armed_event[i]] = 0;
+        hpm_armed_event[i] = NO_EVENT;
+    }
     // IOMMU implements a performance-monitoring unit
     // if capabilities.hpm == 1
     if ( g_reg_file.capabilities.hpm == 0 ) return;
 
-    for ( i = 0; i < g_num_hpm; i++ ) {
+    for ( i = 0; i < (g_num_hpm - 1); i++ ) {
         // The performance-monitoring counter inhibits is a 32-bits WARL 
         // register where that contains bits to inhibit the corresponding 
         // counters from counting. Bit X when set inhibits counting in 
         // iohpmctrX and bit 0 inhibits counting in iohpmcycles.
-        if ( g_reg_file.iocountinh.raw & (1UL << i) ) continue;
+        if ( g_reg_file.iocountinh.raw & (1UL << (i + 1)) ) continue;
 
-        // Counter is not inhibited check if it matches
-        // These performance-monitoring event registers are 64-bit RW 
-        // registers. When a transaction processed by the IOMMU causes an 
-        // event that is programmed to count in a counter then the counter is
-        // incremented. In addition to matching events the event selector may 
-        // be programmed with additional filters based on device_id, process_id, 
-        // GSCID, and PSCID such that the counter is incremented conditionally 
-        // based on the transaction matching these additional filters. When such 
-        // device_id based filtering is used, the match may be configured to be 
-        // a precise match or a partial match. A partial match allows a 
-        // transactions with a range of IDs to be counted by the counter.
-        if ( g_reg_file.iohpmevt[i].eventID != eventID ) continue;
+        // Event ID 0 - Do not count
+        if ( g_reg_file.iohpmevt[i].eventID == NO_EVENT ) continue;
 
         // When filtering by device_id or GSCID is selected and the event supports 
         // ID based filtering, the DMASK field can be used to configure a partial 
@@ -51,33 +61,67 @@ count_events(
         mask = mask ^ g_reg_file.iohpmevt[i].did_gscid;
         mask = ~mask;
         // If DMASK is 0, then all 24-bits must match
-        mask = (g_reg_file.iohpmevt[i].dmask == 1) ? mask : 0xFFFFFF;
+        hpm_filter[i].did_mask = (g_reg_file.iohpmevt[i].dmask == 1) ? mask : 0xFFFFFF;
+        hpm_filter[i].did_gscid = g_reg_file.iohpmevt[i].did_gscid & hpm_filter[i].did_mask;
+        hpm_filter[i].pid_pscid = g_reg_file.iohpmevt[i].pid_pscid;
+        hpm_filter[i].idt = g_reg_file.iohpmevt[i].idt;
+        hpm_filter[i].pv_pscv = g_reg_file.iohpmevt[i].pv_pscv;
+        hpm_filter[i].dv_gscv = g_reg_file.iohpmevt[i].dv_gscv;
+
+        hpm_armed_event[i] = g_reg_file.iohpmevt[i].eventID;
+        g_hpm_event_ctrs[hpm_armed_event[i]] |= (1UL << i);
+    }
+    return;
+}
+void
+count_events(
+    uint8_t PV, uint32_t PID, uint8_t PSCV, uint32_t PSCID, 
+    uint32_t DID, uint8_t GSCV, uint32_t GSCID, uint16_t eventID) {
+    uint8_t i;
+    uint32_t ctrs, mask;
+    uint64_t count;
+
+    // Counters that are not inhibited and are programmed to count this event
+    ctrs = g_hpm_event_ctrs[eventID];
+    while ( ctrs ) {
+        i = __builtin_ctz(ctrs);
+        ctrs &= (ctrs - 1);
+
+        // These performance-monitoring event registers are 64-bit RW 
+        // registers. When a transaction processed by the IOMMU causes an 
+        // event that is programmed to count in a counter then the counter is
+        // incremented. In addition to matching events the event selector may 
+        // be programmed with additional filters based on device_id, process_id, 
+        // GSCID, and PSCID such that the counter is incremented conditionally 
+        // based on the transaction matching these additional filters. When such 
+        // device_id based filtering is used, the match may be configured to be 
+        // a precise match or a partial match. A partial match allows a 
+        // transactions with a range of IDs to be counted by the counter.
+        mask = hpm_filter[i].did_mask;
 
         // IDT - Filter ID Type: This field indicates the type of ID to
         // filter on. 
-        if ( g_reg_file.iohpmevt[i].idt == 0 ) {
+        if ( hpm_filter[i].idt == 0 ) {
             // When 0, the DID_GSCID field holds a device_id and the 
             // PID_PSCID field holds a process_id. 
-            if ( g_reg_file.iohpmevt[i].pv_pscv == 1 ) {
+            if ( hpm_filter[i].pv_pscv == 1 ) {
                 if ( PV == 0 ) continue;
-                if ( g_reg_file.iohpmevt[i].pid_pscid != PID ) continue;
+                if ( hpm_filter[i].pid_pscid != PID ) continue;
             }
-            if ( g_reg_file.iohpmevt[i].dv_gscv == 1 ) {
-                if ( (g_reg_file.iohpmevt[i].did_gscid & mask) != (DID & mask) ) {
-                    continue;
-                }
+            if ( hpm_filter[i].dv_gscv == 1 ) {
+                if ( hpm_filter[i].did_gscid != (DID & mask) ) continue;
             }
         }
-        if ( g_reg_file.iohpmevt[i].idt == 1 ) {
+        if ( hpm_filter[i].idt == 1 ) {
             // When 1, the DID_GSCID field holds a GSCID and PID_PSCID 
             // field holds a PSCID.
-            if ( g_reg_file.iohpmevt[i].pv_pscv == 1 ) {
+            if ( hpm_filter[i].pv_pscv == 1 ) {
                 if ( PSCV == 0 ) continue;
-                if ( g_reg_file.iohpmevt[i].pid_pscid != PSCID ) continue;
+                if ( hpm_filter[i].pid_pscid != PSCID ) continue;
             }
-            if ( g_reg_file.iohpmevt[i].dv_gscv == 1 ) {
+            if ( hpm_filter[i].dv_gscv == 1 ) {
                 if ( GSCV == 0 ) continue;
-                if ( (g_reg_file.iohpmevt[i].did_gscid & mask) != (GSCID & mask) ) continue;
+                if ( hpm_filter[i].did_gscid != (GSCID & mask) ) continue;
             }
         }
         // Counter is not inhibited and all filters pass
@@ -104,3 +148,76 @@ count_events(
     }
     return;
 }
+// The iohpmcycles counter is computed lazily from a clock source. The counter
+// is synchronized to the clock when it or the iocountovf register is read,
+// when iohpmcycles or iocountinh are written and when the virtual clock
+// reaches the time at which the counter overflows.
+static uint64_t (*hpm_cycles_clock)(void) = iommu_get_clock;
+// Clock value at which the iohpmcycles was last synchronized
+static uint64_t hpm_cycles_epoch;
+// Clock value at which the iohpmcycles overflows
+static uint64_t hpm_cycles_ovf_clock = -1;
+
+void
+update_iohpmcycles(
+    void) {
+    uint64_t now, count;
+
+    now = hpm_cycles_clock();
+    count = g_reg_file.iohpmcycles.counter + (now - hpm_cycles_epoch);
+    hpm_cycles_epoch = now;
+    hpm_cycles_ovf_clock = -1;
+
+    // IOMMU implements a performance-monitoring unit
+    // if capabilities.hpm == 1
+    if ( g_reg_file.capabilities.hpm == 0 ) return;
+    // Bit 0 of iocountinh inhibits counting in iohpmcycles.
+    if ( g_reg_file.iocountinh.cy == 1 ) return;
+
+    g_reg_file.iohpmcycles.counter = (count & ((1UL << g_hpmctr_bits) - 1));
+    if ( count & ~((1UL << g_hpmctr_bits) - 1) ) {
+        // The OF bit is set when iohpmcycles overflows and remains set
+        // until cleared by software. If iohpmcycles overflows while the
+        // OF bit is zero, then a HPM Counter Overflow interrupt is
+        // generated.
+        if ( g_reg_file.iohpmcycles.of == 0 ) {
+            g_reg_file.iohpmcycles.of = 1;
+            generate_interrupt(HPM);
+        }
+    }
+    // The overflow needs to be detected as the clock advances only if it
+    // generates an interrupt
+    if ( g_reg_file.iohpmcycles.of == 0 )
+        hpm_cycles_ovf_clock = now + ((1UL << g_hpmctr_bits) - g_reg_file.iohpmcycles.counter);
+    return;
+}
+void
+reset_hpm(
+    void) {
+    update_hpm_event_map();
+    hpm_cycles_epoch = hpm_cycles_clock();
+    update_iohpmcycles();
+    return;
+}
+// Invoked when the virtual clock advances to generate the overflow
+// interrupt at the time the counter overflows
+void
+hpm_clock_tick(
+    uint64_t now) {
+    if ( hpm_cycles_clock == iommu_get_clock && now >= hpm_cycles_ovf_clock )
+        update_iohpmcycles();
+    return;
+}
+// Set the clock source that advances iohpmcycles. When no clock source
+// is provided the virtual clock of the model is used. Overflow interrupts
+// are generated as the virtual clock advances; with an embedder clock
+// source the overflow is detected when the counter is next synchronized.
+void
+iommu_set_hpm_cycles_clock(
+    uint64_t (*clock)(void)) {
+    update_iohpmcycles();
+    hpm_cycles_clock = ( clock == NULL ) ? iommu_get_clock : clock;
+    hpm_cycles_epoch = hpm_cycles_clock();
+    update_iohpmcycles();
+    return;
+}
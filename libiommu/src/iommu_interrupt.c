@@ -4,15 +4,214 @@
 // Author: ved@rivosinc.com
 
 #include "iommu.h"
-void 
-generate_interrupt(
-    uint8_t unit) {
+// Interrupt moderation controls of each vector
+imod_t g_imod[16];
+// Interrupt moderation state of each vector
+static struct {
+    uint64_t last;      // Clock when the last interrupt was signaled
+    uint32_t count;     // Number of events since the last interrupt was signaled
+    uint8_t  signaled;  // An interrupt was signaled since reset
+} imod_state[16];
+// Vectors with an interrupt held for moderation
+static uint16_t imod_held;
+// Interrupt sink provided by the embedder. When no sink is provided the
+// MSIs are written to memory and the wires are not modeled.
+static iommu_intr_sink_t intr_sink;
+// MSIs batched for delivery to the sink
+static iommu_msi_t msi_batch[MAX_MSI_BATCH];
+static uint32_t msi_batch_size = 1;
+static uint32_t num_msis_batched;
+// Vectors with the wire asserted
+static uint16_t wires_asserted;
+static uint8_t vector_pending(uint8_t vec);
+
+// Provide the sink to deliver the interrupts to. MSIs are delivered to the
+// sink in batches of up to batch_size messages; a partial batch is delivered
+// when the clock advances or when iommu_flush_interrupts() is invoked. A
+// NULL sink restores writing the MSIs to memory. Returns 1 if the batch
+// size is not valid.
+uint8_t
+iommu_set_interrupt_sink(
+    iommu_intr_sink_t *sink, uint32_t batch_size) {
+    uint8_t vec;
+
+    if ( sink != NULL && (batch_size == 0 || batch_size > MAX_MSI_BATCH) )
+        return 1;
+    iommu_flush_interrupts();
+    // Deassert the wires on the old sink and assert the wires that are
+    // still pending on the new sink
+    for ( vec = 0; wires_asserted != 0 && vec < 16; vec++ )
+        if ( wires_asserted & (1 << vec) )
+            intr_sink.set_wire(vec, 0);
+    if ( sink == NULL ) {
+        memset(&intr_sink, 0, sizeof(intr_sink));
+        msi_batch_size = 1;
+    } else {
+        intr_sink = *sink;
+        msi_batch_size = batch_size;
+    }
+    wires_asserted = 0;
+    if ( g_reg_file.fctrl.wis == 0 || intr_sink.set_wire == NULL )
+        return 0;
+    for ( vec = 0; vec < 16; vec++ ) {
+        if ( vector_pending(vec) && (imod_held & (1 << vec)) == 0 ) {
+            wires_asserted |= (1 << vec);
+            intr_sink.set_wire(vec, 1);
+        }
+    }
+    return 0;
+}
+// Deliver the batched MSIs to the sink
+void
+iommu_flush_interrupts(
+    void) {
+    uint64_t faulted[MAX_MSI_BATCH];
+    uint32_t i, n, num_faulted;
+
+    if ( (n = num_msis_batched) == 0 )
+        return;
+    num_msis_batched = 0;
+    intr_sink.send_msis(msi_batch, n);
+    // Collect the faulted messages before reporting as the fault may
+    // itself generate an interrupt that is batched
+    num_faulted = 0;
+    for ( i = 0; i < n; i++ )
+        if ( msi_batch[i].status & ACCESS_FAULT )
+            faulted[num_faulted++] = msi_batch[i].addr;
+    for ( i = 0; i < num_faulted; i++ )
+        report_fault(273, faulted[i], 0, TTYPE_NONE, 0, 0, 0, 0, 0);
+    return;
+}
+void
+reset_interrupts(
+    void) {
+    uint8_t vec;
 
+    memset(g_imod, 0, sizeof(g_imod));
+    memset(imod_state, 0, sizeof(imod_state));
+    imod_held = 0;
+    num_msis_batched = 0;
+    for ( vec = 0; wires_asserted != 0 && vec < 16; vec++ ) {
+        if ( wires_asserted & (1 << vec) )
+            intr_sink.set_wire(vec, 0);
+        wires_asserted &= ~(1 << vec);
+    }
+    return;
+}
+// Determine if a cause mapped to the vector has a interrupt pending
+static uint8_t
+vector_pending(
+    uint8_t vec) {
+    return (g_reg_file.ipsr.cip == 1 && g_reg_file.icvec.civ == vec) ||
+           (g_reg_file.ipsr.fip == 1 && g_reg_file.icvec.fiv == vec) ||
+           (g_reg_file.ipsr.pmip == 1 && g_reg_file.icvec.pmiv == vec) ||
+           (g_reg_file.ipsr.pip == 1 && g_reg_file.icvec.piv == vec);
+}
+static void
+signal_interrupt(
+    uint8_t vec) {
     msi_addr_t msi_addr;
     uint32_t msi_data;
     msi_vec_ctrl_t msi_vec_ctrl;
-    uint8_t  vec, status;
+    uint8_t status;
 
+    // The vector is used: 
+    // 1. By an IOMMU that generates interrupts as MSI, to index into MSI 
+    //    configuration table (msi_cfg_tbl) to determine the MSI to generate. An 
+    //    IOMMU is capable of generating interrupts as a MSI if capabilities.IGS==MSI
+    //    or if capabilities.IGS==BOTH. When capabilities.IGS==BOTH the IOMMU may be
+    //    configured to generate interrupts as MSI by setting fctrl.WIS to 0.
+    // 2. By an IOMMU that generates wire based interrupts, to determine the wire 
+    //    to signal the interrupt. An IOMMU is capable of generating wire based 
+    //    interrupts if capabilities.IGS==WIS or if capabilities.IGS==BOTH. When 
+    //    capabilities.IGS==BOTH the IOMMU may be configured to generate wire based 
+    //    interrupts by setting fctrl.WIS to 1.
+    if ( g_reg_file.fctrl.wis == 0 ) {
+        msi_addr.raw = g_reg_file.msi_cfg_tbl[vec].msi_addr.raw;
+        msi_data = g_reg_file.msi_cfg_tbl[vec].msi_data;
+        msi_vec_ctrl.raw = g_reg_file.msi_cfg_tbl[vec].msi_vec_ctrl.raw;
+        // When the mask bit M is 1, the corresponding interrupt vector is
+        // masked and the IOMMU is prohibited from sending the associated
+        // message.
+        if ( msi_vec_ctrl.m == 1 )
+            return;
+        if ( intr_sink.send_msis != NULL ) {
+            msi_batch[num_msis_batched].addr = msi_addr.raw;
+            msi_batch[num_msis_batched].data = msi_data;
+            msi_batch[num_msis_batched].vec = vec;
+            msi_batch[num_msis_batched].status = 0;
+            if ( ++num_msis_batched >= msi_batch_size )
+                iommu_flush_interrupts();
+            return;
+        }
+        status = write_memory((char *)&msi_data, msi_addr.raw, 4);
+        if ( status & ACCESS_FAULT ) {
+            // If an access fault is detected on a MSI write using msi_addr_x, 
+            // then the IOMMU reports a "IOMMU MSI write access fault" (cause 273) fault, 
+            // with TTYP set to 0 and iotval set to the value of msi_addr_x.
+            report_fault(273, msi_addr.raw, 0, TTYPE_NONE, 0, 0, 0, 0, 0);
+        }
+    } else if ( intr_sink.set_wire != NULL && (wires_asserted & (1 << vec)) == 0 ) {
+        // The wires are level signaled and stay asserted till no cause
+        // mapped to the vector has an interrupt pending
+        wires_asserted |= (1 << vec);
+        intr_sink.set_wire(vec, 1);
+    }
+    return;
+}
+// Deassert the wires of vectors that no longer have an interrupt pending.
+// Invoked when software clears interrupt pending bits in ipsr.
+void
+update_interrupt_wires(
+    void) {
+    uint8_t vec;
+
+    for ( vec = 0; wires_asserted != 0 && vec < 16; vec++ ) {
+        if ( (wires_asserted & (1 << vec)) && vector_pending(vec) == 0 ) {
+            wires_asserted &= ~(1 << vec);
+            intr_sink.set_wire(vec, 0);
+        }
+    }
+    return;
+}
+// Signal the interrupt held on the vector if it is due. The interrupt is due
+// when imod.interval ticks have elapsed since the last interrupt on the vector
+// was signaled or when imod.threshold, if not 0, events have been counted on
+// the vector since then. An interrupt that is no longer pending is not
+// signaled.
+static void
+moderate_interrupt(
+    uint8_t vec) {
+    if ( imod_state[vec].signaled == 1 &&
+         (g_iommu_clock - imod_state[vec].last) < g_imod[vec].interval &&
+         (g_imod[vec].threshold == 0 || imod_state[vec].count < g_imod[vec].threshold) )
+        return;
+    imod_held &= ~(1 << vec);
+    if ( vector_pending(vec) == 0 )
+        return;
+    imod_state[vec].last = g_iommu_clock;
+    imod_state[vec].count = 0;
+    imod_state[vec].signaled = 1;
+    signal_interrupt(vec);
+    return;
+}
+// Invoked when the virtual clock advances to signal the held interrupts
+void
+interrupt_clock_tick(
+    uint64_t now) {
+    uint8_t vec;
+
+    for ( vec = 0; imod_held != 0 && vec < 16; vec++ )
+        if ( imod_held & (1 << vec) )
+            moderate_interrupt(vec);
+    iommu_flush_interrupts();
+    return;
+}
+void 
+generate_interrupt(
+    uint8_t unit) {
+
+    uint8_t  vec, pending;
 
     // Interrupt pending status register (ipsr)
     // This 32-bits register (RW1C) reports the pending interrupts 
@@ -27,65 +226,42 @@ generate_interrupt(
     switch ( unit ) {
         case FAULT_QUEUE:
             // The fault-queue-interrupt-pending
-            if ( g_reg_file.ipsr.fip == 1) 
-                return;
             if ( g_reg_file.fqcsr.fie == 0) 
                 return;
             vec = g_reg_file.icvec.fiv;
+            pending = g_reg_file.ipsr.fip;
             g_reg_file.ipsr.fip = 1;
             break;
         case PAGE_QUEUE:
-            if ( g_reg_file.ipsr.pip == 1) 
-                return;
             if ( g_reg_file.pqcsr.pie == 0) 
                 return;
             vec = g_reg_file.icvec.piv;
+            pending = g_reg_file.ipsr.pip;
             g_reg_file.ipsr.pip = 1;
             break;
         case COMMAND_QUEUE:
-            if ( g_reg_file.ipsr.cip == 1) 
-                return;
             if ( g_reg_file.cqcsr.cie == 0) 
                 return;
             vec = g_reg_file.icvec.civ;
+            pending = g_reg_file.ipsr.cip;
             g_reg_file.ipsr.cip = 1;
             break;
         case HPM:
-            if ( g_reg_file.ipsr.pmip == 1) 
-                return;
             vec = g_reg_file.icvec.pmiv;
+            pending = g_reg_file.ipsr.pmip;
             g_reg_file.ipsr.pmip = 1;
             break;
         default:
             return;
     }
-    // The vector is used: 
-    // 1. By an IOMMU that generates interrupts as MSI, to index into MSI 
-    //    configuration table (msi_cfg_tbl) to determine the MSI to generate. An 
-    //    IOMMU is capable of generating interrupts as a MSI if capabilities.IGS==MSI
-    //    or if capabilities.IGS==BOTH. When capabilities.IGS==BOTH the IOMMU may be
-    //    configured to generate interrupts as MSI by setting fctrl.WIS to 0.
-    // 2. By an IOMMU that generates wire based interrupts, to determine the wire 
-    //    to signal the interrupt. An IOMMU is capable of generating wire based 
-    //    interrupts if capabilities.IGS==WIS or if capabilities.IGS==BOTH. When 
-    //    capabilities.IGS==BOTH the IOMMU may be configured to generate wire based 
-    //    interrupts by setting fctrl.WIS to 1.
-    if ( g_reg_file.fctrl.wis == 0 ) {
-        msi_addr.raw = g_reg_file.msi_cfg_tbl[vec].msi_addr.raw;
-        msi_data = g_reg_file.msi_cfg_tbl[vec].msi_data;
-        msi_vec_ctrl.raw = g_reg_file.msi_cfg_tbl[vec].msi_vec_ctrl.raw;
-        // When the mask bit M is 1, the corresponding interrupt vector is
-        // masked and the IOMMU is prohibited from sending the associated
-        // message.
-        if ( msi_vec_ctrl.m == 1 )
-            return;
-        status = write_memory((char *)&msi_data, msi_addr.raw, 4);
-        if ( status & ACCESS_FAULT ) {
-            // If an access fault is detected on a MSI write using msi_addr_x, 
-            // then the IOMMU reports a "IOMMU MSI write access fault" (cause 273) fault, 
-            // with TTYP set to 0 and iotval set to the value of msi_addr_x.
-            report_fault(273, msi_addr.raw, 0, TTYPE_NONE, 0, 0, 0, 0, 0);
-        }
+    // Events are counted toward the moderation threshold of the vector
+    // even when the interrupt is already pending
+    imod_state[vec].count++;
+    if ( pending == 0 ) {
+        TRACE(TRACE_INTERRUPT, unit, vec, 0, 0, g_reg_file.fctrl.wis, 0, 0);
+        imod_held |= (1 << vec);
     }
+    if ( imod_held & (1 << vec) )
+        moderate_interrupt(vec);
     return;
 }
@@ -75,12 +75,15 @@ msi_address_translation(
     // never fault. G-stage faults cause invalidate and return miss. So we cannot 
     // get a ATC fault on this lookup.
     if ( (ioatc_status = lookup_ioatc_iotlb(iova, U_MODE, 1, 1, 0, 0, 0, 0, GV, GSCID, cause,
-                                            resp_pa, &page_sz, R, W, &X, &G, &PBMT)) == IOATC_HIT )
+                                            resp_pa, &page_sz, R, W, &X, &G, &PBMT)) == IOATC_HIT ) {
+        count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, MSI_PTE_CACHE_HIT);
         return 0;
+    }
 
     // Miss in IOATC
     // Count misses in TLB
     count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, IOATC_TLB_MISS);
+    count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, MSI_PTE_CACHE_MISS);
 
     // 7. Let `m` be `(DC.msiptp.PPN x 2^12^)`.
     m = DC->msiptp.PPN * PAGESIZE;
@@ -88,6 +91,7 @@ msi_address_translation(
     // 8. Let `msipte` be the value of sixteen bytes at address `(m | (I x 16))`. If
     //    accessing `msipte` violates a PMA or PMP check, then stop and report
     //    "MSI PTE load access fault" (cause = 261).
+    COST_MEM_READ();
     status = read_memory((m + (I * 16)), 16, (char *)&msipte.raw);
     if ( status & ACCESS_FAULT ) {
         *cause = 261;     // MSI PTE load access fault
@@ -188,6 +192,7 @@ msi_address_translation(
     //       for interrupt identity `D` to 1 using an `AMOOR` operation for atomic update.
     if ( g_reg_file.capabilities.amo == 1 ) {
         mrif_dw_addr = (msipte.mrif.MRIF_ADDR * 512) + (D >> 5);
+        COST_MEM_READ();
         status = read_memory_for_AMO((msipte.mrif.MRIF_ADDR * 512), 4, (char *)&mrif_dw);
         if ( status == 0 ) {
             mrif_dw |= (1UL << (D & 0x1F));
@@ -200,6 +205,7 @@ msi_address_translation(
     //       read-modify-write sequence.
     if ( g_reg_file.capabilities.amo == 1 ) {
         mrif_dw_addr = (msipte.mrif.MRIF_ADDR * 512) + (D >> 5);
+        COST_MEM_READ();
         status = read_memory((msipte.mrif.MRIF_ADDR * 512), 4, (char *)&mrif_dw);
         if ( status == 0 ) {
             mrif_dw |= (1UL << (D & 0x1F));
@@ -5,6 +5,35 @@
 
 #include "iommu.h"
 
+// Determine if the process context is misconfigured - steps 11 and 12 of the
+// process to locate the process context. Returns 1 if the PC is misconfigured.
+uint8_t
+is_pc_misconfigured(
+    process_context_t *PC) {
+    //11. If any bits or encoding that are reserved for future standard use are set
+    //     within `PC`, stop and report "PDT entry misconfigured" (cause = 267).
+    if ( PC->ta.reserved != 0 || PC->fsc.iosatp.reserved != 0 ||
+         ((PC->fsc.iosatp.MODE != IOSATP_Bare) &&
+          (PC->fsc.iosatp.MODE != IOSATP_Sv32) &&
+          (PC->fsc.iosatp.MODE != IOSATP_Sv39) &&
+          (PC->fsc.iosatp.MODE != IOSATP_Sv48) &&
+          (PC->fsc.iosatp.MODE != IOSATP_Sv57)) ) {
+        return 1;
+    }
+    //12. If any of the following conditions are true then stop and report
+    //     "PDT entry misconfigured" (cause = 267).
+    //    a. `capabilities.Sv32` is 0 and `PC.fsc.MODE` is `Sv32`
+    //    b. `capabilities.Sv39` is 0 and `PC.fsc.MODE` is `Sv39`
+    //    c. `capabilities.Sv48` is 0 and `PC.fsc.MODE` is `Sv48`
+    //    d. `capabilities.Sv57` is 0 and `PC.fsc.MODE` is `Sv57`
+    if ( ((PC->fsc.iosatp.MODE == IOSATP_Sv32) && (g_reg_file.capabilities.Sv32 == 0)) ||
+         ((PC->fsc.iosatp.MODE == IOSATP_Sv39) && (g_reg_file.capabilities.Sv39 == 0)) ||
+         ((PC->fsc.iosatp.MODE == IOSATP_Sv48) && (g_reg_file.capabilities.Sv48 == 0)) ||
+         ((PC->fsc.iosatp.MODE == IOSATP_Sv57) && (g_reg_file.capabilities.Sv57 == 0)) ) {
+        return 1;
+    }
+    return 0;
+}
 uint8_t
 locate_process_context(
     process_context_t *PC, device_context_t *DC, uint32_t device_id, uint32_t process_id, 
@@ -58,8 +87,11 @@ locate_process_context(
     // using its process_id is as follows:
 
     // Determine if there is a cached device context
-    if ( lookup_ioatc_pc(device_id, process_id, PC) == IOATC_HIT )
+    if ( lookup_ioatc_pc(device_id, process_id, PC) == IOATC_HIT ) {
+        count_events(1, process_id, 0, 0, device_id, 0, 0, PDT_CACHE_HIT);
         return 0;
+    }
+    count_events(1, process_id, 0, 0, device_id, 0, 0, PDT_CACHE_MISS);
 
     // 1. Let a be pdtp.PPN x 2^12 and let i = LEVELS - 1. When pdtp.MODE 
     //    is PD20, LEVELS is three. When pdtp.MODE is PD17, LEVELS is two. 
@@ -91,6 +123,7 @@ step_2:
     // 4. Let `pdte` be value of eight bytes at address `a + PDI[i] x 8`. If
     //    accessing `pdte` violates a PMA or PMP check, then stop and report
     //    "PDT entry load access fault" (cause = 265).
+    COST_MEM_READ();
     status = read_memory((a + (PDI[i] * 8)), 8, (char *)&pdte.raw);
     if ( status & ACCESS_FAULT ) {
         *cause = 265;     // PDT entry load access fault
@@ -131,6 +164,7 @@ step_9:
     //    fault" (cause = 265).If `PC` access detects a data corruption
     //    (a.k.a. poisoned data), then stop and report "PDT data corruption"
     //    (cause = 269).
+    COST_MEM_READ();
     status = read_memory((a + (PDI[0] * 16)), 16, (char *)PC);
     if ( status & ACCESS_FAULT ) {
         *cause = 265;     // PDT entry load access fault
@@ -147,26 +181,10 @@ step_9:
     }
     //11. If any bits or encoding that are reserved for future standard use are set
     //     within `PC`, stop and report "PDT entry misconfigured" (cause = 267).
-    if ( PC->ta.reserved != 0 || PC->fsc.iosatp.reserved != 0 ||
-         ((PC->fsc.iosatp.MODE != IOSATP_Bare) &&
-          (PC->fsc.iosatp.MODE != IOSATP_Sv32) &&
-          (PC->fsc.iosatp.MODE != IOSATP_Sv39) &&
-          (PC->fsc.iosatp.MODE != IOSATP_Sv48) &&
-          (PC->fsc.iosatp.MODE != IOSATP_Sv57)) ) {
-        *cause = 267;     // PDT entry not misconfigured
-        return 1;
-    } 
-    //12. If any of the following conditions are true then stop and report
-    //     "PDT entry misconfigured" (cause = 267).
-    //    a. `capabilities.Sv32` is 0 and `PC.fsc.MODE` is `Sv32`
-    //    b. `capabilities.Sv39` is 0 and `PC.fsc.MODE` is `Sv39`
-    //    c. `capabilities.Sv48` is 0 and `PC.fsc.MODE` is `Sv48`
-    //    d. `capabilities.Sv57` is 0 and `PC.fsc.MODE` is `Sv57`
-    if ( ((PC->fsc.iosatp.MODE == IOSATP_Sv32) && (g_reg_file.capabilities.Sv32 == 0)) &&
-         ((PC->fsc.iosatp.MODE == IOSATP_Sv39) && (g_reg_file.capabilities.Sv39 == 0)) &&
-         ((PC->fsc.iosatp.MODE == IOSATP_Sv48) && (g_reg_file.capabilities.Sv48 == 0)) &&
-         ((PC->fsc.iosatp.MODE == IOSATP_Sv57) && (g_reg_file.capabilities.Sv57 == 0)) ) {
-        *cause = 267;     // PDT entry not misconfigured
+    //12. If any of the conditions listed in is_pc_misconfigured() are true then
+    //     stop and report "PDT entry misconfigured" (cause = 267).
+    if ( is_pc_misconfigured(PC) ) {
+        *cause = 267;     // PDT entry misconfigured
         return 1;
     }
     //13. The Process-context has been successfully located.
@@ -0,0 +1,558 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "iommu.h"
+// Set while a recording is in progress
+uint8_t g_recording = 0;
+// The records are encoded into the chunk buffer and the chunk is written to
+// the file when the next record may not fit. Requests may be presented from
+// multiple threads and the recorder state is held under the lock.
+static atomic_flag rec_lock = ATOMIC_FLAG_INIT;
+static FILE *rec_fp;
+static rec_hdr_t rec_hdr;
+static rec_index_t *rec_index;
+static uint64_t rec_max_chunks;
+static uint64_t rec_offset;
+static uint8_t rec_buf[REC_CHUNK_SIZE + 8];
+static uint32_t rec_len;
+static uint32_t rec_chunk_records;
+static uint64_t rec_prev_iova;
+static uint8_t rec_error;
+// Largest encoding of a record - a COMMANDS record with REC_MAX_COMMANDS
+#define REC_MAX_RECORD_SIZE (1 + 10 + 10 + (REC_MAX_COMMANDS * 16))
+
+static void
+put_varint(
+    uint64_t v) {
+    while ( v >= 0x80 ) {
+        rec_buf[rec_len++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    rec_buf[rec_len++] = v;
+    return;
+}
+static void
+flush_chunk(
+    void) {
+    rec_chunk_hdr_t chunk_hdr;
+    rec_index_t *index;
+    uint32_t pad;
+
+    if ( rec_chunk_records == 0 )
+        return;
+    if ( rec_hdr.num_chunks == rec_max_chunks ) {
+        rec_max_chunks = ( rec_max_chunks == 0 ) ? 64 : (rec_max_chunks * 2);
+        if ( (index = realloc(rec_index, (rec_max_chunks * sizeof(rec_index_t)))) == NULL ) {
+            rec_error = 1;
+            goto done;
+        }
+        rec_index = index;
+    }
+    rec_index[rec_hdr.num_chunks].offset = rec_offset;
+    rec_index[rec_hdr.num_chunks].first_record = rec_hdr.num_records - rec_chunk_records;
+    rec_hdr.num_chunks++;
+    chunk_hdr.num_records = rec_chunk_records;
+    chunk_hdr.num_bytes = rec_len;
+    // Pad the chunk so the next chunk header and the index are aligned
+    pad = (8 - (rec_len & 7)) & 7;
+    memset(&rec_buf[rec_len], 0, pad);
+    if ( fwrite(&chunk_hdr, sizeof(chunk_hdr), 1, rec_fp) != 1 ||
+         fwrite(rec_buf, (rec_len + pad), 1, rec_fp) != 1 )
+        rec_error = 1;
+    rec_offset += sizeof(chunk_hdr) + rec_len + pad;
+done:
+    rec_len = 0;
+    rec_chunk_records = 0;
+    rec_prev_iova = 0;
+    return;
+}
+// Start a record in the chunk buffer. The lock must be held.
+static void
+begin_record(
+    uint8_t type, uint8_t flags) {
+    if ( (rec_len + REC_MAX_RECORD_SIZE) > REC_CHUNK_SIZE )
+        flush_chunk();
+    rec_buf[rec_len++] = type | (flags << 3);
+    rec_chunk_records++;
+    rec_hdr.num_records++;
+    return;
+}
+// The arguments of the last reset of the IOMMU
+static void
+get_reset_args(
+    rec_reset_t *reset) {
+    memset(reset, 0, sizeof(*reset));
+    reset->num_hpm = g_num_hpm;
+    reset->hpmctr_bits = g_hpmctr_bits;
+    reset->eventID_mask = g_eventID_mask;
+    reset->num_vec_bits = g_num_vec_bits;
+    reset->reset_iommu_mode = g_reset_iommu_mode;
+    reset->fctrl = g_reset_fctrl.raw;
+    reset->capabilities = g_reg_file.capabilities.raw;
+    return;
+}
+static void
+lock_recorder(
+    void) {
+    while ( atomic_flag_test_and_set_explicit(&rec_lock, memory_order_acquire) )
+        ;
+    return;
+}
+static void
+unlock_recorder(
+    void) {
+    atomic_flag_clear_explicit(&rec_lock, memory_order_release);
+    return;
+}
+// Take the lock to add a record. The RECORD() check of g_recording is made
+// without the lock and the recording may have been stopped since. Returns
+// 0, with the lock released, if no recording is in progress.
+static uint8_t
+lock_recording(
+    void) {
+    lock_recorder();
+    if ( g_recording == 1 )
+        return 1;
+    unlock_recorder();
+    return 0;
+}
+// Start recording to the file at path. The table image of the tables
+// should be saved before the recording is started. Returns 1 if a
+// recording is in progress or the file could not be created.
+uint8_t
+iommu_record_start(
+    const char *path) {
+    lock_recorder();
+    if ( g_recording == 1 || (rec_fp = fopen(path, "wb")) == NULL ) {
+        unlock_recorder();
+        return 1;
+    }
+    memset(&rec_hdr, 0, sizeof(rec_hdr));
+    rec_hdr.magic = REC_MAGIC;
+    rec_hdr.version = REC_VERSION;
+    get_reset_args(&rec_hdr.reset);
+    rec_offset = sizeof(rec_hdr);
+    rec_index = NULL;
+    rec_max_chunks = 0;
+    rec_len = 0;
+    rec_chunk_records = 0;
+    rec_prev_iova = 0;
+    rec_error = ( fwrite(&rec_hdr, sizeof(rec_hdr), 1, rec_fp) != 1 ) ? 1 : 0;
+    // The invalidation request timeout is not held in the table image
+    if ( g_ats_inv_req_timeout_ticks != 0 ) {
+        begin_record(REC_EVENT, REC_EV_ATS_TIMEOUT);
+        put_varint(g_ats_inv_req_timeout_ticks);
+    }
+    g_recording = 1;
+    unlock_recorder();
+    return 0;
+}
+// Stop the recording and complete the file. Returns 1 if no recording is
+// in progress or the file could not be written.
+uint8_t
+iommu_record_stop(
+    void) {
+    uint8_t status;
+
+    if ( lock_recording() == 0 )
+        return 1;
+    g_recording = 0;
+    flush_chunk();
+    rec_hdr.index_offset = rec_offset;
+    if ( fwrite(rec_index, sizeof(rec_index_t), rec_hdr.num_chunks, rec_fp) != rec_hdr.num_chunks ||
+         fseek(rec_fp, 0, SEEK_SET) != 0 ||
+         fwrite(&rec_hdr, sizeof(rec_hdr), 1, rec_fp) != 1 )
+        rec_error = 1;
+    status = rec_error;
+    if ( fclose(rec_fp) != 0 ) status = 1;
+    free(rec_index);
+    rec_index = NULL;
+    unlock_recorder();
+    return status;
+}
+void
+record_request(
+    hb_to_iommu_req_t *req) {
+    uint64_t delta;
+
+    if ( lock_recording() == 0 )
+        return;
+    begin_record(req->tr.at,
+                 (req->pid_valid | (req->no_write << 1) | (req->exec_req << 2) |
+                  (req->priv_req << 3) | (req->tr.read_writeAMO << 4)));
+    put_varint(req->device_id);
+    if ( req->pid_valid )
+        put_varint(req->process_id);
+    delta = req->tr.iova - rec_prev_iova;
+    put_varint((delta << 1) ^ (uint64_t)((int64_t)delta >> 63));
+    rec_prev_iova = req->tr.iova;
+    put_varint(((uint64_t)req->tr.length << 1) | (req->is_cxl_dev & 1));
+    if ( req->tr.read_writeAMO == WRITE )
+        put_varint(req->tr.msi_wr_data);
+    unlock_recorder();
+    return;
+}
+// Record the register write. Software writes the commands to the command
+// queue before advancing cqt, so on a write to cqt the commands between the
+// old and the new cqt are recorded ahead of the write.
+void
+record_register_write(
+    uint16_t offset, uint8_t num_bytes, uint64_t data) {
+    uint32_t index, cqt, mask, count;
+    uint64_t base;
+
+    if ( lock_recording() == 0 )
+        return;
+    if ( offset == CQT_OFFSET && num_bytes == 4 && g_reg_file.cqcsr.cqon == 1 ) {
+        mask = (1UL << (g_reg_file.cqb.log2szm1 + 1)) - 1;
+        base = g_reg_file.cqb.ppn * PAGESIZE;
+        index = g_reg_file.cqt.index & mask;
+        cqt = data & mask;
+        while ( index != cqt ) {
+            // Record the commands up to the end of the queue or the new cqt
+            count = ( cqt > index ) ? (cqt - index) : ((mask + 1) - index);
+            if ( count > REC_MAX_COMMANDS ) count = REC_MAX_COMMANDS;
+            begin_record(REC_COMMANDS, 0);
+            put_varint(index);
+            put_varint(count);
+            for ( ; count != 0; count--, index++, rec_len += 16 )
+                if ( read_memory((base + (index * 16)), 16, (char *)&rec_buf[rec_len]) != 0 )
+                    memset(&rec_buf[rec_len], 0, 16);
+            index &= mask;
+        }
+    }
+    begin_record(REC_MMIO, (num_bytes == 8) ? 1 : 0);
+    put_varint(offset);
+    put_varint(data);
+    unlock_recorder();
+    return;
+}
+void
+record_process_commands(
+    void) {
+    if ( lock_recording() == 0 )
+        return;
+    begin_record(REC_PROCESS, 0);
+    unlock_recorder();
+    return;
+}
+void
+record_reset(
+    void) {
+    rec_reset_t reset;
+
+    get_reset_args(&reset);
+    if ( lock_recording() == 0 )
+        return;
+    begin_record(REC_EVENT, REC_EV_RESET);
+    put_varint(reset.num_hpm);
+    put_varint(reset.hpmctr_bits);
+    put_varint(reset.eventID_mask);
+    put_varint(reset.num_vec_bits);
+    put_varint(reset.reset_iommu_mode);
+    put_varint(reset.capabilities);
+    put_varint(reset.fctrl);
+    unlock_recorder();
+    return;
+}
+// Record the clock advance, the ATS timer expiry or the change of the
+// invalidation request timeout
+void
+record_event(
+    uint8_t event, uint64_t data) {
+    if ( lock_recording() == 0 )
+        return;
+    begin_record(REC_EVENT, event);
+    put_varint(data);
+    unlock_recorder();
+    return;
+}
+void
+record_invalidation_completion(
+    ats_msg_t *inv_cc) {
+    if ( lock_recording() == 0 )
+        return;
+    begin_record(REC_EVENT, REC_EV_INV_COMPLETION);
+    put_varint(inv_cc->RID);
+    put_varint(((uint64_t)inv_cc->DSEG << 1) | (inv_cc->DSV & 1));
+    put_varint(inv_cc->PAYLOAD);
+    unlock_recorder();
+    return;
+}
+
+static uint8_t
+get_varint(
+    rec_reader_t *r, uint64_t *v) {
+    uint8_t shift, b;
+
+    *v = 0;
+    for ( shift = 0; shift < 64; shift += 7 ) {
+        if ( r->pos >= r->end )
+            return 1;
+        b = *r->pos++;
+        *v |= (uint64_t)(b & 0x7F) << shift;
+        if ( (b & 0x80) == 0 )
+            return 0;
+    }
+    return 1;
+}
+static uint8_t
+load_chunk(
+    rec_reader_t *r, uint64_t chunk) {
+    const rec_chunk_hdr_t *chunk_hdr;
+    uint64_t offset;
+
+    r->chunk = chunk;
+    if ( chunk >= r->hdr->num_chunks ) {
+        r->chunk_records = 0;
+        r->record = r->hdr->num_records;
+        return 0;
+    }
+    offset = r->index[chunk].offset;
+    if ( (offset + sizeof(rec_chunk_hdr_t)) > r->hdr->index_offset )
+        return 1;
+    chunk_hdr = (const rec_chunk_hdr_t *)(r->base + offset);
+    if ( (offset + sizeof(rec_chunk_hdr_t) + chunk_hdr->num_bytes) > r->hdr->index_offset )
+        return 1;
+    r->pos = r->base + offset + sizeof(rec_chunk_hdr_t);
+    r->end = r->pos + chunk_hdr->num_bytes;
+    r->chunk_records = chunk_hdr->num_records;
+    r->record = r->index[chunk].first_record;
+    r->prev_iova = 0;
+    return 0;
+}
+// Map the recording at path for replay and position it at the first
+// record. Returns 1 if the file is not a valid recording.
+uint8_t
+iommu_replay_open(
+    rec_reader_t *r, const char *path) {
+    struct stat st;
+    void *base;
+    int fd;
+
+    if ( (fd = open(path, O_RDONLY)) < 0 )
+        return 1;
+    if ( fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(rec_hdr_t) ) {
+        close(fd);
+        return 1;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( base == MAP_FAILED )
+        return 1;
+    r->base = base;
+    r->size = st.st_size;
+    r->hdr = (const rec_hdr_t *)base;
+    r->index = (const rec_index_t *)(r->base + r->hdr->index_offset);
+    if ( r->hdr->magic != REC_MAGIC || r->hdr->version != REC_VERSION ||
+         r->hdr->index_offset > r->size ||
+         r->hdr->num_chunks > ((r->size - r->hdr->index_offset) / sizeof(rec_index_t)) ||
+         load_chunk(r, 0) != 0 ) {
+        munmap(base, st.st_size);
+        return 1;
+    }
+    return 0;
+}
+void
+iommu_replay_close(
+    rec_reader_t *r) {
+    munmap((void *)r->base, r->size);
+    return;
+}
+// Decode the next record. Returns 1 at the end of the recording or if the
+// record is malformed.
+uint8_t
+iommu_replay_next(
+    rec_reader_t *r, rec_t *rec) {
+    uint64_t v;
+    uint8_t tag, flags;
+
+    while ( r->chunk_records == 0 ) {
+        if ( r->chunk >= r->hdr->num_chunks ||
+             load_chunk(r, (r->chunk + 1)) != 0 ||
+             r->chunk >= r->hdr->num_chunks )
+            return 1;
+    }
+    if ( r->pos >= r->end )
+        return 1;
+    tag = *r->pos++;
+    rec->type = tag & 0x7;
+    flags = tag >> 3;
+    switch ( rec->type ) {
+        case REC_UNTRANSLATED:
+        case REC_ATS_REQUEST:
+        case REC_TRANSLATED:
+            memset(&rec->req, 0, sizeof(rec->req));
+            rec->req.tr.at = rec->type;
+            rec->req.pid_valid = flags & 1;
+            rec->req.no_write = (flags >> 1) & 1;
+            rec->req.exec_req = (flags >> 2) & 1;
+            rec->req.priv_req = (flags >> 3) & 1;
+            rec->req.tr.read_writeAMO = (flags >> 4) & 1;
+            if ( get_varint(r, &v) != 0 ) return 1;
+            rec->req.device_id = v;
+            if ( rec->req.pid_valid ) {
+                if ( get_varint(r, &v) != 0 ) return 1;
+                rec->req.process_id = v;
+            }
+            if ( get_varint(r, &v) != 0 ) return 1;
+            r->prev_iova += (v >> 1) ^ -(v & 1);
+            rec->req.tr.iova = r->prev_iova;
+            if ( get_varint(r, &v) != 0 ) return 1;
+            rec->req.tr.length = v >> 1;
+            rec->req.is_cxl_dev = v & 1;
+            if ( rec->req.tr.read_writeAMO == WRITE ) {
+                if ( get_varint(r, &v) != 0 ) return 1;
+                rec->req.tr.msi_wr_data = v;
+            }
+            break;
+        case REC_MMIO:
+            rec->num_bytes = ( flags & 1 ) ? 8 : 4;
+            if ( get_varint(r, &v) != 0 ) return 1;
+            rec->offset = v;
+            if ( get_varint(r, &rec->data) != 0 ) return 1;
+            break;
+        case REC_COMMANDS:
+            if ( get_varint(r, &v) != 0 ) return 1;
+            rec->cq_index = v;
+            if ( get_varint(r, &v) != 0 || v > REC_MAX_COMMANDS ||
+                 (uint64_t)(r->end - r->pos) < (v * 16) )
+                return 1;
+            rec->num_commands = v;
+            rec->commands = r->pos;
+            r->pos += v * 16;
+            break;
+        case REC_PROCESS:
+            break;
+        case REC_EVENT:
+            rec->event = flags;
+            switch ( rec->event ) {
+                case REC_EV_RESET:
+                    memset(&rec->reset, 0, sizeof(rec->reset));
+                    if ( get_varint(r, &v) != 0 ) return 1;
+                    rec->reset.num_hpm = v;
+                    if ( get_varint(r, &v) != 0 ) return 1;
+                    rec->reset.hpmctr_bits = v;
+                    if ( get_varint(r, &v) != 0 ) return 1;
+                    rec->reset.eventID_mask = v;
+                    if ( get_varint(r, &v) != 0 ) return 1;
+                    rec->reset.num_vec_bits = v;
+                    if ( get_varint(r, &v) != 0 ) return 1;
+                    rec->reset.reset_iommu_mode = v;
+                    if ( get_varint(r, &rec->reset.capabilities) != 0 ) return 1;
+                    if ( get_varint(r, &v) != 0 ) return 1;
+                    rec->reset.fctrl = v;
+                    break;
+                case REC_EV_CLOCK:
+                case REC_EV_ATS_TIMER_EXPIRY:
+                case REC_EV_ATS_TIMEOUT:
+                    if ( get_varint(r, &rec->data) != 0 ) return 1;
+                    break;
+                case REC_EV_INV_COMPLETION:
+                    memset(&rec->inv_cc, 0, sizeof(rec->inv_cc));
+                    rec->inv_cc.MSGCODE = INVAL_COMPL_MSG_CODE;
+                    if ( get_varint(r, &v) != 0 ) return 1;
+                    rec->inv_cc.RID = v;
+                    if ( get_varint(r, &v) != 0 ) return 1;
+                    rec->inv_cc.DSV = v & 1;
+                    rec->inv_cc.DSEG = v >> 1;
+                    if ( get_varint(r, &rec->inv_cc.PAYLOAD) != 0 ) return 1;
+                    break;
+                default:
+                    return 1;
+            }
+            break;
+        default:
+            return 1;
+    }
+    r->chunk_records--;
+    r->record++;
+    return 0;
+}
+// Position the recording at record number rec_num. Returns 1 if there is
+// no such record or the recording is malformed.
+uint8_t
+iommu_replay_seek(
+    rec_reader_t *r, uint64_t rec_num) {
+    uint64_t lo, hi, mid;
+    rec_t rec;
+
+    if ( rec_num > r->hdr->num_records )
+        return 1;
+    // Find the last chunk that starts at or before the record
+    lo = 0;
+    hi = r->hdr->num_chunks;
+    while ( (hi - lo) > 1 ) {
+        mid = (lo + hi) / 2;
+        if ( r->index[mid].first_record <= rec_num )
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if ( load_chunk(r, lo) != 0 )
+        return 1;
+    while ( r->record < rec_num )
+        if ( iommu_replay_next(r, &rec) != 0 )
+            return 1;
+    return 0;
+}
+// Apply the record to the IOMMU. The response to a request is provided in
+// rsp_msg.
+void
+iommu_replay_apply(
+    rec_t *rec, iommu_to_hb_rsp_t *rsp_msg) {
+    capabilities_t cap;
+    uint32_t i, mask;
+    uint64_t base;
+    fctrl_t fctrl;
+
+    switch ( rec->type ) {
+        case REC_UNTRANSLATED:
+        case REC_ATS_REQUEST:
+        case REC_TRANSLATED:
+            iommu_translate_iova(&rec->req, rsp_msg);
+            break;
+        case REC_MMIO:
+            write_register(rec->offset, rec->num_bytes, rec->data);
+            break;
+        case REC_COMMANDS:
+            mask = (1UL << (g_reg_file.cqb.log2szm1 + 1)) - 1;
+            base = g_reg_file.cqb.ppn * PAGESIZE;
+            for ( i = 0; i < rec->num_commands; i++ )
+                write_memory((char *)&rec->commands[i * 16],
+                             (base + (((rec->cq_index + i) & mask) * 16)), 16);
+            break;
+        case REC_PROCESS:
+            process_commands();
+            break;
+        case REC_EVENT:
+            switch ( rec->event ) {
+                case REC_EV_RESET:
+                    cap.raw = rec->reset.capabilities;
+                    fctrl.raw = rec->reset.fctrl;
+                    reset_iommu(rec->reset.num_hpm, rec->reset.hpmctr_bits,
+                                rec->reset.eventID_mask, rec->reset.num_vec_bits,
+                                rec->reset.reset_iommu_mode, cap, fctrl);
+                    break;
+                case REC_EV_CLOCK:
+                    iommu_advance_clock(rec->data);
+                    break;
+                case REC_EV_INV_COMPLETION:
+                    handle_invalidation_completion(&rec->inv_cc);
+                    break;
+                case REC_EV_ATS_TIMER_EXPIRY:
+                    do_ats_timer_expiry(rec->data);
+                    break;
+                case REC_EV_ATS_TIMEOUT:
+                    iommu_set_ats_inv_req_timeout(rec->data);
+                    break;
+            }
+            break;
+    }
+    return;
+}
@@ -5,6 +5,89 @@
 
 #include "iommu.h"
 
+// Check a PTE read from level i of a S/VS-stage page table of the MODE for the
+// conditions that cause a page fault irrespective of the access type.
+pte_check_t
+check_s_vs_pte(
+    pte_t pte, uint8_t i, uint8_t MODE) {
+    uint16_t ppn[5];
+
+    // 3. If pte.v = 0, or if pte.r = 0 and pte.w = 1, or if any bits or 
+    //    encodings that are reserved for future standard use are set within pte,
+    //    stop and raise a page-fault exception to the original access type.
+    if ( pte.V == 0 ) return PTE_NOT_VALID;
+    if ( pte.R == 0 && pte.W == 1 ) return PTE_W_WITHOUT_R;
+    if ( (pte.N == 1) && (g_reg_file.capabilities.Svnapot == 0) ) return PTE_BAD_NAPOT;
+    if ( ((pte.PBMT != 0) && (g_reg_file.capabilities.Svpbmt == 0)) ||
+         (pte.PBMT == 3) ) return PTE_BAD_PBMT;
+    if ( pte.reserved != 0 ) return PTE_RESERVED;
+
+    // NAPOT PTEs behave identically to non-NAPOT PTEs within the address-translation
+    // algorithm in Section 4.3.2, except that:
+    // a. If the encoding in pte is valid according to Table 5.1, then instead of 
+    //    returning the original value of pte, implicit reads of a NAPOT PTE 
+    //    return a copy of pte in which pte.ppn[pte.napot bits − 1 : 0] is replaced 
+    //    by vpn[i][pte.napot bits − 1 : 0]. If the encoding in pte is reserved 
+    //    according to Table 5.1, then a page-fault exception must be raised.
+    //    i     pte.ppn[i]     Description                   pte.napot bits
+    //    0    x xxxx xxx1      Reserved                           −
+    //    0    x xxxx xx1x      Reserved                           −
+    //    0    x xxxx x1xx      Reserved                           −
+    //    0    x xxxx 1000      64 KiB contiguous region           4
+    //    0    x xxxx 0xxx      Reserved                           −
+    //    ≥ 1  x xxxx xxxx      Reserved                           −
+    if ( i != 0 && pte.N ) return PTE_BAD_NAPOT;
+
+    // 4. Otherwise, the PTE is valid. If pte.r = 1 or pte.x = 1, go to step 5. 
+    //    Otherwise, this PTE is a pointer to the next level of the page table. 
+    //    Let i = i − 1. If i < 0, stop and raise a page-fault exception 
+    //    corresponding to the original access type.
+    if ( pte.R == 0 && pte.X == 0 ) {
+        // For non-leaf PTEs, bits 62–61 are reserved for future standard use. Until 
+        // their use is defined by a standard extension, they must be cleared by 
+        // software for forward compatibility, or else a page-fault exception is raised.
+        if ( pte.PBMT != 0 ) return PTE_BAD_PBMT;
+        if ( i == 0 ) return PTE_NOT_LEAF;
+        return PTE_OK;
+    }
+
+    ppn[4] = ppn[3] = ppn[2] = ppn[1] = ppn[0] = 0;
+    if ( MODE == IOSATP_Sv32 ) {
+        ppn[0] = get_bits(19, 10, pte.raw);
+        ppn[1] = get_bits(31, 20, pte.raw);
+    }
+    if ( MODE == IOSATP_Sv39 ) {
+        ppn[0] = get_bits(18, 10, pte.raw);
+        ppn[1] = get_bits(27, 19, pte.raw);
+        ppn[2] = get_bits(53, 28, pte.raw);
+    }
+    if ( MODE == IOSATP_Sv48 ) {
+        ppn[0] = get_bits(18, 10, pte.raw);
+        ppn[1] = get_bits(27, 19, pte.raw);
+        ppn[2] = get_bits(36, 28, pte.raw);
+        ppn[3] = get_bits(53, 37, pte.raw);
+    }
+    if ( MODE == IOSATP_Sv57 ) {
+        ppn[0] = get_bits(18, 10, pte.raw);
+        ppn[1] = get_bits(27, 19, pte.raw);
+        ppn[2] = get_bits(36, 28, pte.raw);
+        ppn[3] = get_bits(45, 37, pte.raw);
+        ppn[4] = get_bits(53, 46, pte.raw);
+    }
+    // 6. If i > 0 and pte.ppn[i − 1 : 0] = 0, this is a misaligned superpage; 
+    // stop and raise a page-fault exception corresponding to the original 
+    // access type.
+    if ( i > 0 ) {
+        switch ( (i - 1) ) {
+            case 3: if ( ppn[3] ) return PTE_MISALIGNED;
+            case 2: if ( ppn[2] ) return PTE_MISALIGNED;
+            case 1: if ( ppn[1] ) return PTE_MISALIGNED;
+            case 0: if ( ppn[0] ) return PTE_MISALIGNED;
+        }
+    }
+    if ( i == 0 && pte.N && ((pte.PPN & 0xF) != 0x8) ) return PTE_BAD_NAPOT;
+    return PTE_OK;
+}
 uint8_t
 s_vs_stage_address_translation(
     uint64_t iova,
@@ -15,7 +98,6 @@ s_vs_stage_address_translation(
     uint8_t pid_valid, uint32_t process_id, uint32_t device_id, uint8_t TTYP, uint8_t T2GPA) {
 
     uint16_t vpn[5];
-    uint16_t ppn[5];
     pte_t pte, amo_pte;
     uint8_t NL_G = 1;
     uint8_t i, PTESIZE, LEVELS, status, pte_changed;
@@ -52,8 +134,12 @@ s_vs_stage_address_translation(
         goto page_fault;
 
     // Hit in IOATC - complete translation.
-    if ( ioatc_status == IOATC_HIT )
+    if ( ioatc_status == IOATC_HIT ) {
+        // Count hits on translations cached from G-stage page tables only
+        if ( GV == 1 && PSCV == 0 )
+            count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, G_STAGE_CACHE_HIT);
         return 0;
+    }
 
     // Count misses in TLB
     count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, IOATC_TLB_MISS);
@@ -143,41 +229,18 @@ step_2:
 
     // Count S/VS stage page walks
     count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, S_VS_PT_WALKS);
+    count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, S_VS_PT_WALK_LEVEL0 + i);
 
+    COST_MEM_READ();
     status = read_memory((a + (vpn[i] * PTESIZE)), PTESIZE, (char *)&pte.raw);
     if ( status != 0 ) goto access_fault;
 
     // 3. If pte.v = 0, or if pte.r = 0 and pte.w = 1, or if any bits or 
     //    encodings that are reserved for future standard use are set within pte,
     //    stop and raise a page-fault exception to the original access type.
-    if ( (pte.V == 0) || (pte.R == 0 && pte.W == 1) || 
-         ((pte.N == 1) && (g_reg_file.capabilities.Svnapot == 0)) ||
-         ((pte.PBMT != 0) && (g_reg_file.capabilities.Svpbmt == 0)) ||
-         (pte.PBMT == 3) ||
-         (pte.reserved != 0) )
-        goto page_fault;
-
-    // NAPOT PTEs behave identically to non-NAPOT PTEs within the address-translation
-    // algorithm in Section 4.3.2, except that:
-    // a. If the encoding in pte is valid according to Table 5.1, then instead of 
-    //    returning the original value of pte, implicit reads of a NAPOT PTE 
-    //    return a copy of pte in which pte.ppn[pte.napot bits − 1 : 0] is replaced 
-    //    by vpn[i][pte.napot bits − 1 : 0]. If the encoding in pte is reserved 
-    //    according to Table 5.1, then a page-fault exception must be raised.
-    //    i     pte.ppn[i]     Description                   pte.napot bits
-    //    0    x xxxx xxx1      Reserved                           −
-    //    0    x xxxx xx1x      Reserved                           −
-    //    0    x xxxx x1xx      Reserved                           −
-    //    0    x xxxx 1000      64 KiB contiguous region           4
-    //    0    x xxxx 0xxx      Reserved                           −
-    //    ≥ 1  x xxxx xxxx      Reserved                           −
-    // b. Implicit reads of NAPOT page table entries may create address-translation
-    //    cache entries mapping a + va.vpn[j] × PTESIZE to a copy of pte in which 
-    //    pte.ppn[pte.napot bits − 1 : 0] is replaced by vpn[0][pte.napot bits − 1 : 0], 
-    //    for any or all j such that j[8 : napot bits] = i[8 : napot bits], all for 
-    //    the address space identified in satp as loaded by step 0.
-    if ( i != 0 && pte.N ) goto page_fault;
-
+    //    The checks that do not depend on the access type, including those of
+    //    steps 4 and 6 and of the NAPOT encoding, are made by check_s_vs_pte().
+    if ( check_s_vs_pte(pte, i, iosatp.MODE) != PTE_OK ) goto page_fault;
 
     // 4. Otherwise, the PTE is valid. If pte.r = 1 or pte.x = 1, go to step 5. 
     //    Otherwise, this PTE is a pointer to the next level of the page table. 
@@ -191,13 +254,7 @@ step_2:
     // all mappings in the subsequent levels of the page table are global.
     NL_G = NL_G & pte.G;
 
-    // For non-leaf PTEs, bits 62–61 are reserved for future standard use. Until 
-    // their use is defined by a standard extension, they must be cleared by 
-    // software for forward compatibility, or else a page-fault exception is raised.
-    if ( pte.PBMT != 0 ) goto page_fault;
-
     i = i - 1;
-    if ( i < 0 ) goto page_fault;
     a = pte.PPN * PAGESIZE;
     goto step_2;
 
@@ -236,39 +293,7 @@ step_5:
     // with U-bit in PTE set to 1 will fault.
     if ( (priv == S_MODE) && !is_exec && SUM == 0 && pte.U == 1 ) goto page_fault;
 
-    ppn[4] = ppn[3] = ppn[2] = ppn[1] = ppn[0] = 0;
-    if ( iosatp.MODE == IOSATP_Sv32 ) {
-        ppn[0] = get_bits(19, 10, pte.raw);
-        ppn[1] = get_bits(31, 20, pte.raw);
-    }
-    if ( iosatp.MODE == IOSATP_Sv39 ) {
-        ppn[0] = get_bits(18, 10, pte.raw);
-        ppn[1] = get_bits(27, 19, pte.raw);
-        ppn[2] = get_bits(53, 28, pte.raw);
-    }
-    if ( iosatp.MODE == IOSATP_Sv48 ) {
-        ppn[0] = get_bits(18, 10, pte.raw);
-        ppn[1] = get_bits(27, 19, pte.raw);
-        ppn[2] = get_bits(36, 28, pte.raw);
-        ppn[3] = get_bits(53, 37, pte.raw);
-    }
-    if ( iosatp.MODE == IOSATP_Sv57 ) {
-        ppn[0] = get_bits(18, 10, pte.raw);
-        ppn[1] = get_bits(27, 19, pte.raw);
-        ppn[2] = get_bits(36, 28, pte.raw);
-        ppn[3] = get_bits(45, 37, pte.raw);
-        ppn[4] = get_bits(53, 46, pte.raw);
-    }
-    // 6. If i > 0 and pte.ppn[i − 1 : 0] = 0, this is a misaligned superpage; 
-    // stop and raise a page-fault exception corresponding to the original 
-    // access type.
     if ( i > 0 ) {
-        switch ( (i - 1) ) {
-            case 3: if ( ppn[3] ) goto page_fault;
-            case 2: if ( ppn[2] ) goto page_fault;
-            case 1: if ( ppn[1] ) goto page_fault;
-            case 0: if ( ppn[0] ) goto page_fault;
-        }
         // Determine page size
         if ( iosatp.MODE == IOSATP_Sv32 ) {
             *page_sz = 4 * 1024 * 1024;  // 4M;
@@ -281,22 +306,11 @@ step_5:
                 case 1: *page_sz *= 512; //   2MiB
             }
         }
+    } else {
+        // A NAPOT PTE maps a 64 KiB contiguous region
+        *page_sz = ( pte.N == 1 ) ? (16 * PAGESIZE) : PAGESIZE;
     }
 
-    // a. If the encoding in pte is valid according to Table 5.1, then instead of 
-    //    returning the original value of pte, implicit reads of a NAPOT PTE 
-    //    return a copy of pte in which pte.ppn[pte.napot bits − 1 : 0] is replaced 
-    //    by vpn[i][pte.napot bits − 1 : 0]. If the encoding in pte is reserved 
-    //    according to Table 5.1, then a page-fault exception must be raised.
-    //    i     pte.ppn[i]     Description                   pte.napot bits
-    //    0    x xxxx xxx1      Reserved                           −
-    //    0    x xxxx xx1x      Reserved                           −
-    //    0    x xxxx x1xx      Reserved                           −
-    //    0    x xxxx 1000      64 KiB contiguous region           4
-    //    0    x xxxx 0xxx      Reserved                           −
-    //    ≥ 1  x xxxx xxxx      Reserved                           −
-    if ( i == 0 && pte.N && ((pte.PPN & 0xF) != 0x8) ) goto page_fault;
-
     // IOMMU A/D bit behavior:
     //    When `capabilities.AMO` is 1, the IOMMU supports updating the A and D bits in
     //    PTEs atomically. If `capabilities.AMO` is 0, the IOMMU ignores the A and D bits
@@ -325,6 +339,7 @@ step_5:
     // Count S/VS stage page walks
     count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, S_VS_PT_WALKS);
 
+    COST_AD_AMO();
     status = read_memory_for_AMO((a + (vpn[i] * PTESIZE)), PTESIZE, (char *)&amo_pte.raw);
 
     if ( status != 0 ) goto access_fault;
@@ -340,6 +355,10 @@ step_5:
 
     if ( status != 0 ) goto access_fault;
 
+    // Count A/D bit updates
+    if ( pte_changed == 0 )
+        count_events(pid_valid, process_id, PSCV, PSCID, device_id, GV, GSCID, AD_UPDATE_WRITES);
+
     if ( pte_changed == 1) goto step_2;
 
 step_8:
@@ -0,0 +1,112 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include "iommu.h"
+// Types of records to trace - no records are traced till a ring is provided
+uint8_t g_trace_mask = 0;
+// IOATC lookup status of the translation in progress
+uint8_t g_trace_ioatc = TRACE_IOATC_NONE;
+// The ring is indexed by free running head and tail counters. Producers
+// reserve a slot by advancing the tail and the head is advanced only by the
+// consumer. The seq of a slot is the tail value that may reserve it when the
+// slot is free and one more than that when the record in it is published.
+static trace_rec_t *trace_ring;
+static uint32_t trace_ring_mask;
+static _Atomic uint64_t trace_head;
+static _Atomic uint64_t trace_tail;
+static _Atomic uint64_t trace_dropped;
+
+// Provide the ring to hold num_records trace records and select the types
+// of records to trace. num_records must be a power of 2. A NULL ring or a
+// type_mask of 0 stops tracing. Returns 1 if the ring size is not valid.
+// Must not be invoked while records are being produced or drained.
+uint8_t
+iommu_trace_init(
+    trace_rec_t *ring, uint32_t num_records, uint8_t type_mask) {
+    uint32_t i;
+
+    if ( ring != NULL && (num_records == 0 || (num_records & (num_records - 1)) != 0) )
+        return 1;
+    g_trace_mask = 0;
+    trace_ring = ring;
+    trace_ring_mask = num_records - 1;
+    for ( i = 0; ring != NULL && i < num_records; i++ )
+        __atomic_store_n(&ring[i].seq, i, __ATOMIC_RELAXED);
+    atomic_store_explicit(&trace_head, 0, memory_order_relaxed);
+    atomic_store_explicit(&trace_tail, 0, memory_order_relaxed);
+    atomic_store_explicit(&trace_dropped, 0, memory_order_relaxed);
+    g_trace_mask = ( ring == NULL ) ? 0 : (type_mask & TRACE_ALL);
+    return 0;
+}
+void
+trace_record(
+    uint8_t type, uint8_t a, uint16_t b, uint32_t device_id,
+    uint32_t process_id, uint32_t c, uint64_t d0, uint64_t d1) {
+    trace_rec_t *rec;
+    uint64_t tail, seq;
+
+    if ( trace_ring == NULL )
+        return;
+    // Reserve the slot at the tail. A slot that has not been drained since
+    // the last revolution has a seq behind the tail and the ring is full.
+    tail = atomic_load_explicit(&trace_tail, memory_order_relaxed);
+    for ( ;; ) {
+        rec = &trace_ring[tail & trace_ring_mask];
+        seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if ( seq == tail ) {
+            if ( atomic_compare_exchange_weak_explicit(&trace_tail, &tail, tail + 1,
+                                                       memory_order_relaxed,
+                                                       memory_order_relaxed) )
+                break;
+        } else if ( (int64_t)(seq - tail) < 0 ) {
+            atomic_fetch_add_explicit(&trace_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            tail = atomic_load_explicit(&trace_tail, memory_order_relaxed);
+        }
+    }
+    rec->clock = g_iommu_clock;
+    rec->type = type;
+    rec->a = a;
+    rec->b = b;
+    rec->device_id = device_id;
+    rec->process_id = process_id;
+    rec->c = c;
+    rec->d0 = d0;
+    rec->d1 = d1;
+    // Publish the record to the consumer
+    __atomic_store_n(&rec->seq, tail + 1, __ATOMIC_RELEASE);
+    return;
+}
+// Drain up to max_records records from the ring. Returns the number of
+// records drained. May be invoked from a thread other than the ones
+// producing the records. Draining stops at a reserved slot whose record
+// is not yet published.
+uint32_t
+iommu_trace_drain(
+    trace_rec_t *recs, uint32_t max_records) {
+    trace_rec_t *rec;
+    uint64_t head;
+    uint32_t n;
+
+    if ( trace_ring == NULL )
+        return 0;
+    head = atomic_load_explicit(&trace_head, memory_order_relaxed);
+    for ( n = 0; n < max_records; n++, head++ ) {
+        rec = &trace_ring[head & trace_ring_mask];
+        if ( __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != (head + 1) )
+            break;
+        recs[n] = *rec;
+        // Release the slot to the producers for the next revolution
+        __atomic_store_n(&rec->seq, (head + trace_ring_mask + 1), __ATOMIC_RELEASE);
+    }
+    atomic_store_explicit(&trace_head, head, memory_order_relaxed);
+    return n;
+}
+// Number of records dropped as the ring was full
+uint64_t
+iommu_trace_dropped(
+    void) {
+    return atomic_load_explicit(&trace_dropped, memory_order_relaxed);
+}
@@ -5,6 +5,32 @@
 
 #include "iommu.h"
 
+// Page size of passthrough translations - the largest page supported by
+// both the S/VS-stage and the G-stage page tables
+static uint64_t
+passthrough_page_size(
+    void) {
+    uint64_t s_page_sz, g_page_sz;
+
+    s_page_sz = g_page_sz = PAGESIZE;
+    if ( g_reg_file.capabilities.Sv57 == 1 ) 
+        s_page_sz = 512UL * 512UL * 512UL * 512UL * PAGESIZE;
+    else if ( g_reg_file.capabilities.Sv48 == 1 ) 
+        s_page_sz = 512UL * 512UL * 512UL * PAGESIZE;
+    else if ( g_reg_file.capabilities.Sv39 == 1 ) 
+        s_page_sz = 512UL * 512UL * PAGESIZE;
+    else if ( g_reg_file.capabilities.Sv32 == 1 ) 
+        s_page_sz = 2UL * 512UL * PAGESIZE;
+    if ( g_reg_file.capabilities.Sv57x4 == 1 ) 
+        g_page_sz = 512UL * 512UL * 512UL * 512UL * PAGESIZE;
+    else if ( g_reg_file.capabilities.Sv48x4 == 1 ) 
+        g_page_sz = 512UL * 512UL * 512UL * PAGESIZE;
+    else if ( g_reg_file.capabilities.Sv39x4 == 1 ) 
+        g_page_sz = 512UL * 512UL * PAGESIZE;
+    else if ( g_reg_file.capabilities.Sv32x4 == 1 ) 
+        g_page_sz = 2UL * 512UL * PAGESIZE;
+    return ( s_page_sz < g_page_sz ) ? s_page_sz : g_page_sz;
+}
 void 
 iommu_translate_iova(
     hb_to_iommu_req_t *req, iommu_to_hb_rsp_t *rsp_msg) {
@@ -30,6 +56,21 @@ iommu_translate_iova(
     is_read = is_write = is_exec = 0;
     is_unsup = is_msi = is_mrif_wr = 0;
     priv = U_MODE;
+    // Faults detected before the device context is located are reported
+    DC.tc.DTF = 0;
+
+    // Record the request
+    RECORD(record_request(req));
+
+    // Start accumulating the cost of this request
+    COST_BEGIN();
+
+    // Trace the request
+    g_trace_ioatc = TRACE_IOATC_NONE;
+    TRACE(TRACE_REQUEST, req->tr.at,
+          (req->pid_valid | (req->no_write << 1) | (req->exec_req << 2) |
+           (req->priv_req << 3) | (req->tr.read_writeAMO << 4)),
+          req->device_id, req->process_id, req->tr.length, req->tr.iova, req->tr.msi_wr_data);
 
     // Count events
     if ( req->tr.at == ADDR_TYPE_UNTRANSLATED )
@@ -118,6 +159,8 @@ iommu_translate_iova(
             cause = 260; // "Transaction type disallowed" 
             goto stop_and_report_fault;
         } 
+        // No translation or protection and no device context to locate
+        goto passthrough;
     }
     // 3. If `capabilities.MSI_FLAT` is 0 then the IOMMU uses base-format device
     //    context. Let `DDI[0]` be `device_id[6:0]`, `DDI[1]` be `device_id[15:7]`, and
@@ -309,6 +352,10 @@ step_9:
     goto step_16;
 
 step_16:
+    // When neither a S/VS-stage nor a G-stage page table is active there is
+    // no translation or protection and the page tables need not be walked
+    if ( iosatp.MODE == IOSATP_Bare && iohgatp.MODE == IOHGATP_Bare )
+        goto passthrough;
 
     // Miss in IOATC - continue to page table translations
     // 16. If a G-stage page table is not active in the device-context then use the
@@ -324,6 +371,15 @@ step_16:
                         &PBMT, &UNTRANSLATED_ONLY, req->pid_valid, req->process_id, req->device_id,
                         TTYP, DC.tc.T2GPA) )
         goto stop_and_report_fault;
+    goto step_18;
+
+passthrough:
+    // The IOVA is identity mapped with full permissions
+    pa = req->tr.iova;
+    page_sz = passthrough_page_size();
+    R = W = X = G = 1;
+    UNTRANSLATED_ONLY = 0;
+    PBMT = PMA;
 
 step_18:
     // 18. Translation process is complete
@@ -411,14 +467,21 @@ step_18:
         rsp_msg->trsp.W      = W;
         rsp_msg->trsp.Exe    = (X & R);
     }
+    COST_END(TTYP, req->device_id);
+    TRACE(TRACE_RESULT, rsp_msg->status, (R | (W << 1) | (X << 2) | (UNTRANSLATED_ONLY << 3)),
+          req->device_id, req->process_id, g_trace_ioatc, pa, page_sz);
     return;
 
 return_unsupported_request:
     rsp_msg->status = UNSUPPORTED_REQUEST;
+    COST_END(TTYP, req->device_id);
+    TRACE(TRACE_RESULT, rsp_msg->status, 0, req->device_id, req->process_id, g_trace_ioatc, 0, 0);
     return;
 
 return_completer_abort:
     rsp_msg->status = UNSUPPORTED_REQUEST;
+    COST_END(TTYP, req->device_id);
+    TRACE(TRACE_RESULT, rsp_msg->status, 0, req->device_id, req->process_id, g_trace_ioatc, 0, 0);
     return;
 
 stop_and_report_fault:
@@ -5,18 +5,103 @@
 #include "iommu.h"
 #ifndef __TABLES_API_H__
 #define __TABLES_API_H__
+// IOTINVAL commands produced when unmapping or changing permissions of a
+// range. The caller provides the buffer for max_cmds commands and the PSCID
+// to tag IOTINVAL.VMA commands with. The commands are ready to be appended
+// to the command queue.
+typedef struct {
+    command_t *cmds;
+    uint32_t  max_cmds;
+    uint32_t  num_cmds;
+    uint8_t   PSCV;
+    uint32_t  PSCID;
+} iotinval_batch_t;
+// A device and the processes to add to its process directory table. The
+// process_ids and PC arrays hold num_processes entries.
+typedef struct {
+    uint32_t           device_id;
+    device_context_t  *DC;
+    uint32_t           num_processes;
+    uint32_t          *process_ids;
+    process_context_t *PC;
+} dev_tables_desc_t;
+// Usage statistics of a page pool
+typedef struct {
+    uint64_t pages_in_use;
+    uint64_t peak_pages_in_use;
+    uint64_t free_pages;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failed_allocs;
+} page_pool_stats_t;
+// Tables checked by verify_tables()
+#define VERIFY_DDT     0
+#define VERIFY_PDT     1
+#define VERIFY_S_STAGE 2
+#define VERIFY_G_STAGE 3
+// An entry found by verify_tables() that would cause a fault when used. The
+// device_id, and the process_id if pid_valid, identify the first context
+// that reaches the entry. The addr is the SPA of the entry, or the GPA of
+// a table that is not mapped by the G-stage when the cause is a guest page
+// fault and check is PTE_OK. The va is the VA or GPA mapped by a page table
+// entry. The cause is the fault reported for a read through the entry and
+// check is the page table entry check that failed.
+typedef struct {
+    uint8_t     table;
+    uint8_t     level;
+    uint8_t     pid_valid;
+    uint32_t    device_id;
+    uint32_t    process_id;
+    uint64_t    addr;
+    uint64_t    va;
+    uint32_t    cause;
+    pte_check_t check;
+} table_violation_t;
+// PPN returned when a page pool is exhausted. The add_* builders return 1
+// when a table they need cannot be allocated.
+#define INVALID_PPN ((uint64_t)-1)
 uint64_t add_dev_context(device_context_t *DC, uint32_t device_id);
 uint64_t add_process_context(device_context_t *DC, process_context_t *PC, uint32_t process_id);
+uint8_t build_device_tables(dev_tables_desc_t *devs, uint32_t num_devs, uint32_t num_threads);
 uint64_t add_g_stage_pte(iohgatp_t iohgatp, uint64_t gpa, gpte_t gpte, uint8_t add_level);
 uint64_t add_s_stage_pte(iosatp_t satp, uint64_t va, pte_t pte, uint8_t add_level);
 uint64_t add_vs_stage_pte(iosatp_t satp, uint64_t va, pte_t pte, uint8_t add_level, iohgatp_t iohgatp);
 uint8_t translate_gpa (iohgatp_t iohgatp, uint64_t gpa, uint64_t *spa);
+void invalidate_gpa_cache(iohgatp_t iohgatp);
+void flush_gpa_cache(void);
+int64_t map_s_stage_range(iosatp_t satp, uint64_t va, uint64_t pa, uint64_t len, pte_t pte);
+int64_t map_vs_stage_range(iosatp_t satp, uint64_t va, uint64_t gpa, uint64_t len, pte_t pte,
+                           iohgatp_t iohgatp);
+int64_t map_g_stage_range(iohgatp_t iohgatp, uint64_t gpa, uint64_t spa, uint64_t len, gpte_t gpte);
+int64_t unmap_s_stage_range(iosatp_t satp, uint64_t va, uint64_t len, iotinval_batch_t *inv);
+int64_t unmap_vs_stage_range(iosatp_t satp, uint64_t va, uint64_t len, iohgatp_t iohgatp,
+                             iotinval_batch_t *inv);
+int64_t unmap_g_stage_range(iohgatp_t iohgatp, uint64_t gpa, uint64_t len, iotinval_batch_t *inv);
+int64_t protect_s_stage_range(iosatp_t satp, uint64_t va, uint64_t len, pte_t perms,
+                              iotinval_batch_t *inv);
+int64_t protect_vs_stage_range(iosatp_t satp, uint64_t va, uint64_t len, pte_t perms,
+                               iohgatp_t iohgatp, iotinval_batch_t *inv);
+int64_t protect_g_stage_range(iohgatp_t iohgatp, uint64_t gpa, uint64_t len, gpte_t perms,
+                              iotinval_batch_t *inv);
 void print_dev_context(device_context_t *DC, uint32_t device_id);
 void print_process_context(process_context_t *DC, uint32_t device_id, uint32_t process_id);
+void init_page_pool(uint64_t base_ppn, uint64_t num_ppns);
+uint8_t init_guest_page_pool(uint16_t GSCID, uint64_t base_gppn, uint64_t num_gppns);
+uint8_t get_page_pool_stats(uint8_t GV, uint16_t GSCID, page_pool_stats_t *stats);
+uint64_t verify_tables(table_violation_t *violations, uint64_t max_violations,
+                       uint32_t num_threads);
+uint8_t save_table_image(const char *path);
+uint8_t restore_table_image(const char *path, char *memory, uint64_t mem_size);
+// Page pool state saved in a table image
+void get_page_pool_range(uint64_t *base_ppn, uint64_t *next_ppn);
+uint8_t save_page_pools(FILE *fp);
+uint8_t restore_page_pools(FILE *fp);
 
 
 
 extern uint64_t get_free_ppn(uint64_t num_ppn);
 extern uint64_t get_free_gppn(uint64_t num_gppn, iohgatp_t iohgatp);
+extern void free_ppn(uint64_t ppn, uint64_t num_ppn);
+extern void free_gppn(uint64_t gppn, uint64_t num_gppn, iohgatp_t iohgatp);
 
 #endif // __TABLES_API_H__
@@ -8,7 +8,7 @@
 uint64_t
 add_dev_context(
     device_context_t *DC, uint32_t device_id) {
-    uint64_t a;
+    uint64_t a, ppn;
     uint8_t i, LEVELS, DC_SIZE;
     ddte_t ddte;
     uint8_t DDI[3];
@@ -36,7 +36,8 @@ add_dev_context(
         read_memory((a + (DDI[i] * 8)), 8, (char *)&ddte.raw);
         if ( ddte.V == 0 ) {
             ddte.V = 1;
-            ddte.PPN = get_free_ppn(1);
+            if ( (ppn = get_free_ppn(1)) == INVALID_PPN ) return 1;
+            ddte.PPN = ppn;
             write_memory((char *)&ddte.raw, (a + (DDI[i] * 8)), 8);
         }
         i = i - 1;
@@ -0,0 +1,298 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include <stdlib.h>
+#include <pthread.h>
+#include "iommu.h"
+#include "tables_api.h"
+// The tables are built in two phases. The first phase walks the devices
+// and processes in order on the calling thread and allocates the directory
+// pages exactly as add_dev_context() and add_process_context() invoked in
+// that order would. The planning is not parallel: the pages must be handed
+// out in the serial order for the memory image to be identical to serial
+// construction, and the G-stage tables mapping the PDT pages may be shared
+// by devices in different DDI subtrees. The directory entries and contexts
+// to write are recorded in a plan. Only the second phase, which copies the
+// plan to memory, uses multiple threads. Each thread writes
+// the entries of the devices whose leaf DDT page - the device_id bits
+// above DDI[0] - selects the thread. The process directory tables of a
+// device are written by the thread writing the device. As every location
+// is written once the memory image is identical to serial construction.
+typedef struct {
+    uint64_t addr;
+    uint64_t raw;
+    char    *data;
+    uint32_t size;
+    uint32_t part;
+} table_write_t;
+typedef struct {
+    table_write_t *writes;
+    uint64_t       num_writes;
+    uint64_t       max_writes;
+    // Directory entries planned but not yet written, indexed by the
+    // address of the entry. The address is tagged with bit 0 as the
+    // entries are 8 byte aligned and address 0 is a valid address.
+    uint64_t      *keys;
+    uint64_t      *vals;
+    uint64_t       hash_mask;
+    uint64_t       num_keys;
+} plan_t;
+typedef struct {
+    plan_t   *plan;
+    uint32_t  id;
+    uint32_t  num_threads;
+    uint8_t   created;
+    uint8_t   status;
+} worker_t;
+
+static uint64_t
+hash_addr(
+    uint64_t addr) {
+    return (addr >> 3) * 0x9E3779B97F4A7C15UL;
+}
+static uint8_t
+insert_entry(
+    plan_t *p, uint64_t addr, uint64_t raw) {
+    uint64_t *keys, *vals, i, j, old_mask;
+
+    if ( ((p->num_keys + 1) * 2) > (p->hash_mask + 1) ) {
+        old_mask = p->hash_mask;
+        keys = p->keys;
+        vals = p->vals;
+        p->hash_mask = ( keys == NULL ) ? 1023 : ((old_mask * 2) + 1);
+        p->keys = calloc((p->hash_mask + 1), sizeof(uint64_t));
+        p->vals = calloc((p->hash_mask + 1), sizeof(uint64_t));
+        if ( p->keys == NULL || p->vals == NULL ) {
+            free(keys);
+            free(vals);
+            return 1;
+        }
+        p->num_keys = 0;
+        for ( i = 0; keys != NULL && i <= old_mask; i++ ) {
+            if ( keys[i] == 0 ) continue;
+            j = hash_addr(keys[i]) & p->hash_mask;
+            while ( p->keys[j] != 0 ) j = (j + 1) & p->hash_mask;
+            p->keys[j] = keys[i];
+            p->vals[j] = vals[i];
+            p->num_keys++;
+        }
+        free(keys);
+        free(vals);
+    }
+    i = hash_addr(addr) & p->hash_mask;
+    while ( p->keys[i] != 0 ) i = (i + 1) & p->hash_mask;
+    p->keys[i] = addr | 1;
+    p->vals[i] = raw;
+    p->num_keys++;
+    return 0;
+}
+// Read a directory entry from the plan if planned else from memory
+static uint8_t
+read_entry(
+    plan_t *p, uint64_t addr, uint64_t *raw) {
+    uint64_t i;
+
+    if ( p->keys != NULL ) {
+        i = hash_addr(addr) & p->hash_mask;
+        while ( p->keys[i] != 0 ) {
+            if ( p->keys[i] == (addr | 1) ) {
+                *raw = p->vals[i];
+                return 0;
+            }
+            i = (i + 1) & p->hash_mask;
+        }
+    }
+    return read_memory(addr, 8, (char *)raw);
+}
+static uint8_t
+add_write(
+    plan_t *p, uint64_t addr, uint64_t raw, char *data, uint32_t size, uint32_t part) {
+    table_write_t *w;
+
+    if ( p->num_writes == p->max_writes ) {
+        p->max_writes = ( p->max_writes == 0 ) ? 1024 : (p->max_writes * 2);
+        if ( (w = realloc(p->writes, (p->max_writes * sizeof(table_write_t)))) == NULL )
+            return 1;
+        p->writes = w;
+    }
+    w = &p->writes[p->num_writes++];
+    w->addr = addr;
+    w->raw = raw;
+    w->data = data;
+    w->size = size;
+    w->part = part;
+    // Directory entries are looked up by later devices and processes
+    if ( data == NULL )
+        return insert_entry(p, addr, raw);
+    return 0;
+}
+// Plan the DDT entries and the device context as add_dev_context() would
+static uint8_t
+plan_dev_context(
+    plan_t *p, device_context_t *DC, uint32_t device_id, uint32_t *part) {
+    uint64_t a, ppn;
+    uint8_t i, LEVELS, DC_SIZE;
+    ddte_t ddte;
+    uint8_t DDI[3];
+
+    if ( g_reg_file.capabilities.msi_flat == 0 ) {
+        DDI[0] = get_bits(6,   0, device_id);
+        DDI[1] = get_bits(15,  7, device_id);
+        DDI[2] = get_bits(23, 16, device_id);
+        DC_SIZE = BASE_FORMAT_DC_SIZE;
+        *part = device_id >> 7;
+    } else {
+        DDI[0] = get_bits(5,   0, device_id);
+        DDI[1] = get_bits(14,  6, device_id);
+        DDI[2] = get_bits(23, 15, device_id);
+        DC_SIZE = EXT_FORMAT_DC_SIZE;
+        *part = device_id >> 6;
+    }
+    a = g_reg_file.ddtp.ppn * PAGESIZE;
+    LEVELS = 1;
+    if ( g_reg_file.ddtp.iommu_mode == DDT_3LVL ) LEVELS = 3;
+    if ( g_reg_file.ddtp.iommu_mode == DDT_2LVL ) LEVELS = 2;
+    i = LEVELS - 1;
+    while ( i > 0 ) {
+        if ( read_entry(p, (a + (DDI[i] * 8)), &ddte.raw) != 0 ) return 1;
+        if ( ddte.V == 0 ) {
+            ddte.V = 1;
+            if ( (ppn = get_free_ppn(1)) == INVALID_PPN ) return 1;
+            ddte.PPN = ppn;
+            if ( add_write(p, (a + (DDI[i] * 8)), ddte.raw, NULL, 8, *part) != 0 )
+                return 1;
+        }
+        i = i - 1;
+        a = ddte.PPN * PAGESIZE;
+    }
+    return add_write(p, (a + (DDI[0] * DC_SIZE)), 0, (char *)DC, DC_SIZE, *part);
+}
+// Plan the PDT entries and the process context as add_process_context()
+// would. The G-stage mappings of new PDT pages are made immediately as the
+// following walks of the PDT translate through them.
+static uint8_t
+plan_process_context(
+    plan_t *p, device_context_t *DC, process_context_t *PC, uint32_t process_id,
+    uint32_t part) {
+    uint64_t a, ppn;
+    uint8_t i, LEVELS;
+    pdte_t pdte;
+    gpte_t gpte;
+    uint8_t PDI[3];
+
+    PDI[0] = get_bits(7,   0, process_id);
+    PDI[1] = get_bits(16,  8, process_id);
+    PDI[2] = get_bits(19, 17, process_id);
+
+    LEVELS = 1;
+    if ( DC->fsc.pdtp.MODE == PD20 ) LEVELS = 3;
+    if ( DC->fsc.pdtp.MODE == PD17 ) LEVELS = 2;
+
+    a = DC->fsc.pdtp.PPN * PAGESIZE;
+    i = LEVELS - 1;
+    while ( i > 0 ) {
+        if ( translate_gpa(DC->iohgatp, a, &a) != 0 ) return 1;
+        if ( read_entry(p, (a + (PDI[i] * 8)), &pdte.raw) != 0 ) return 1;
+        if ( pdte.V == 0 ) {
+            pdte.V = 1;
+            pdte.reserved0 = pdte.reserved1 = 0;
+            if ( DC->iohgatp.MODE != IOHGATP_Bare ) {
+                if ( (ppn = get_free_gppn(1, DC->iohgatp)) == INVALID_PPN ) return 1;
+                pdte.PPN = ppn;
+                gpte.raw = 0;
+                gpte.V = 1;
+                gpte.R = 1;
+                gpte.U = 1;
+                gpte.PBMT = PMA;
+                if ( (ppn = get_free_ppn(1)) == INVALID_PPN ) return 1;
+                gpte.PPN = ppn;
+                if ( add_g_stage_pte(DC->iohgatp, (PAGESIZE * pdte.PPN), gpte, 0) <= 1 )
+                    return 1;
+            } else {
+                if ( (ppn = get_free_ppn(1)) == INVALID_PPN ) return 1;
+                pdte.PPN = ppn;
+            }
+            if ( add_write(p, (a + (PDI[i] * 8)), pdte.raw, NULL, 8, part) != 0 )
+                return 1;
+        }
+        i = i - 1;
+        a = pdte.PPN * PAGESIZE;
+    }
+    if ( translate_gpa(DC->iohgatp, a, &a) != 0 ) return 1;
+    return add_write(p, (a + (PDI[0] * 16)), 0, (char *)PC, 16, part);
+}
+static void *
+write_tables(
+    void *arg) {
+    worker_t *w = (worker_t *)arg;
+    table_write_t *t;
+    uint64_t i;
+
+    for ( i = 0; i < w->plan->num_writes; i++ ) {
+        t = &w->plan->writes[i];
+        if ( (t->part % w->num_threads) != w->id ) continue;
+        if ( write_memory(( t->data == NULL ) ? (char *)&t->raw : t->data,
+                          t->addr, t->size) != 0 )
+            w->status = 1;
+    }
+    return NULL;
+}
+// Add the device contexts and the process contexts of the devices. The
+// tables are planned on the calling thread and up to num_threads threads
+// are used to write them. The memory image is the
+// same as that produced by invoking add_dev_context() for each device
+// followed by add_process_context() for each of its processes in order.
+// The contexts must not be modified till the function returns. Returns 1
+// if pages could not be allocated, a PDT could not be located, or a table
+// could not be written. No directory entries or contexts are written if
+// the tables could not be planned.
+uint8_t
+build_device_tables(
+    dev_tables_desc_t *devs, uint32_t num_devs, uint32_t num_threads) {
+    pthread_t *threads;
+    worker_t *workers;
+    uint32_t i, j, part;
+    uint8_t status = 0;
+    plan_t p;
+
+    memset(&p, 0, sizeof(p));
+    for ( i = 0; i < num_devs && status == 0; i++ ) {
+        status = plan_dev_context(&p, devs[i].DC, devs[i].device_id, &part);
+        for ( j = 0; j < devs[i].num_processes && status == 0; j++ )
+            status = plan_process_context(&p, devs[i].DC, &devs[i].PC[j],
+                                          devs[i].process_ids[j], part);
+    }
+    if ( status == 0 ) {
+        if ( num_threads == 0 ) num_threads = 1;
+        threads = calloc(num_threads, sizeof(pthread_t));
+        workers = calloc(num_threads, sizeof(worker_t));
+        if ( threads == NULL || workers == NULL )
+            num_threads = 0;
+        for ( i = 0; i < num_threads; i++ ) {
+            workers[i].plan = &p;
+            workers[i].id = i;
+            workers[i].num_threads = num_threads;
+        }
+        // The calling thread writes the first partition
+        for ( i = 1; i < num_threads; i++ ) {
+            if ( pthread_create(&threads[i], NULL, write_tables, &workers[i]) == 0 )
+                workers[i].created = 1;
+            else
+                // Write the partition from the calling thread instead
+                write_tables(&workers[i]);
+        }
+        if ( num_threads != 0 ) write_tables(&workers[0]);
+        for ( i = 1; i < num_threads; i++ ) {
+            if ( workers[i].created == 1 ) pthread_join(threads[i], NULL);
+            status |= workers[i].status;
+        }
+        status |= ( num_threads == 0 ) ? 1 : workers[0].status;
+        free(threads);
+        free(workers);
+    }
+    free(p.writes);
+    free(p.keys);
+    free(p.vals);
+    return status;
+}
@@ -9,7 +9,7 @@ add_g_stage_pte (
     iohgatp_t iohgatp, uint64_t gpa, gpte_t gpte, uint8_t add_level) {
 
     uint16_t vpn[5];
-    uint64_t a;
+    uint64_t a, ppn;
     uint8_t i, PTESIZE, LEVELS;
     gpte_t nl_gpte;
 
@@ -19,27 +19,26 @@ add_g_stage_pte (
         vpn[1] = get_bits(34, 22, gpa);
         LEVELS = 2;
         PTESIZE = 4;
-    }
-    if ( iohgatp.MODE == IOHGATP_Sv39x4 ) {
+    } else if ( iohgatp.MODE == IOHGATP_Sv39x4 ) {
         vpn[0] = get_bits(20, 12, gpa);
         vpn[1] = get_bits(29, 21, gpa);
         vpn[2] = get_bits(40, 30, gpa);
         LEVELS = 3;
-    }
-    if ( iohgatp.MODE == IOHGATP_Sv48x4 ) {
+    } else if ( iohgatp.MODE == IOHGATP_Sv48x4 ) {
         vpn[0] = get_bits(20, 12, gpa);
         vpn[1] = get_bits(29, 21, gpa);
         vpn[2] = get_bits(38, 30, gpa);
         vpn[3] = get_bits(49, 39, gpa);
         LEVELS = 4;
-    }
-    if ( iohgatp.MODE == IOHGATP_Sv57x4 ) {
+    } else if ( iohgatp.MODE == IOHGATP_Sv57x4 ) {
         vpn[0] = get_bits(20, 12, gpa);
         vpn[1] = get_bits(29, 21, gpa);
         vpn[2] = get_bits(38, 30, gpa);
         vpn[3] = get_bits(47, 39, gpa);
         vpn[4] = get_bits(58, 48, gpa);
         LEVELS = 5;
+    } else {
+        return 0;
     }
     i = LEVELS - 1;
     a = iohgatp.PPN * PAGESIZE;
@@ -47,7 +46,8 @@ add_g_stage_pte (
         read_memory((a | (vpn[i] * PTESIZE)), PTESIZE, (char *)&nl_gpte.raw);
         if ( nl_gpte.V == 0 ) {
             nl_gpte.V = 1;
-            nl_gpte.PPN = get_free_ppn(1);
+            if ( (ppn = get_free_ppn(1)) == INVALID_PPN ) return 1;
+            nl_gpte.PPN = ppn;
             write_memory((char *)&nl_gpte.raw, (a | (vpn[i] * PTESIZE)), PTESIZE);
         }
         i = i - 1;
@@ -55,5 +55,6 @@ add_g_stage_pte (
         a = nl_gpte.PPN * PAGESIZE;
     }
     write_memory((char *)&gpte.raw, (a | (vpn[i] * PTESIZE)), PTESIZE);
+    invalidate_gpa_cache(iohgatp);
     return (a | (vpn[i] * PTESIZE));
 }
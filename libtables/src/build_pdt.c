@@ -8,7 +8,7 @@
 uint64_t
 add_process_context(
     device_context_t *DC, process_context_t *PC, uint32_t process_id) {
-    uint64_t a;
+    uint64_t a, ppn;
     uint8_t i, LEVELS;
     pdte_t pdte;
     uint8_t PDI[3];
@@ -32,7 +32,8 @@ add_process_context(
             if (DC->iohgatp.MODE != IOHGATP_Bare) {
                 gpte_t gpte;
 
-                pdte.PPN = get_free_gppn(1, DC->iohgatp);
+                if ( (ppn = get_free_gppn(1, DC->iohgatp)) == INVALID_PPN ) return 1;
+                pdte.PPN = ppn;
 
                 gpte.raw = 0;
                 gpte.V = 1;
@@ -44,11 +45,14 @@ add_process_context(
                 gpte.A = 0;
                 gpte.D = 0;
                 gpte.PBMT = PMA;
-                gpte.PPN = get_free_ppn(1);
+                if ( (ppn = get_free_ppn(1)) == INVALID_PPN ) return 1;
+                gpte.PPN = ppn;
 
-                add_g_stage_pte(DC->iohgatp, (PAGESIZE * pdte.PPN), gpte, 0);
+                if ( add_g_stage_pte(DC->iohgatp, (PAGESIZE * pdte.PPN), gpte, 0) <= 1 )
+                    return 1;
             } else {
-                pdte.PPN = get_free_ppn(1);
+                if ( (ppn = get_free_ppn(1)) == INVALID_PPN ) return 1;
+                pdte.PPN = ppn;
             }
             write_memory((char *)&pdte.raw, (a + (PDI[i] * 8)), 8);
         }
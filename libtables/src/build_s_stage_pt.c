@@ -9,7 +9,7 @@ add_s_stage_pte (
     iosatp_t satp, uint64_t va, pte_t pte, uint8_t add_level) {
 
     uint16_t vpn[5];
-    uint64_t a;
+    uint64_t a, ppn;
     uint8_t i, PTESIZE, LEVELS;
     pte_t nl_pte;
 
@@ -19,27 +19,26 @@ add_s_stage_pte (
         vpn[1] = get_bits(34, 22, va);
         LEVELS = 2;
         PTESIZE = 4;
-    }
-    if ( satp.MODE == IOSATP_Sv32 ) {
+    } else if ( satp.MODE == IOSATP_Sv39 ) {
         vpn[0] = get_bits(20, 12, va);
         vpn[1] = get_bits(29, 21, va);
         vpn[2] = get_bits(40, 30, va);
         LEVELS = 3;
-    }
-    if ( satp.MODE == IOSATP_Sv48 ) {
+    } else if ( satp.MODE == IOSATP_Sv48 ) {
         vpn[0] = get_bits(20, 12, va);
         vpn[1] = get_bits(29, 21, va);
         vpn[2] = get_bits(38, 30, va);
         vpn[3] = get_bits(49, 39, va);
         LEVELS = 4;
-    }
-    if ( satp.MODE == IOSATP_Sv57 ) {
+    } else if ( satp.MODE == IOSATP_Sv57 ) {
         vpn[0] = get_bits(20, 12, va);
         vpn[1] = get_bits(29, 21, va);
         vpn[2] = get_bits(38, 30, va);
         vpn[3] = get_bits(47, 39, va);
         vpn[4] = get_bits(58, 48, va);
         LEVELS = 5;
+    } else {
+        return 0;
     }
     i = LEVELS - 1;
     a = satp.PPN * PAGESIZE;
@@ -47,7 +46,8 @@ add_s_stage_pte (
         read_memory((a | (vpn[i] * PTESIZE)), PTESIZE, (char *)&nl_pte.raw);
         if ( nl_pte.V == 0 ) {
             nl_pte.V = 1;
-            nl_pte.PPN = get_free_ppn(1);
+            if ( (ppn = get_free_ppn(1)) == INVALID_PPN ) return 1;
+            nl_pte.PPN = ppn;
             write_memory((char *)&nl_pte.raw, (a | (vpn[i] * PTESIZE)), PTESIZE);
         }
         i = i - 1;
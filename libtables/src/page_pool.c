@@ -0,0 +1,326 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include <stdio.h>
+#include <stdlib.h>
+#include "iommu.h"
+#include "tables_api.h"
+// Pages are allocated from a pool per address space - one pool for the
+// supervisor physical address space and one for the guest physical address
+// space of each GSCID. A pool allocates pages by advancing a bump pointer
+// through its range of pages. Freed pages are held in a list of free extents
+// sorted by PPN with adjacent extents coalesced. Allocations are made first
+// fit from the free extents before advancing the bump pointer.
+typedef struct {
+    uint64_t ppn;
+    uint64_t num_ppns;
+} extent_t;
+typedef struct {
+    uint64_t          base_ppn;
+    uint64_t          next_ppn;
+    uint64_t          end_ppn;
+    extent_t         *free;
+    uint32_t          num_free;
+    uint32_t          max_free;
+    page_pool_stats_t stats;
+} page_pool_t;
+
+static page_pool_t spa_pool = { 0, 0, (~0UL / PAGESIZE), NULL, 0, 0, {0} };
+static page_pool_t *gpa_pools[65536];
+
+static void
+reset_pool(
+    page_pool_t *p, uint64_t base_ppn, uint64_t num_ppns) {
+    free(p->free);
+    memset(p, 0, sizeof(page_pool_t));
+    p->base_ppn = base_ppn;
+    p->next_ppn = base_ppn;
+    p->end_ppn = base_ppn + num_ppns;
+    return;
+}
+static page_pool_t *
+get_gpa_pool(
+    uint16_t GSCID) {
+    if ( gpa_pools[GSCID] == NULL ) {
+        if ( (gpa_pools[GSCID] = calloc(1, sizeof(page_pool_t))) == NULL )
+            return NULL;
+        reset_pool(gpa_pools[GSCID], 0, (~0UL / PAGESIZE));
+    }
+    return gpa_pools[GSCID];
+}
+// Insert the extent at index i of the free list
+static uint8_t
+insert_extent(
+    page_pool_t *p, uint32_t i, uint64_t ppn, uint64_t num_ppns) {
+    extent_t *e;
+
+    if ( p->num_free == p->max_free ) {
+        if ( (e = realloc(p->free, (p->max_free + 64) * sizeof(extent_t))) == NULL )
+            return 1;
+        p->free = e;
+        p->max_free += 64;
+    }
+    memmove(&p->free[i + 1], &p->free[i], (p->num_free - i) * sizeof(extent_t));
+    p->free[i].ppn = ppn;
+    p->free[i].num_ppns = num_ppns;
+    p->num_free++;
+    return 0;
+}
+static void
+remove_extent(
+    page_pool_t *p, uint32_t i) {
+    memmove(&p->free[i], &p->free[i + 1], (p->num_free - i - 1) * sizeof(extent_t));
+    p->num_free--;
+    return;
+}
+// Return pages to the free list. Pages that end at the bump pointer are
+// returned to the unallocated part of the range.
+static void
+release_pages(
+    page_pool_t *p, uint64_t ppn, uint64_t num_ppns) {
+    uint32_t lo, hi, i;
+
+    // Locate the first extent that starts above the pages
+    lo = 0;
+    hi = p->num_free;
+    while ( lo < hi ) {
+        i = (lo + hi) / 2;
+        if ( p->free[i].ppn < ppn ) lo = i + 1;
+        else hi = i;
+    }
+    i = lo;
+    // Coalesce with the preceding extent
+    if ( i > 0 && (p->free[i - 1].ppn + p->free[i - 1].num_ppns) == ppn ) {
+        i--;
+        ppn = p->free[i].ppn;
+        num_ppns += p->free[i].num_ppns;
+        p->stats.free_pages -= p->free[i].num_ppns;
+        remove_extent(p, i);
+    }
+    // Coalesce with the following extent
+    if ( i < p->num_free && (ppn + num_ppns) == p->free[i].ppn ) {
+        num_ppns += p->free[i].num_ppns;
+        p->stats.free_pages -= p->free[i].num_ppns;
+        remove_extent(p, i);
+    }
+    if ( (ppn + num_ppns) == p->next_ppn ) {
+        p->next_ppn = ppn;
+        return;
+    }
+    if ( insert_extent(p, i, ppn, num_ppns) == 0 )
+        p->stats.free_pages += num_ppns;
+    return;
+}
+// Allocate contiguous pages. Allocations of a power of 2 number of pages are
+// aligned to their size.
+static uint64_t
+allocate_pages(
+    page_pool_t *p, uint64_t num_ppns) {
+    uint64_t align, ppn, end;
+    uint32_t i;
+
+    align = ( (num_ppns & (num_ppns - 1)) == 0 ) ? num_ppns : 1;
+    for ( i = 0; i < p->num_free; i++ ) {
+        ppn = (p->free[i].ppn + align - 1) & ~(align - 1);
+        end = p->free[i].ppn + p->free[i].num_ppns;
+        if ( ppn >= end || (end - ppn) < num_ppns )
+            continue;
+        // Split the extent into the parts before and after the allocation
+        p->stats.free_pages -= num_ppns;
+        if ( ppn == p->free[i].ppn ) {
+            p->free[i].ppn += num_ppns;
+            p->free[i].num_ppns -= num_ppns;
+            if ( p->free[i].num_ppns == 0 )
+                remove_extent(p, i);
+        } else {
+            p->free[i].num_ppns = ppn - p->free[i].ppn;
+            if ( (ppn + num_ppns) != end &&
+                 insert_extent(p, (i + 1), (ppn + num_ppns), (end - ppn - num_ppns)) )
+                p->stats.free_pages -= (end - ppn - num_ppns);
+        }
+        goto allocated;
+    }
+    ppn = (p->next_ppn + align - 1) & ~(align - 1);
+    if ( ppn < p->next_ppn || ppn >= p->end_ppn || (p->end_ppn - ppn) < num_ppns ) {
+        p->stats.failed_allocs++;
+        return INVALID_PPN;
+    }
+    // The pages skipped to align the allocation are free
+    if ( ppn != p->next_ppn && insert_extent(p, p->num_free, p->next_ppn, (ppn - p->next_ppn)) == 0 )
+        p->stats.free_pages += ppn - p->next_ppn;
+    p->next_ppn = ppn + num_ppns;
+
+allocated:
+    p->stats.allocs++;
+    p->stats.pages_in_use += num_ppns;
+    if ( p->stats.pages_in_use > p->stats.peak_pages_in_use )
+        p->stats.peak_pages_in_use = p->stats.pages_in_use;
+    return ppn;
+}
+static void
+free_pages(
+    page_pool_t *p, uint64_t ppn, uint64_t num_ppns) {
+    p->stats.frees++;
+    p->stats.pages_in_use -= num_ppns;
+    release_pages(p, ppn, num_ppns);
+    return;
+}
+// Set the range of supervisor physical pages to allocate from. All pages
+// previously allocated, including those of the guest physical address
+// spaces, are considered free.
+void
+init_page_pool(
+    uint64_t base_ppn, uint64_t num_ppns) {
+    uint32_t GSCID;
+
+    reset_pool(&spa_pool, base_ppn, num_ppns);
+    for ( GSCID = 0; GSCID < 65536; GSCID++ ) {
+        if ( gpa_pools[GSCID] == NULL ) continue;
+        reset_pool(gpa_pools[GSCID], 0, 0);
+        free(gpa_pools[GSCID]);
+        gpa_pools[GSCID] = NULL;
+    }
+    return;
+}
+// Set the range of guest physical pages to allocate from for the GSCID. By
+// default the entire guest physical address space is allocated from.
+// Returns 1 if the pool could not be created.
+uint8_t
+init_guest_page_pool(
+    uint16_t GSCID, uint64_t base_gppn, uint64_t num_gppns) {
+    page_pool_t *p;
+
+    if ( (p = get_gpa_pool(GSCID)) == NULL )
+        return 1;
+    reset_pool(p, base_gppn, num_gppns);
+    return 0;
+}
+// Get the usage statistics of the supervisor physical address space pool if
+// GV is 0 else of the guest physical address space pool of the GSCID.
+// Returns 1 if no pages were allocated for the GSCID.
+uint8_t
+get_page_pool_stats(
+    uint8_t GV, uint16_t GSCID, page_pool_stats_t *stats) {
+    if ( GV == 1 && gpa_pools[GSCID] == NULL )
+        return 1;
+    *stats = ( GV == 0 ) ? spa_pool.stats : gpa_pools[GSCID]->stats;
+    return 0;
+}
+// Get the range of supervisor physical pages allocated from so far
+void
+get_page_pool_range(
+    uint64_t *base_ppn, uint64_t *next_ppn) {
+    *base_ppn = spa_pool.base_ppn;
+    *next_ppn = spa_pool.next_ppn;
+    return;
+}
+// Save the state of the pools to a table image. The supervisor physical
+// address space pool is saved with the ID 65536 followed by the pools of
+// the GSCIDs. Returns 1 if the state could not be written.
+uint8_t
+save_page_pools(
+    FILE *fp) {
+    page_pool_t *p;
+    uint32_t id, num_pools;
+
+    num_pools = 1;
+    for ( id = 0; id < 65536; id++ )
+        if ( gpa_pools[id] != NULL ) num_pools++;
+    if ( fwrite(&num_pools, sizeof(num_pools), 1, fp) != 1 ) return 1;
+    for ( id = 0; id <= 65536; id++ ) {
+        p = ( id == 65536 ) ? &spa_pool : gpa_pools[id];
+        if ( p == NULL ) continue;
+        if ( fwrite(&id, sizeof(id), 1, fp) != 1 ||
+             fwrite(p, sizeof(page_pool_t), 1, fp) != 1 ||
+             fwrite(p->free, sizeof(extent_t), p->num_free, fp) != p->num_free )
+            return 1;
+    }
+    return 0;
+}
+// Determine if the state of the pools in a table image can be read. The
+// file is left positioned at the state.
+static uint8_t
+check_page_pools(
+    FILE *fp) {
+    extent_t extents[64];
+    page_pool_t saved;
+    uint32_t id, num_pools, n;
+    long pos;
+
+    if ( (pos = ftell(fp)) < 0 ) return 1;
+    if ( fread(&num_pools, sizeof(num_pools), 1, fp) != 1 || num_pools > 65537 ) return 1;
+    while ( num_pools-- ) {
+        if ( fread(&id, sizeof(id), 1, fp) != 1 || id > 65536 ||
+             fread(&saved, sizeof(page_pool_t), 1, fp) != 1 )
+            return 1;
+        for ( ; saved.num_free != 0; saved.num_free -= n ) {
+            n = ( saved.num_free < 64 ) ? saved.num_free : 64;
+            if ( fread(extents, sizeof(extent_t), n, fp) != n ) return 1;
+        }
+    }
+    return ( fseek(fp, pos, SEEK_SET) != 0 ) ? 1 : 0;
+}
+// Restore the state of the pools from a table image. Returns 1 if the
+// state could not be read, in which case the pools are not changed unless
+// memory for the free lists could not be allocated.
+uint8_t
+restore_page_pools(
+    FILE *fp) {
+    page_pool_t *p, saved;
+    uint32_t id, num_pools;
+
+    if ( check_page_pools(fp) != 0 ) return 1;
+    init_page_pool(0, 0);
+    if ( fread(&num_pools, sizeof(num_pools), 1, fp) != 1 ) return 1;
+    while ( num_pools-- ) {
+        if ( fread(&id, sizeof(id), 1, fp) != 1 || id > 65536 ||
+             fread(&saved, sizeof(page_pool_t), 1, fp) != 1 )
+            return 1;
+        p = ( id == 65536 ) ? &spa_pool : get_gpa_pool(id);
+        if ( p == NULL ) return 1;
+        reset_pool(p, 0, 0);
+        if ( saved.num_free != 0 &&
+             (p->free = malloc(saved.num_free * sizeof(extent_t))) == NULL )
+            return 1;
+        if ( fread(p->free, sizeof(extent_t), saved.num_free, fp) != saved.num_free )
+            return 1;
+        p->base_ppn = saved.base_ppn;
+        p->next_ppn = saved.next_ppn;
+        p->end_ppn = saved.end_ppn;
+        p->num_free = p->max_free = saved.num_free;
+        p->stats = saved.stats;
+    }
+    return 0;
+}
+// Default allocators. These may be overridden by the embedder.
+__attribute__((weak)) uint64_t
+get_free_ppn(
+    uint64_t num_ppn) {
+    return allocate_pages(&spa_pool, num_ppn);
+}
+__attribute__((weak)) uint64_t
+get_free_gppn(
+    uint64_t num_gppn, iohgatp_t iohgatp) {
+    page_pool_t *p;
+
+    if ( (p = get_gpa_pool(iohgatp.GSCID)) == NULL )
+        return INVALID_PPN;
+    return allocate_pages(p, num_gppn);
+}
+__attribute__((weak)) void
+free_ppn(
+    uint64_t ppn, uint64_t num_ppn) {
+    free_pages(&spa_pool, ppn, num_ppn);
+    return;
+}
+__attribute__((weak)) void
+free_gppn(
+    uint64_t gppn, uint64_t num_gppn, iohgatp_t iohgatp) {
+    page_pool_t *p;
+
+    if ( (p = get_gpa_pool(iohgatp.GSCID)) == NULL )
+        return;
+    free_pages(p, gppn, num_gppn);
+    return;
+}
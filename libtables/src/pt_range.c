@@ -0,0 +1,541 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include "iommu.h"
+#include "tables_api.h"
+// Format of a page table and a cursor to the tables last walked. The cursor
+// holds the address of the table at each level along with the part of the
+// address that selects that table so that mapping consecutive pages does not
+// walk the tables from the root again.
+typedef struct {
+    uint8_t   levels;
+    uint8_t   pte_size;
+    uint8_t   vpn_width;
+    uint8_t   root_vpn_width;
+    uint8_t   max_leaf_level;
+    uint8_t   napot;
+    uint8_t   is_vs_stage;
+    uint8_t   is_g_stage;
+    iohgatp_t iohgatp;
+    uint64_t  root;
+    uint8_t   valid[5];
+    uint64_t  tag[5];
+    uint64_t  table[5];
+} pt_walk_t;
+
+#define UNMAP   0
+#define PROTECT 1
+static int64_t update_range(pt_walk_t *w, uint64_t table, uint8_t level, uint64_t va,
+                            uint64_t end, uint8_t op, pte_t perms, iotinval_batch_t *inv);
+
+static uint8_t
+init_s_stage_walk(
+    pt_walk_t *w, iosatp_t satp) {
+    memset(w, 0, sizeof(pt_walk_t));
+    w->pte_size = 8;
+    w->vpn_width = w->root_vpn_width = 9;
+    if ( satp.MODE == IOSATP_Sv32 ) {
+        w->levels = 2;
+        w->pte_size = 4;
+        w->vpn_width = w->root_vpn_width = 10;
+    }
+    if ( satp.MODE == IOSATP_Sv39 ) w->levels = 3;
+    if ( satp.MODE == IOSATP_Sv48 ) w->levels = 4;
+    if ( satp.MODE == IOSATP_Sv57 ) w->levels = 5;
+    if ( w->levels == 0 ) return 1;
+    w->root = satp.PPN * PAGESIZE;
+    return 0;
+}
+static uint8_t
+init_g_stage_walk(
+    pt_walk_t *w, iohgatp_t iohgatp) {
+    memset(w, 0, sizeof(pt_walk_t));
+    // The root table of the G-stage is 16 KiB and is indexed by 2 more bits
+    w->pte_size = 8;
+    w->vpn_width = 9;
+    w->root_vpn_width = 11;
+    if ( iohgatp.MODE == IOHGATP_Sv32x4 ) {
+        w->levels = 2;
+        w->pte_size = 4;
+        w->vpn_width = 10;
+        w->root_vpn_width = 12;
+    }
+    if ( iohgatp.MODE == IOHGATP_Sv39x4 ) w->levels = 3;
+    if ( iohgatp.MODE == IOHGATP_Sv48x4 ) w->levels = 4;
+    if ( iohgatp.MODE == IOHGATP_Sv57x4 ) w->levels = 5;
+    if ( w->levels == 0 ) return 1;
+    w->is_g_stage = 1;
+    w->iohgatp = iohgatp;
+    w->root = iohgatp.PPN * PAGESIZE;
+    return 0;
+}
+static uint8_t
+pt_shift(
+    pt_walk_t *w, uint8_t level) {
+    return 12 + (w->vpn_width * level);
+}
+static uint64_t
+pt_index(
+    pt_walk_t *w, uint64_t va, uint8_t level) {
+    uint8_t width = ( level == (w->levels - 1) ) ? w->root_vpn_width : w->vpn_width;
+    return (va >> pt_shift(w, level)) & ((1UL << width) - 1);
+}
+// Allocate and clear a table. Tables of the VS-stage are allocated in guest
+// physical memory and are mapped by the G-stage page table. Returns the
+// PPN to program in the non-leaf PTE and the SPA of the table.
+static uint8_t
+alloc_table(
+    pt_walk_t *w, uint64_t *ppn, uint64_t *spa, int64_t *num_tables) {
+    uint64_t zero = 0;
+    int64_t g_tables;
+    gpte_t gpte;
+    uint32_t i;
+
+    if ( (*ppn = get_free_ppn(1)) == INVALID_PPN )
+        return 1;
+    *spa = *ppn * PAGESIZE;
+    if ( w->is_vs_stage == 1 ) {
+        if ( (*ppn = get_free_gppn(1, w->iohgatp)) == INVALID_PPN ) {
+            free_ppn((*spa / PAGESIZE), 1);
+            return 1;
+        }
+        gpte.raw = 0;
+        gpte.R = gpte.W = gpte.U = 1;
+        gpte.PBMT = PMA;
+        if ( (g_tables = map_g_stage_range(w->iohgatp, (*ppn * PAGESIZE), *spa,
+                                           PAGESIZE, gpte)) < 0 )
+            return 1;
+        *num_tables += g_tables;
+    }
+    for ( i = 0; i < PAGESIZE; i += 8 )
+        write_memory((char *)&zero, (*spa + i), 8);
+    *num_tables += 1;
+    return 0;
+}
+// Determine the SPA of the table pointed to by a non-leaf PTE
+static uint8_t
+translate_table(
+    pt_walk_t *w, uint64_t ppn, uint64_t *spa) {
+    if ( w->is_vs_stage == 1 )
+        return translate_gpa(w->iohgatp, (ppn * PAGESIZE), spa);
+    *spa = ppn * PAGESIZE;
+    return 0;
+}
+// Locate the table at the level, allocating non-leaf tables as needed, and
+// update the cursor. Returns 1 if a leaf PTE maps the address at a higher
+// level.
+static uint8_t
+walk_to_level(
+    pt_walk_t *w, uint64_t va, uint8_t level, uint64_t *table, int64_t *num_tables) {
+    uint64_t a, pte_addr, ppn;
+    pte_t nl_pte;
+    uint8_t i;
+
+    // Resume from the lowest level whose table in the cursor covers the address
+    for ( i = level; i < (w->levels - 1); i++ )
+        if ( w->valid[i] == 1 && w->tag[i] == (va >> pt_shift(w, i + 1)) )
+            break;
+    a = ( i == (w->levels - 1) ) ? w->root : w->table[i];
+    for ( ; i > level; i-- ) {
+        pte_addr = a | (pt_index(w, va, i) * w->pte_size);
+        nl_pte.raw = 0;
+        read_memory(pte_addr, w->pte_size, (char *)&nl_pte.raw);
+        if ( nl_pte.V == 1 && (nl_pte.R == 1 || nl_pte.W == 1 || nl_pte.X == 1) )
+            return 1;
+        if ( nl_pte.V == 0 ) {
+            if ( alloc_table(w, &ppn, &a, num_tables) ) return 1;
+            nl_pte.raw = 0;
+            nl_pte.V = 1;
+            nl_pte.PPN = ppn;
+            write_memory((char *)&nl_pte.raw, pte_addr, w->pte_size);
+        } else if ( translate_table(w, nl_pte.PPN, &a) ) {
+            return 1;
+        }
+        w->valid[i - 1] = 1;
+        w->tag[i - 1] = va >> pt_shift(w, i);
+        w->table[i - 1] = a;
+    }
+    *table = a;
+    return 0;
+}
+// Select the largest page that is aligned in both the input and the output
+// address spaces and that fits in the range. A 64 KiB NAPOT page is mapped
+// by 16 identical PTEs. Returns the size of the page.
+static uint64_t
+select_page(
+    pt_walk_t *w, uint64_t va, uint64_t pa, uint64_t len, uint8_t *level, uint8_t *num_ptes) {
+    uint64_t page_sz;
+
+    for ( *level = w->max_leaf_level; *level > 0; (*level)-- ) {
+        page_sz = 1UL << pt_shift(w, *level);
+        if ( ((va | pa) & (page_sz - 1)) == 0 && len >= page_sz )
+            break;
+    }
+    *num_ptes = 1;
+    if ( *level == 0 && w->napot == 1 &&
+         ((va | pa) & ((16 * PAGESIZE) - 1)) == 0 && len >= (16 * PAGESIZE) )
+        *num_ptes = 16;
+    return ( *num_ptes == 16 ) ? (16 * PAGESIZE) : (1UL << pt_shift(w, *level));
+}
+// Determine if the range can be mapped without replacing an existing leaf
+// or table. The tables are only read.
+static uint8_t
+is_range_free(
+    pt_walk_t *w, uint64_t va, uint64_t pa, uint64_t len) {
+    uint64_t a, page_sz;
+    uint8_t level, num_ptes, i;
+    pte_t pte;
+
+    while ( len != 0 ) {
+        page_sz = select_page(w, va, pa, len, &level, &num_ptes);
+        a = w->root;
+        for ( i = w->levels - 1; i > level; i-- ) {
+            pte.raw = 0;
+            read_memory((a | (pt_index(w, va, i) * w->pte_size)), w->pte_size,
+                        (char *)&pte.raw);
+            if ( pte.V == 0 )
+                break;
+            if ( pte.R == 1 || pte.W == 1 || pte.X == 1 || translate_table(w, pte.PPN, &a) )
+                return 0;
+        }
+        for ( ; i == level && num_ptes != 0; num_ptes-- ) {
+            pte.raw = 0;
+            read_memory((a | (pt_index(w, (va + ((num_ptes - 1) * PAGESIZE)), level) *
+                              w->pte_size)), w->pte_size, (char *)&pte.raw);
+            if ( pte.V == 1 )
+                return 0;
+        }
+        va += page_sz;
+        pa += page_sz;
+        len -= page_sz;
+    }
+    return 1;
+}
+// Map the range using the largest pages that are aligned in both the input
+// and the output address spaces and that fit in the range. Returns the number
+// of tables allocated or -1 if the range could not be mapped, which includes
+// a part of the range that is already mapped. The range is checked before
+// any PTE is written, and if a table could not be allocated the part of the
+// range already mapped is unmapped, so nothing is mapped when -1 is returned.
+static int64_t
+map_range(
+    pt_walk_t *w, uint64_t va, uint64_t pa, uint64_t len, pte_t attrs) {
+    uint64_t table, page_sz, start, end;
+    int64_t num_tables;
+    uint8_t level, i, num_ptes;
+    pte_t pte;
+
+    if ( ((va | pa | len) & (PAGESIZE - 1)) != 0 )
+        return -1;
+    if ( is_range_free(w, va, pa, len) == 0 )
+        return -1;
+    num_tables = 0;
+    start = va;
+    end = va + len;
+    while ( len != 0 ) {
+        page_sz = select_page(w, va, pa, len, &level, &num_ptes);
+        pte = attrs;
+        pte.V = 1;
+        pte.N = 0;
+        pte.PPN = pa / PAGESIZE;
+        // The low 4 bits of the PPN of a NAPOT page are encoded as 1000b
+        if ( num_ptes == 16 ) {
+            pte.N = 1;
+            pte.PPN = (pte.PPN & ~0xFUL) | 0x8;
+        }
+        if ( walk_to_level(w, va, level, &table, &num_tables) ) {
+            // The range was free so the tables allocated for it, including
+            // those allocated for this page, are emptied and freed
+            pte.raw = 0;
+            update_range(w, w->root, (w->levels - 1), start, end, UNMAP, pte, NULL);
+            return -1;
+        }
+        for ( i = 0; i < num_ptes; i++ )
+            write_memory((char *)&pte.raw,
+                         (table | (pt_index(w, (va + (i * PAGESIZE)), level) * w->pte_size)),
+                         w->pte_size);
+        va += page_sz;
+        pa += page_sz;
+        len -= page_sz;
+    }
+    return num_tables;
+}
+// Leaf PTEs are created at levels up to the 1 GiB (4 MiB for Sv32) pages.
+// NAPOT pages are used when requested by the N bit in the PTE attributes.
+#define MAX_LEAF_LEVEL(__W) ((((__W)->levels - 1) < 2) ? ((__W)->levels - 1) : 2)
+int64_t
+map_s_stage_range(
+    iosatp_t satp, uint64_t va, uint64_t pa, uint64_t len, pte_t pte) {
+    pt_walk_t w;
+
+    if ( init_s_stage_walk(&w, satp) )
+        return -1;
+    w.max_leaf_level = MAX_LEAF_LEVEL(&w);
+    w.napot = ( w.pte_size == 8 ) ? pte.N : 0;
+    return map_range(&w, va, pa, len, pte);
+}
+int64_t
+map_vs_stage_range(
+    iosatp_t satp, uint64_t va, uint64_t gpa, uint64_t len, pte_t pte, iohgatp_t iohgatp) {
+    pt_walk_t w;
+
+    if ( init_s_stage_walk(&w, satp) )
+        return -1;
+    w.max_leaf_level = MAX_LEAF_LEVEL(&w);
+    w.napot = ( w.pte_size == 8 ) ? pte.N : 0;
+    w.is_vs_stage = 1;
+    w.iohgatp = iohgatp;
+    if ( translate_gpa(iohgatp, w.root, &w.root) )
+        return -1;
+    return map_range(&w, va, gpa, len, pte);
+}
+int64_t
+map_g_stage_range(
+    iohgatp_t iohgatp, uint64_t gpa, uint64_t spa, uint64_t len, gpte_t gpte) {
+    pt_walk_t w;
+    pte_t pte;
+
+    if ( init_g_stage_walk(&w, iohgatp) )
+        return -1;
+    w.max_leaf_level = MAX_LEAF_LEVEL(&w);
+    pte.raw = gpte.raw;
+    invalidate_gpa_cache(iohgatp);
+    return map_range(&w, gpa, spa, len, pte);
+}
+
+// Add a IOTINVAL command to the batch. When the batch is full, or when a
+// table was freed and information cached from non-leaf entries needs to be
+// invalidated, the commands are replaced by a single command that
+// invalidates the entire address space. The IOTINVAL.GVMA commands queued
+// when the guest physical pages of freed VS-stage tables are unmapped are
+// kept when the VS-stage commands are replaced, as an IOTINVAL.VMA does not
+// invalidate the G-stage translations.
+static void
+add_iotinval(
+    pt_walk_t *w, iotinval_batch_t *inv, uint8_t AV, uint64_t addr) {
+    command_t *cmd;
+    uint32_t i, n;
+    uint8_t func3;
+
+    if ( inv == NULL || inv->max_cmds == 0 )
+        return;
+    func3 = ( w->is_g_stage == 1 ) ? GVMA : VMA;
+    // An IOTINVAL.GVMA of the entire address space also invalidates the
+    // VS-stage translations of the guest
+    for ( i = 0; i < inv->num_cmds; i++ )
+        if ( inv->cmds[i].iotinval.av == 0 &&
+             (inv->cmds[i].iotinval.func3 == func3 || inv->cmds[i].iotinval.func3 == GVMA) )
+            return;
+    if ( AV == 0 || inv->num_cmds == inv->max_cmds ) {
+        for ( i = n = 0; i < inv->num_cmds; i++ )
+            if ( func3 == VMA && inv->cmds[i].iotinval.func3 == GVMA )
+                inv->cmds[n++] = inv->cmds[i];
+        inv->num_cmds = n;
+        AV = 0;
+        if ( n == inv->max_cmds ) {
+            inv->num_cmds = 0;
+            func3 = GVMA;
+        }
+    }
+    cmd = &inv->cmds[inv->num_cmds++];
+    cmd->low = cmd->high = 0;
+    cmd->iotinval.opcode = IOTINVAL;
+    cmd->iotinval.func3 = func3;
+    cmd->iotinval.gv = ( w->iohgatp.MODE == IOHGATP_Bare ) ? 0 : 1;
+    cmd->iotinval.gscid = ( w->iohgatp.MODE == IOHGATP_Bare ) ? 0 : w->iohgatp.GSCID;
+    if ( func3 == VMA ) {
+        cmd->iotinval.pscv = inv->PSCV;
+        cmd->iotinval.pscid = inv->PSCID;
+    }
+    cmd->iotinval.av = AV;
+    cmd->iotinval.addr_63_12 = ( AV == 1 ) ? (addr / PAGESIZE) : 0;
+    return;
+}
+static uint8_t
+is_table_empty(
+    pt_walk_t *w, uint64_t table) {
+    uint64_t i;
+    pte_t pte;
+
+    for ( i = 0; i < (1UL << w->vpn_width); i++ ) {
+        pte.raw = 0;
+        read_memory((table | (i * w->pte_size)), w->pte_size, (char *)&pte.raw);
+        if ( pte.V == 1 )
+            return 0;
+    }
+    return 1;
+}
+// Return a table to the page pool. The guest physical page holding a table
+// of the VS-stage is unmapped from the G-stage, with the invalidation added
+// to the batch, and returned too. Returns the number of tables freed.
+static int64_t
+free_table(
+    pt_walk_t *w, uint64_t ppn, uint64_t spa, iotinval_batch_t *inv) {
+    int64_t g_tables;
+
+    free_ppn((spa / PAGESIZE), 1);
+    if ( w->is_vs_stage == 0 )
+        return 1;
+    if ( (g_tables = unmap_g_stage_range(w->iohgatp, (ppn * PAGESIZE), PAGESIZE, inv)) < 0 )
+        return -1;
+    free_gppn(ppn, 1, w->iohgatp);
+    return 1 + g_tables;
+}
+// Unmap or change the permissions of the leaf PTEs in the range. Leaf PTEs
+// must be entirely covered by the range. Returns the number of tables freed
+// when unmapping or the number of leaf PTEs changed when protecting, or -1
+// if the range covers a part of a leaf PTE.
+static int64_t
+update_range(
+    pt_walk_t *w, uint64_t table, uint8_t level, uint64_t va, uint64_t end,
+    uint8_t op, pte_t perms, iotinval_batch_t *inv) {
+    uint64_t entry_sz, leaf_sz, next, pte_addr, child;
+    int64_t count, n;
+    uint8_t i, num_ptes;
+    pte_t pte, new_pte;
+
+    count = 0;
+    entry_sz = 1UL << pt_shift(w, level);
+    while ( va < end ) {
+        next = (va & ~(entry_sz - 1)) + entry_sz;
+        if ( next > end ) next = end;
+        pte_addr = table | (pt_index(w, va, level) * w->pte_size);
+        pte.raw = 0;
+        read_memory(pte_addr, w->pte_size, (char *)&pte.raw);
+        if ( pte.V == 0 ) {
+            va = next;
+            continue;
+        }
+        if ( pte.R == 1 || pte.W == 1 || pte.X == 1 ) {
+            // The 16 PTEs of a NAPOT page are updated together
+            num_ptes = ( level == 0 && pte.N == 1 ) ? 16 : 1;
+            leaf_sz = entry_sz * num_ptes;
+            if ( (va & (leaf_sz - 1)) != 0 || (end - va) < leaf_sz )
+                return -1;
+            new_pte.raw = 0;
+            if ( op == PROTECT ) {
+                new_pte.raw = pte.raw;
+                new_pte.R = perms.R;
+                new_pte.W = perms.W;
+                new_pte.X = perms.X;
+                new_pte.U = perms.U;
+            }
+            if ( new_pte.raw != pte.raw ) {
+                for ( i = 0; i < num_ptes; i++ )
+                    write_memory((char *)&new_pte.raw, (pte_addr + (i * w->pte_size)),
+                                 w->pte_size);
+                if ( op == PROTECT ) count++;
+                // No invalidation is needed when permissions are only added
+                if ( op == UNMAP ||
+                     (pte.R & ~new_pte.R) || (pte.W & ~new_pte.W) ||
+                     (pte.X & ~new_pte.X) || (pte.U != new_pte.U) )
+                    add_iotinval(w, inv, 1, va);
+            }
+            va += leaf_sz;
+            continue;
+        }
+        if ( level == 0 || translate_table(w, pte.PPN, &child) )
+            return -1;
+        if ( (n = update_range(w, child, level - 1, va, next, op, perms, inv)) < 0 )
+            return -1;
+        count += n;
+        if ( op == UNMAP && is_table_empty(w, child) ) {
+            new_pte.raw = 0;
+            write_memory((char *)&new_pte.raw, pte_addr, w->pte_size);
+            if ( (n = free_table(w, pte.PPN, child, inv)) < 0 )
+                return -1;
+            count += n;
+            add_iotinval(w, inv, 0, 0);
+        }
+        va = next;
+    }
+    return count;
+}
+static int64_t
+unmap_protect_range(
+    pt_walk_t *w, uint64_t va, uint64_t len, uint8_t op, pte_t perms, iotinval_batch_t *inv) {
+    if ( ((va | len) & (PAGESIZE - 1)) != 0 )
+        return -1;
+    // The permissions must be those of a leaf PTE. Write permission
+    // without read permission is reserved.
+    if ( op == PROTECT &&
+         ((perms.R == 0 && perms.W == 0 && perms.X == 0) || (perms.W == 1 && perms.R == 0)) )
+        return -1;
+    return update_range(w, w->root, (w->levels - 1), va, (va + len), op, perms, inv);
+}
+int64_t
+unmap_s_stage_range(
+    iosatp_t satp, uint64_t va, uint64_t len, iotinval_batch_t *inv) {
+    pt_walk_t w;
+    pte_t perms;
+
+    if ( init_s_stage_walk(&w, satp) )
+        return -1;
+    perms.raw = 0;
+    return unmap_protect_range(&w, va, len, UNMAP, perms, inv);
+}
+int64_t
+unmap_vs_stage_range(
+    iosatp_t satp, uint64_t va, uint64_t len, iohgatp_t iohgatp, iotinval_batch_t *inv) {
+    pt_walk_t w;
+    pte_t perms;
+
+    if ( init_s_stage_walk(&w, satp) )
+        return -1;
+    w.is_vs_stage = 1;
+    w.iohgatp = iohgatp;
+    if ( translate_gpa(iohgatp, w.root, &w.root) )
+        return -1;
+    perms.raw = 0;
+    return unmap_protect_range(&w, va, len, UNMAP, perms, inv);
+}
+int64_t
+unmap_g_stage_range(
+    iohgatp_t iohgatp, uint64_t gpa, uint64_t len, iotinval_batch_t *inv) {
+    pt_walk_t w;
+    pte_t perms;
+
+    if ( init_g_stage_walk(&w, iohgatp) )
+        return -1;
+    perms.raw = 0;
+    invalidate_gpa_cache(iohgatp);
+    return unmap_protect_range(&w, gpa, len, UNMAP, perms, inv);
+}
+int64_t
+protect_s_stage_range(
+    iosatp_t satp, uint64_t va, uint64_t len, pte_t perms, iotinval_batch_t *inv) {
+    pt_walk_t w;
+
+    if ( init_s_stage_walk(&w, satp) )
+        return -1;
+    return unmap_protect_range(&w, va, len, PROTECT, perms, inv);
+}
+int64_t
+protect_vs_stage_range(
+    iosatp_t satp, uint64_t va, uint64_t len, pte_t perms, iohgatp_t iohgatp,
+    iotinval_batch_t *inv) {
+    pt_walk_t w;
+
+    if ( init_s_stage_walk(&w, satp) )
+        return -1;
+    w.is_vs_stage = 1;
+    w.iohgatp = iohgatp;
+    if ( translate_gpa(iohgatp, w.root, &w.root) )
+        return -1;
+    return unmap_protect_range(&w, va, len, PROTECT, perms, inv);
+}
+int64_t
+protect_g_stage_range(
+    iohgatp_t iohgatp, uint64_t gpa, uint64_t len, gpte_t perms, iotinval_batch_t *inv) {
+    pt_walk_t w;
+    pte_t pte_perms;
+
+    // G-stage accesses are treated as U-mode accesses so a leaf without
+    // U permission would not grant the permissions
+    if ( init_g_stage_walk(&w, iohgatp) || perms.U == 0 )
+        return -1;
+    pte_perms.raw = perms.raw;
+    invalidate_gpa_cache(iohgatp);
+    return unmap_protect_range(&w, gpa, len, PROTECT, pte_perms, inv);
+}
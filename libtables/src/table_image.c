@@ -0,0 +1,220 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "iommu.h"
+#include "tables_api.h"
+// A table image holds the pages allocated from the supervisor physical
+// address space page pool that are not all zero, the state of the page
+// pools, and the registers that locate the tables and queues. The image
+// is laid out as follows:
+//   - The header padded to PAGESIZE bytes
+//   - The populated pages
+//   - The runs of consecutive populated pages
+//   - The state of the page pools
+// The pages are page aligned in the file so that they may be mapped
+// copy-on-write into the memory on restore.
+#define TABLE_IMAGE_MAGIC   0x474D49544F495652UL
+#define TABLE_IMAGE_VERSION 1
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t num_runs;
+    uint64_t runs_offset;
+    uint64_t capabilities;
+    uint64_t ddtp;
+    uint64_t cqb;
+    uint64_t fqb;
+    uint64_t pqb;
+    uint32_t fctrl;
+    uint32_t cqcsr;
+    uint32_t fqcsr;
+    uint32_t pqcsr;
+} image_hdr_t;
+typedef struct {
+    uint64_t ppn;
+    uint64_t num_ppns;
+    uint64_t offset;
+} image_run_t;
+
+static uint8_t
+read_page(
+    uint64_t ppn, uint64_t *page, uint8_t *is_zero) {
+    uint32_t i;
+
+    *is_zero = 1;
+    for ( i = 0; i < (PAGESIZE / 8); i++ ) {
+        if ( read_memory(((ppn * PAGESIZE) + (i * 8)), 8, (char *)&page[i]) != 0 )
+            return 1;
+        if ( page[i] != 0 ) *is_zero = 0;
+    }
+    return 0;
+}
+// Save the tables and the registers to a table image. The queues and
+// the tables must be quiescent. Returns 1 if the image could not be
+// written.
+uint8_t
+save_table_image(
+    const char *path) {
+    uint64_t base_ppn, next_ppn, ppn, offset;
+    uint64_t page[PAGESIZE / 8];
+    image_run_t *runs, *r;
+    uint64_t max_runs;
+    image_hdr_t hdr;
+    uint8_t is_zero, status = 1;
+    FILE *fp;
+
+    if ( (fp = fopen(path, "wb")) == NULL )
+        return 1;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TABLE_IMAGE_MAGIC;
+    hdr.version = TABLE_IMAGE_VERSION;
+    hdr.page_size = PAGESIZE;
+    hdr.capabilities = read_register(CAPABILITIES_OFFSET, 8);
+    hdr.fctrl = read_register(FCTRL_OFFSET, 4);
+    hdr.ddtp = read_register(DDTP_OFFSET, 8);
+    hdr.cqb = read_register(CQB_OFFSET, 8);
+    hdr.fqb = read_register(FQB_OFFSET, 8);
+    hdr.pqb = read_register(PQB_OFFSET, 8);
+    hdr.cqcsr = read_register(CQCSR_OFFSET, 4);
+    hdr.fqcsr = read_register(FQCSR_OFFSET, 4);
+    hdr.pqcsr = read_register(PQCSR_OFFSET, 4);
+
+    // Copy the populated pages
+    runs = NULL;
+    max_runs = 0;
+    offset = PAGESIZE;
+    get_page_pool_range(&base_ppn, &next_ppn);
+    if ( fseek(fp, offset, SEEK_SET) != 0 ) goto done;
+    for ( ppn = base_ppn; ppn < next_ppn; ppn++ ) {
+        if ( read_page(ppn, page, &is_zero) != 0 ) goto done;
+        if ( is_zero == 1 ) continue;
+        if ( fwrite(page, PAGESIZE, 1, fp) != 1 ) goto done;
+        if ( hdr.num_runs == 0 ||
+             (runs[hdr.num_runs - 1].ppn + runs[hdr.num_runs - 1].num_ppns) != ppn ) {
+            if ( hdr.num_runs == max_runs ) {
+                max_runs = ( max_runs == 0 ) ? 64 : (max_runs * 2);
+                if ( (r = realloc(runs, (max_runs * sizeof(image_run_t)))) == NULL )
+                    goto done;
+                runs = r;
+            }
+            runs[hdr.num_runs].ppn = ppn;
+            runs[hdr.num_runs].num_ppns = 0;
+            runs[hdr.num_runs].offset = offset;
+            hdr.num_runs++;
+        }
+        runs[hdr.num_runs - 1].num_ppns++;
+        offset += PAGESIZE;
+    }
+    hdr.runs_offset = offset;
+    if ( fwrite(runs, sizeof(image_run_t), hdr.num_runs, fp) != hdr.num_runs ||
+         save_page_pools(fp) != 0 )
+        goto done;
+    if ( fseek(fp, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, fp) != 1 )
+        goto done;
+    status = 0;
+done:
+    free(runs);
+    if ( fclose(fp) != 0 ) status = 1;
+    return status;
+}
+// Restore the tables and the registers from a table image. The pages of
+// the image are mapped copy-on-write over the memory of mem_size bytes and
+// the rest of the memory is cleared. The memory must be page aligned. The
+// IOMMU must have been reset with the capabilities in the image and the
+// queues are restored empty. Returns 1 if the image is not valid or
+// could not be mapped. The image is validated before the memory is
+// remapped so the memory is not changed if the image is not valid.
+uint8_t
+restore_table_image(
+    const char *path, char *memory, uint64_t mem_size) {
+    image_run_t *runs = NULL;
+    image_hdr_t hdr;
+    struct stat st;
+    ddtp_t ddtp;
+    cqcsr_t cqcsr, cqcsr_saved;
+    fqcsr_t fqcsr, fqcsr_saved;
+    pqcsr_t pqcsr, pqcsr_saved;
+    uint64_t i, mem_ppns;
+    uint8_t status = 1;
+    FILE *fp;
+
+    if ( sysconf(_SC_PAGESIZE) != PAGESIZE || ((uintptr_t)memory & (PAGESIZE - 1)) != 0 ||
+         (mem_size & (PAGESIZE - 1)) != 0 )
+        return 1;
+    if ( (fp = fopen(path, "rb")) == NULL )
+        return 1;
+    if ( fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != TABLE_IMAGE_MAGIC ||
+         hdr.version != TABLE_IMAGE_VERSION || hdr.page_size != PAGESIZE ||
+         hdr.capabilities != read_register(CAPABILITIES_OFFSET, 8) )
+        goto done;
+    // The runs must be in the file and the pages of each run must be in the
+    // file before the runs and fit in the memory
+    if ( fstat(fileno(fp), &st) != 0 || hdr.runs_offset > (uint64_t)st.st_size ||
+         hdr.num_runs > (((uint64_t)st.st_size - hdr.runs_offset) / sizeof(image_run_t)) )
+        goto done;
+    if ( hdr.num_runs != 0 &&
+         (runs = malloc(hdr.num_runs * sizeof(image_run_t))) == NULL )
+        goto done;
+    if ( fseek(fp, hdr.runs_offset, SEEK_SET) != 0 ||
+         fread(runs, sizeof(image_run_t), hdr.num_runs, fp) != hdr.num_runs )
+        goto done;
+    mem_ppns = mem_size / PAGESIZE;
+    for ( i = 0; i < hdr.num_runs; i++ ) {
+        if ( runs[i].num_ppns == 0 ||
+             runs[i].ppn > mem_ppns || runs[i].num_ppns > (mem_ppns - runs[i].ppn) ||
+             (runs[i].offset & (PAGESIZE - 1)) != 0 || runs[i].offset < PAGESIZE ||
+             runs[i].offset > hdr.runs_offset ||
+             (runs[i].num_ppns * PAGESIZE) > (hdr.runs_offset - runs[i].offset) )
+            goto done;
+    }
+    // The state of the page pools is validated before the pools are changed
+    // so the pools are restored before the memory is remapped
+    if ( restore_page_pools(fp) != 0 ) goto done;
+    if ( mmap(memory, mem_size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED )
+        goto done;
+    for ( i = 0; i < hdr.num_runs; i++ ) {
+        if ( mmap((memory + (runs[i].ppn * PAGESIZE)), (runs[i].num_ppns * PAGESIZE),
+                  PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                  fileno(fp), runs[i].offset) == MAP_FAILED )
+            goto done;
+    }
+    flush_gpa_cache();
+
+    // Restore the registers in the order software would program them
+    write_register(FCTRL_OFFSET, 4, hdr.fctrl);
+    write_register(CQB_OFFSET, 8, hdr.cqb);
+    write_register(FQB_OFFSET, 8, hdr.fqb);
+    write_register(PQB_OFFSET, 8, hdr.pqb);
+    cqcsr_saved.raw = hdr.cqcsr;
+    cqcsr.raw = 0;
+    cqcsr.cqen = cqcsr_saved.cqen;
+    cqcsr.cie = cqcsr_saved.cie;
+    write_register(CQCSR_OFFSET, 4, cqcsr.raw);
+    fqcsr_saved.raw = hdr.fqcsr;
+    fqcsr.raw = 0;
+    fqcsr.fqen = fqcsr_saved.fqen;
+    fqcsr.fie = fqcsr_saved.fie;
+    write_register(FQCSR_OFFSET, 4, fqcsr.raw);
+    pqcsr_saved.raw = hdr.pqcsr;
+    pqcsr.raw = 0;
+    pqcsr.pqen = pqcsr_saved.pqen;
+    pqcsr.pie = pqcsr_saved.pie;
+    write_register(PQCSR_OFFSET, 4, pqcsr.raw);
+    write_register(DDTP_OFFSET, 8, hdr.ddtp);
+    do {
+        ddtp.raw = read_register(DDTP_OFFSET, 8);
+    } while ( ddtp.busy == 1 );
+    status = 0;
+done:
+    free(runs);
+    fclose(fp);
+    return status;
+}
@@ -3,6 +3,54 @@
 // SPDX-License-Identifier: Apache-2.0
 // Author: ved@rivosinc.com
 #include "iommu.h"
+#include "tables_api.h"
+// Translations of guest physical pages are memoised by the G-stage root
+// table and the guest physical page. Each root has a generation that is
+// advanced when libtables modifies the G-stage table and an entry is used
+// only if it was filled in the current generation of its root. Roots that
+// hash to the same generation counter share it. The memoised translations
+// are per thread so that tables may be walked by multiple threads.
+#define GPA_CACHE_SIZE 4096
+#define GPA_ROOT_GENS  256
+typedef struct {
+    uint64_t root_ppn;
+    uint64_t gppn;
+    uint64_t spa_ppn;
+    uint32_t gen;
+    uint8_t  mode;
+    uint8_t  valid;
+} gpa_cache_t;
+static __thread gpa_cache_t gpa_cache[GPA_CACHE_SIZE];
+static uint32_t root_gen[GPA_ROOT_GENS];
+
+static uint32_t
+root_gen_index(
+    uint64_t root_ppn) {
+    return (root_ppn ^ (root_ppn >> 8)) & (GPA_ROOT_GENS - 1);
+}
+static uint32_t
+gpa_cache_index(
+    uint64_t root_ppn, uint64_t gppn) {
+    return ((gppn * 0x9E3779B97F4A7C15UL) ^ root_ppn) >> 52;
+}
+// Invalidate the translations memoised for the G-stage table. Must be
+// invoked when the G-stage table is modified other than through libtables.
+void
+invalidate_gpa_cache(
+    iohgatp_t iohgatp) {
+    root_gen[root_gen_index(iohgatp.PPN)]++;
+    return;
+}
+// Invalidate the translations memoised for all G-stage tables by all threads
+void
+flush_gpa_cache(
+    void) {
+    uint32_t i;
+
+    for ( i = 0; i < GPA_ROOT_GENS; i++ )
+        root_gen[i]++;
+    return;
+}
 uint8_t
 translate_gpa (
     iohgatp_t iohgatp, uint64_t gpa, uint64_t *spa) {
@@ -12,35 +60,41 @@ translate_gpa (
     uint8_t i, PTESIZE, LEVELS;
     gpte_t nl_gpte;
     uint64_t gst_page_sz;
+    gpa_cache_t *c;
+    uint32_t gen;
 
     PTESIZE = 8;
     if ( iohgatp.MODE == IOHGATP_Bare ) {
         *spa = gpa;
         return 0;
     }
+    c = &gpa_cache[gpa_cache_index(iohgatp.PPN, (gpa / PAGESIZE))];
+    gen = root_gen[root_gen_index(iohgatp.PPN)];
+    if ( c->valid == 1 && c->root_ppn == iohgatp.PPN && c->mode == iohgatp.MODE &&
+         c->gppn == (gpa / PAGESIZE) && c->gen == gen ) {
+        *spa = (c->spa_ppn * PAGESIZE) | (gpa & (PAGESIZE - 1));
+        return 0;
+    }
     if ( iohgatp.MODE == IOHGATP_Sv32x4 ) {
         vpn[0] = get_bits(21, 12, gpa);
         vpn[1] = get_bits(34, 22, gpa);
         LEVELS = 2;
         PTESIZE = 4;
         gst_page_sz = 4UL * 1024UL * 1024UL;
-    }
-    if ( iohgatp.MODE == IOHGATP_Sv32x4 ) {
+    } else if ( iohgatp.MODE == IOHGATP_Sv39x4 ) {
         vpn[0] = get_bits(20, 12, gpa);
         vpn[1] = get_bits(29, 21, gpa);
         vpn[2] = get_bits(40, 30, gpa);
         gst_page_sz = 512UL * 512UL * PAGESIZE;
         LEVELS = 3;
-    }
-    if ( iohgatp.MODE == IOHGATP_Sv48x4 ) {
+    } else if ( iohgatp.MODE == IOHGATP_Sv48x4 ) {
         vpn[0] = get_bits(20, 12, gpa);
         vpn[1] = get_bits(29, 21, gpa);
         vpn[2] = get_bits(38, 30, gpa);
         vpn[3] = get_bits(49, 39, gpa);
         gst_page_sz = 512UL * 512UL * 512UL * PAGESIZE;
         LEVELS = 4;
-    }
-    if ( iohgatp.MODE == IOHGATP_Sv57x4 ) {
+    } else if ( iohgatp.MODE == IOHGATP_Sv57x4 ) {
         vpn[0] = get_bits(20, 12, gpa);
         vpn[1] = get_bits(29, 21, gpa);
         vpn[2] = get_bits(38, 30, gpa);
@@ -48,6 +102,8 @@ translate_gpa (
         vpn[4] = get_bits(58, 48, gpa);
         gst_page_sz = 512UL * 512UL * 512UL * 512UL * PAGESIZE;
         LEVELS = 5;
+    } else {
+        return 1;
     }
     i = LEVELS - 1;
     a = iohgatp.PPN * PAGESIZE;
@@ -59,10 +115,16 @@ translate_gpa (
             *spa = *spa * PAGESIZE;
             *spa = *spa & ~(gst_page_sz - 1);
             *spa = *spa | (gpa & (gst_page_sz - 1));
+            c->valid = 1;
+            c->root_ppn = iohgatp.PPN;
+            c->mode = iohgatp.MODE;
+            c->gppn = gpa / PAGESIZE;
+            c->spa_ppn = *spa / PAGESIZE;
+            c->gen = gen;
             return 0;
         }
+        if ( i == 0 ) return 1;
         i = i - 1;
-        if ( i < 0 ) return 1;
         gst_page_sz = ( i == 0 ) ? PAGESIZE : (gst_page_sz / 512);
         a = nl_gpte.PPN * PAGESIZE;
     }
@@ -0,0 +1,553 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+#include <stdlib.h>
+#include <pthread.h>
+#include "iommu.h"
+#include "tables_api.h"
+// The tables are verified in three phases. The first phase walks the
+// non-leaf levels of the DDT and collects the leaf DDT pages. The second
+// phase verifies the device contexts in the leaf DDT pages and walks their
+// process directory tables, collecting the roots of the S/VS-stage and the
+// G-stage page tables referenced. The third phase walks each distinct page
+// table once. The second and third phases divide their work among threads.
+// The entries are checked using the same checks that the IOMMU makes when
+// translating through them. Entries that are not valid are unused and are
+// not reported.
+typedef struct {
+    uint64_t ppn;
+    uint32_t device_id;
+} ddt_page_t;
+typedef struct {
+    uint8_t   table;
+    uint8_t   MODE;
+    uint64_t  ppn;
+    iohgatp_t iohgatp;
+    uint8_t   pid_valid;
+    uint32_t  device_id;
+    uint32_t  process_id;
+} pt_root_t;
+typedef struct {
+    table_violation_t *violations;
+    uint64_t           num_violations;
+    uint64_t           max_violations;
+    pt_root_t         *roots;
+    uint64_t           num_roots;
+    uint64_t           max_roots;
+    uint8_t            failed;
+} verify_results_t;
+typedef struct {
+    ddt_page_t       *pages;
+    uint64_t          num_pages;
+    pt_root_t        *roots;
+    uint64_t          num_roots;
+    uint32_t          id;
+    uint32_t          num_threads;
+    uint8_t           created;
+    verify_results_t  r;
+} verifier_t;
+
+static void *
+grow_array(
+    void *array, uint64_t *max, uint64_t num, size_t size) {
+    void *a;
+
+    if ( num < *max ) return array;
+    if ( (a = realloc(array, ((*max + 1024) * size))) == NULL ) return NULL;
+    *max += 1024;
+    return a;
+}
+static void
+report_violation(
+    verify_results_t *r, table_violation_t *v) {
+    table_violation_t *a;
+
+    if ( (a = grow_array(r->violations, &r->max_violations, r->num_violations,
+                         sizeof(table_violation_t))) == NULL ) {
+        r->failed = 1;
+        return;
+    }
+    r->violations = a;
+    r->violations[r->num_violations++] = *v;
+    return;
+}
+static void
+add_root(
+    verify_results_t *r, uint8_t table, uint8_t MODE, uint64_t ppn, iohgatp_t iohgatp,
+    table_violation_t *v) {
+    pt_root_t *a;
+
+    if ( (a = grow_array(r->roots, &r->max_roots, r->num_roots, sizeof(pt_root_t))) == NULL ) {
+        r->failed = 1;
+        return;
+    }
+    r->roots = a;
+    a = &r->roots[r->num_roots++];
+    a->table = table;
+    a->MODE = MODE;
+    a->ppn = ppn;
+    // Only the mode and the root of the G-stage are needed to translate the
+    // addresses of the VS-stage tables
+    a->iohgatp.raw = 0;
+    a->iohgatp.MODE = iohgatp.MODE;
+    a->iohgatp.PPN = iohgatp.PPN;
+    a->pid_valid = v->pid_valid;
+    a->device_id = v->device_id;
+    a->process_id = v->process_id;
+    return;
+}
+static int
+compare_roots(
+    const void *a, const void *b) {
+    const pt_root_t *x = a, *y = b;
+
+    if ( x->table != y->table ) return ( x->table < y->table ) ? -1 : 1;
+    if ( x->MODE != y->MODE ) return ( x->MODE < y->MODE ) ? -1 : 1;
+    if ( x->ppn != y->ppn ) return ( x->ppn < y->ppn ) ? -1 : 1;
+    if ( x->iohgatp.raw != y->iohgatp.raw ) return ( x->iohgatp.raw < y->iohgatp.raw ) ? -1 : 1;
+    if ( x->device_id != y->device_id ) return ( x->device_id < y->device_id ) ? -1 : 1;
+    if ( x->pid_valid != y->pid_valid ) return ( x->pid_valid < y->pid_valid ) ? -1 : 1;
+    if ( x->process_id != y->process_id ) return ( x->process_id < y->process_id ) ? -1 : 1;
+    return 0;
+}
+static int
+compare_violations(
+    const void *a, const void *b) {
+    const table_violation_t *x = a, *y = b;
+
+    if ( x->device_id != y->device_id ) return ( x->device_id < y->device_id ) ? -1 : 1;
+    if ( x->pid_valid != y->pid_valid ) return ( x->pid_valid < y->pid_valid ) ? -1 : 1;
+    if ( x->process_id != y->process_id ) return ( x->process_id < y->process_id ) ? -1 : 1;
+    if ( x->table != y->table ) return ( x->table < y->table ) ? -1 : 1;
+    if ( x->addr != y->addr ) return ( x->addr < y->addr ) ? -1 : 1;
+    if ( x->level != y->level ) return ( x->level > y->level ) ? -1 : 1;
+    return 0;
+}
+// Walk a process directory table at GPA a. The process_id holds the PDI
+// of the levels above.
+static void
+verify_pdt(
+    verify_results_t *r, device_context_t *DC, uint64_t a, uint8_t i, uint32_t process_id,
+    table_violation_t *v) {
+    process_context_t PC;
+    pdte_t pdte;
+    uint64_t gpa = a;
+    uint32_t j, num_entries;
+
+    v->table = VERIFY_PDT;
+    v->level = i;
+    v->pid_valid = 1;
+    v->process_id = process_id;
+    v->check = PTE_OK;
+    if ( translate_gpa(DC->iohgatp, a, &a) != 0 ) {
+        v->addr = gpa;
+        v->cause = 21;      // Read guest page fault
+        report_violation(r, v);
+        return;
+    }
+    num_entries = ( i == 0 ) ? 256 : (( i == 1 ) ? 512 : 8);
+    for ( j = 0; j < num_entries; j++ ) {
+        v->table = VERIFY_PDT;
+        v->level = i;
+        v->pid_valid = 1;
+        v->check = PTE_OK;
+        if ( i == 0 ) {
+            v->addr = a + (j * 16);
+            v->process_id = process_id | j;
+            if ( read_memory(v->addr, 16, (char *)&PC) != 0 ) {
+                v->cause = 265;     // PDT entry load access fault
+                report_violation(r, v);
+                return;
+            }
+            if ( PC.ta.V == 0 ) continue;
+            if ( is_pc_misconfigured(&PC) ) {
+                v->cause = 267;     // PDT entry misconfigured
+                report_violation(r, v);
+                continue;
+            }
+            if ( PC.fsc.iosatp.MODE != IOSATP_Bare )
+                add_root(r, VERIFY_S_STAGE, PC.fsc.iosatp.MODE, PC.fsc.iosatp.PPN,
+                         DC->iohgatp, v);
+            continue;
+        }
+        v->addr = a + (j * 8);
+        v->process_id = process_id | (j << (( i == 1 ) ? 8 : 17));
+        if ( read_memory(v->addr, 8, (char *)&pdte.raw) != 0 ) {
+            v->cause = 265;     // PDT entry load access fault
+            report_violation(r, v);
+            return;
+        }
+        if ( pdte.V == 0 ) continue;
+        if ( pdte.reserved0 != 0 || pdte.reserved1 != 0 ) {
+            v->cause = 267;     // PDT entry misconfigured
+            report_violation(r, v);
+            continue;
+        }
+        verify_pdt(r, DC, (pdte.PPN * PAGESIZE), (i - 1), v->process_id, v);
+    }
+    return;
+}
+// Verify the device contexts in a leaf DDT page and the process directory
+// tables they reference
+static void
+verify_ddt_page(
+    verify_results_t *r, ddt_page_t *page) {
+    device_context_t DC;
+    table_violation_t v;
+    uint8_t DC_SIZE;
+    uint8_t LEVELS;
+    uint32_t j;
+
+    DC_SIZE = ( g_reg_file.capabilities.msi_flat == 1 ) ? EXT_FORMAT_DC_SIZE : BASE_FORMAT_DC_SIZE;
+    for ( j = 0; j < (PAGESIZE / DC_SIZE); j++ ) {
+        memset(&v, 0, sizeof(v));
+        v.table = VERIFY_DDT;
+        v.device_id = page->device_id | j;
+        v.addr = (page->ppn * PAGESIZE) + (j * DC_SIZE);
+        memset(&DC, 0, sizeof(DC));
+        if ( read_memory(v.addr, DC_SIZE, (char *)&DC) != 0 ) {
+            v.cause = 257;      // DDT entry load access fault
+            report_violation(r, &v);
+            return;
+        }
+        if ( DC.tc.V == 0 ) continue;
+        if ( is_dc_misconfigured(&DC) ) {
+            v.cause = 259;      // DDT entry misconfigured
+            report_violation(r, &v);
+            continue;
+        }
+        if ( DC.iohgatp.MODE != IOHGATP_Bare )
+            add_root(r, VERIFY_G_STAGE, DC.iohgatp.MODE, DC.iohgatp.PPN, DC.iohgatp, &v);
+        if ( DC.tc.PDTV == 0 && DC.fsc.iosatp.MODE != IOSATP_Bare )
+            add_root(r, VERIFY_S_STAGE, DC.fsc.iosatp.MODE, DC.fsc.iosatp.PPN, DC.iohgatp, &v);
+        if ( DC.tc.PDTV == 1 && DC.fsc.pdtp.MODE != PDTP_Bare ) {
+            LEVELS = 1;
+            if ( DC.fsc.pdtp.MODE == PD20 ) LEVELS = 3;
+            if ( DC.fsc.pdtp.MODE == PD17 ) LEVELS = 2;
+            if ( DC.fsc.pdtp.MODE == PD8  ) LEVELS = 1;
+            verify_pdt(r, &DC, (DC.fsc.pdtp.PPN * PAGESIZE), (LEVELS - 1), 0, &v);
+        }
+    }
+    return;
+}
+// Walk the non-leaf levels of the DDT and collect the leaf DDT pages. The
+// device_id holds the DDI of the levels above.
+static void
+collect_ddt_pages(
+    verify_results_t *r, ddt_page_t **pages, uint64_t *num_pages, uint64_t *max_pages,
+    uint64_t ppn, uint8_t i, uint32_t device_id) {
+    table_violation_t v;
+    ddt_page_t *a;
+    ddte_t ddte;
+    uint32_t j, num_entries;
+    uint8_t shift;
+
+    if ( i == 0 ) {
+        if ( (a = grow_array(*pages, max_pages, *num_pages, sizeof(ddt_page_t))) == NULL ) {
+            r->failed = 1;
+            return;
+        }
+        *pages = a;
+        a[*num_pages].ppn = ppn;
+        a[*num_pages].device_id = device_id;
+        (*num_pages)++;
+        return;
+    }
+    if ( g_reg_file.capabilities.msi_flat == 0 )
+        shift = ( i == 1 ) ? 7 : 16;
+    else
+        shift = ( i == 1 ) ? 6 : 15;
+    num_entries = ( (24 - shift) < 9 ) ? (1 << (24 - shift)) : 512;
+    for ( j = 0; j < num_entries; j++ ) {
+        memset(&v, 0, sizeof(v));
+        v.table = VERIFY_DDT;
+        v.level = i;
+        v.device_id = device_id | (j << shift);
+        v.addr = (ppn * PAGESIZE) + (j * 8);
+        if ( read_memory(v.addr, 8, (char *)&ddte.raw) != 0 ) {
+            v.cause = 257;      // DDT entry load access fault
+            report_violation(r, &v);
+            return;
+        }
+        if ( ddte.V == 0 ) continue;
+        if ( ddte.reserved0 != 0 || ddte.reserved1 != 0 ) {
+            v.cause = 259;      // DDT entry misconfigured
+            report_violation(r, &v);
+            continue;
+        }
+        collect_ddt_pages(r, pages, num_pages, max_pages, ddte.PPN, (i - 1), v.device_id);
+    }
+    return;
+}
+// Sign extend the virtual address mapped by a S/VS-stage PTE
+static uint64_t
+canonical_va(
+    uint64_t va, uint8_t MODE) {
+    uint8_t va_bits;
+
+    va_bits = ( MODE == IOSATP_Sv57 ) ? 57 : (( MODE == IOSATP_Sv48 ) ? 48 : 39);
+    if ( MODE == IOSATP_Sv32 || ((va >> (va_bits - 1)) & 1) == 0 )
+        return va;
+    return va | ~((1UL << va_bits) - 1);
+}
+// Walk the S/VS-stage page table at SPA a. The va holds the VA mapped by
+// the levels above.
+static void
+verify_s_vs_table(
+    verify_results_t *r, pt_root_t *root, uint64_t a, uint8_t i, uint64_t va,
+    table_violation_t *v) {
+    uint64_t pa_mask = ((1UL << (g_reg_file.capabilities.pas)) - 1);
+    uint8_t PTESIZE, shift;
+    uint64_t next;
+    uint32_t j;
+    pte_t pte;
+
+    PTESIZE = ( root->MODE == IOSATP_Sv32 ) ? 4 : 8;
+    shift = ( root->MODE == IOSATP_Sv32 ) ? (12 + (10 * i)) : (12 + (9 * i));
+    for ( j = 0; j < (PAGESIZE / PTESIZE); j++ ) {
+        v->table = VERIFY_S_STAGE;
+        v->level = i;
+        v->addr = a + (j * PTESIZE);
+        v->va = canonical_va((va | ((uint64_t)j << shift)), root->MODE);
+        v->check = PTE_OK;
+        pte.raw = 0;
+        if ( (a & ~pa_mask) || read_memory(v->addr, PTESIZE, (char *)&pte.raw) != 0 ) {
+            v->cause = 5;       // Read access fault
+            report_violation(r, v);
+            return;
+        }
+        if ( pte.V == 0 ) continue;
+        if ( (v->check = check_s_vs_pte(pte, i, root->MODE)) != PTE_OK ) {
+            v->cause = 13;      // Read page fault
+            report_violation(r, v);
+            continue;
+        }
+        if ( pte.R == 1 || pte.X == 1 ) continue;
+        next = pte.PPN * PAGESIZE;
+        if ( translate_gpa(root->iohgatp, next, &next) != 0 ) {
+            v->addr = pte.PPN * PAGESIZE;
+            v->cause = 21;      // Read guest page fault
+            report_violation(r, v);
+            continue;
+        }
+        verify_s_vs_table(r, root, next, (i - 1), (va | ((uint64_t)j << shift)), v);
+    }
+    return;
+}
+// Walk the G-stage page table at SPA a. The gpa holds the GPA mapped by
+// the levels above.
+static void
+verify_g_table(
+    verify_results_t *r, pt_root_t *root, uint64_t a, uint8_t i, uint8_t LEVELS, uint64_t gpa,
+    table_violation_t *v) {
+    uint64_t pa_mask = ((1UL << (g_reg_file.capabilities.pas)) - 1);
+    uint8_t PTESIZE, shift;
+    uint32_t j, num_entries;
+    gpte_t gpte;
+
+    PTESIZE = ( root->MODE == IOHGATP_Sv32x4 ) ? 4 : 8;
+    shift = ( root->MODE == IOHGATP_Sv32x4 ) ? (12 + (10 * i)) : (12 + (9 * i));
+    // The root G-stage page table is 16 KiB
+    num_entries = PAGESIZE / PTESIZE;
+    if ( i == (LEVELS - 1) ) num_entries *= 4;
+    for ( j = 0; j < num_entries; j++ ) {
+        v->table = VERIFY_G_STAGE;
+        v->level = i;
+        v->addr = a + (j * PTESIZE);
+        v->va = gpa | ((uint64_t)j << shift);
+        v->check = PTE_OK;
+        gpte.raw = 0;
+        if ( (a & ~pa_mask) || read_memory(v->addr, PTESIZE, (char *)&gpte.raw) != 0 ) {
+            v->cause = 5;       // Read access fault
+            report_violation(r, v);
+            return;
+        }
+        if ( gpte.V == 0 ) continue;
+        if ( (v->check = check_g_pte(gpte, i, root->MODE)) != PTE_OK ) {
+            v->cause = 21;      // Read guest page fault
+            report_violation(r, v);
+            continue;
+        }
+        if ( gpte.R == 1 || gpte.X == 1 ) {
+            if ( (gpte.PPN * PAGESIZE) & ~pa_mask ) {
+                v->cause = 5;   // Read access fault
+                report_violation(r, v);
+            }
+            continue;
+        }
+        verify_g_table(r, root, (gpte.PPN * PAGESIZE), (i - 1), LEVELS, v->va, v);
+    }
+    return;
+}
+static void
+verify_page_table(
+    verify_results_t *r, pt_root_t *root) {
+    table_violation_t v;
+    uint8_t LEVELS;
+    uint64_t a;
+
+    memset(&v, 0, sizeof(v));
+    v.table = root->table;
+    v.pid_valid = root->pid_valid;
+    v.device_id = root->device_id;
+    v.process_id = root->process_id;
+    if ( root->table == VERIFY_G_STAGE ) {
+        LEVELS = 2;
+        if ( root->MODE == IOHGATP_Sv39x4 ) LEVELS = 3;
+        if ( root->MODE == IOHGATP_Sv48x4 ) LEVELS = 4;
+        if ( root->MODE == IOHGATP_Sv57x4 ) LEVELS = 5;
+        verify_g_table(r, root, (root->ppn * PAGESIZE), (LEVELS - 1), LEVELS, 0, &v);
+        return;
+    }
+    LEVELS = 2;
+    if ( root->MODE == IOSATP_Sv39 ) LEVELS = 3;
+    if ( root->MODE == IOSATP_Sv48 ) LEVELS = 4;
+    if ( root->MODE == IOSATP_Sv57 ) LEVELS = 5;
+    v.level = LEVELS - 1;
+    if ( translate_gpa(root->iohgatp, (root->ppn * PAGESIZE), &a) != 0 ) {
+        v.addr = root->ppn * PAGESIZE;
+        v.cause = 21;      // Read guest page fault
+        report_violation(r, &v);
+        return;
+    }
+    verify_s_vs_table(r, root, a, (LEVELS - 1), 0, &v);
+    return;
+}
+static void *
+verify_ddt_pages(
+    void *arg) {
+    verifier_t *w = (verifier_t *)arg;
+    uint64_t i;
+
+    for ( i = w->id; i < w->num_pages; i += w->num_threads )
+        verify_ddt_page(&w->r, &w->pages[i]);
+    return NULL;
+}
+static void *
+verify_page_tables(
+    void *arg) {
+    verifier_t *w = (verifier_t *)arg;
+    uint64_t i;
+
+    for ( i = w->id; i < w->num_roots; i += w->num_threads )
+        verify_page_table(&w->r, &w->roots[i]);
+    return NULL;
+}
+static void
+run_verifiers(
+    verifier_t *workers, pthread_t *threads, uint32_t num_threads, void *(*fn)(void *)) {
+    uint32_t i;
+
+    // The calling thread runs the first verifier
+    for ( i = 1; i < num_threads; i++ ) {
+        workers[i].created = 0;
+        if ( pthread_create(&threads[i], NULL, fn, &workers[i]) == 0 )
+            workers[i].created = 1;
+        else
+            fn(&workers[i]);
+    }
+    fn(&workers[0]);
+    for ( i = 1; i < num_threads; i++ )
+        if ( workers[i].created == 1 ) pthread_join(threads[i], NULL);
+    return;
+}
+// Verify the device directory table, the process directory tables and the
+// page tables reachable from the ddtp using up to num_threads threads.
+// Each page table is walked once and violations in it are reported against
+// the first device, and process, that references it. Up to max_violations
+// violations are returned sorted by device_id, process_id and address.
+// Returns the number of violations found or (uint64_t)-1 if memory could
+// not be allocated. The tables must not be modified till the function
+// returns.
+uint64_t
+verify_tables(
+    table_violation_t *violations, uint64_t max_violations, uint32_t num_threads) {
+    verify_results_t r;
+    ddt_page_t *pages = NULL;
+    uint64_t num_pages = 0, max_pages = 0;
+    pt_root_t *roots = NULL;
+    uint64_t num_roots = 0, max_roots = 0;
+    verifier_t *workers;
+    pthread_t *threads;
+    pt_root_t *a;
+    uint64_t i, j, num_violations;
+    uint8_t LEVELS;
+
+    memset(&r, 0, sizeof(r));
+    if ( g_reg_file.ddtp.iommu_mode != DDT_1LVL && g_reg_file.ddtp.iommu_mode != DDT_2LVL &&
+         g_reg_file.ddtp.iommu_mode != DDT_3LVL )
+        return 0;
+    if ( num_threads == 0 ) num_threads = 1;
+    threads = calloc(num_threads, sizeof(pthread_t));
+    workers = calloc(num_threads, sizeof(verifier_t));
+    if ( threads == NULL || workers == NULL ) {
+        r.failed = 1;
+        goto done;
+    }
+    LEVELS = 1;
+    if ( g_reg_file.ddtp.iommu_mode == DDT_3LVL ) LEVELS = 3;
+    if ( g_reg_file.ddtp.iommu_mode == DDT_2LVL ) LEVELS = 2;
+    collect_ddt_pages(&r, &pages, &num_pages, &max_pages, g_reg_file.ddtp.ppn, (LEVELS - 1), 0);
+    if ( r.failed == 1 ) goto done;
+
+    for ( i = 0; i < num_threads; i++ ) {
+        workers[i].pages = pages;
+        workers[i].num_pages = num_pages;
+        workers[i].id = i;
+        workers[i].num_threads = num_threads;
+    }
+    run_verifiers(workers, threads, num_threads, verify_ddt_pages);
+
+    // Walk each distinct page table once on behalf of its first referrer
+    for ( i = 0; i < num_threads; i++ ) {
+        for ( j = 0; j < workers[i].r.num_roots; j++ ) {
+            if ( (a = grow_array(roots, &max_roots, num_roots, sizeof(pt_root_t))) == NULL ) {
+                r.failed = 1;
+                goto done;
+            }
+            roots = a;
+            roots[num_roots++] = workers[i].r.roots[j];
+        }
+    }
+    if ( num_roots != 0 )
+        qsort(roots, num_roots, sizeof(pt_root_t), compare_roots);
+    for ( i = 0, j = 0; i < num_roots; i++ ) {
+        if ( j != 0 && roots[j - 1].table == roots[i].table &&
+             roots[j - 1].MODE == roots[i].MODE && roots[j - 1].ppn == roots[i].ppn &&
+             roots[j - 1].iohgatp.raw == roots[i].iohgatp.raw )
+            continue;
+        roots[j++] = roots[i];
+    }
+    num_roots = j;
+    for ( i = 0; i < num_threads; i++ ) {
+        workers[i].roots = roots;
+        workers[i].num_roots = num_roots;
+    }
+    run_verifiers(workers, threads, num_threads, verify_page_tables);
+
+    for ( i = 0; i < num_threads; i++ ) {
+        r.failed |= workers[i].r.failed;
+        for ( j = 0; j < workers[i].r.num_violations && r.failed == 0; j++ )
+            report_violation(&r, &workers[i].r.violations[j]);
+    }
+
+done:
+    num_violations = ( r.failed == 1 ) ? (uint64_t)-1 : r.num_violations;
+    if ( r.failed == 0 && r.num_violations != 0 ) {
+        qsort(r.violations, r.num_violations, sizeof(table_violation_t), compare_violations);
+        for ( i = 0; i < r.num_violations && i < max_violations; i++ )
+            violations[i] = r.violations[i];
+    }
+    for ( i = 0; workers != NULL && i < num_threads; i++ ) {
+        free(workers[i].r.violations);
+        free(workers[i].r.roots);
+    }
+    free(r.violations);
+    free(r.roots);
+    free(pages);
+    free(roots);
+    free(workers);
+    free(threads);
+    return num_violations;
+}
@@ -5,11 +5,13 @@
 
 #include <stdio.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "iommu.h"
 #include "tables_api.h"
 char *memory;
-uint64_t next_free_page;
-uint64_t next_free_gpage[65536];
 int8_t reset_system(uint8_t mem_gb, uint16_t num_vms);
 int8_t enable_cq(uint32_t nppn);
 int8_t enable_fq(uint32_t nppn);
@@ -17,17 +19,32 @@ int8_t enable_pq(uint32_t nppn);
 int8_t enable_iommu(uint8_t iommu_mode);
 void iodir(uint8_t f3, uint8_t DV, uint32_t DID, uint32_t PID);
 void iofence(uint8_t f3, uint8_t PR, uint8_t PW, uint8_t AV, uint8_t WIS_bit, uint64_t addr, uint32_t data);
+void ats_command(uint8_t f3, uint8_t DSV, uint8_t PV, uint32_t PID, uint8_t DSEG, uint16_t RID, uint64_t payload);
 void send_translation_request(uint32_t did, uint8_t pid_valid, uint32_t pid, uint8_t no_write,
              uint8_t exec_req, uint8_t priv_req, uint8_t is_cxl_dev, addr_type_t at, uint64_t iova,
              uint32_t length, uint8_t read_writeAMO, uint32_t msi_wr_data,
              hb_to_iommu_req_t *req, iommu_to_hb_rsp_t *rsp);
 int8_t check_rsp_and_faults(hb_to_iommu_req_t *req, iommu_to_hb_rsp_t *rsp, status_t status,
           uint16_t cause, uint64_t exp_iotval2);
-uint64_t get_free_gppn(uint64_t num_gppn, iohgatp_t iohgatp);
+int8_t check_pool_frees(uint8_t GV, uint16_t GSCID, page_pool_stats_t *prev, uint64_t num_ppns);
+int8_t build_test_tables(uint64_t base_ppn, uint64_t num_ppns, uint32_t num_threads);
 uint64_t access_viol_addr = -1;
 uint64_t data_corruption_addr = -1;
 uint8_t pr_go_requested = 0;
 uint8_t pw_go_requested = 0;
+ats_msg_t exp_msg;
+uint32_t num_msgs_sent = 0;
+uint64_t test_clock = 0;
+uint64_t test_clock_fn(void);
+iommu_msi_t test_msis[MAX_MSI_BATCH];
+uint32_t num_test_msis = 0;
+uint8_t test_wires[16];
+uint32_t num_wire_changes = 0;
+void test_send_msis(iommu_msi_t *msis, uint32_t num_msis);
+void test_set_wire(uint8_t vec, uint8_t level);
+void *trace_producer(void *arg);
+#define TRACE_PRODUCERS 4
+#define TRACE_PRODUCER_RECORDS 1000
 #define FOR_ALL_TRANSACTION_TYPES(at, pid_valid, exec_req, priv_req, no_write, code)\
     for ( at = 0; at < 3; at++ ) {\
         for ( pid_valid = 0; pid_valid < 2; pid_valid++ ) {\
@@ -56,6 +73,50 @@ main(void) {
     ddtp_t ddtp;
     gpte_t gpte;
     fqcsr_t fqcsr;
+    fqb_t fqb;
+    fault_rec_t fault_rec;
+    pqb_t pqb;
+    iohpmevt_t iohpmevt;
+    iocountovf_t iocountovf;
+    ipsr_t ipsr;
+    trace_rec_t trace_ring[8], trace_recs[16], *mp_ring, *mp_recs;
+    pthread_t producers[TRACE_PRODUCERS];
+    uint64_t next_d0[TRACE_PRODUCERS];
+    tr_req_ctrl_t tr_req_ctrl;
+    tr_response_t tr_response;
+    dbg_tr_req_t dbg_reqs[4];
+    tr_response_t dbg_rsps[4];
+    icvec_t icvec;
+    imod_t imod;
+    iommu_intr_sink_t sink;
+    pte_t pte;
+    int64_t num_tables;
+    command_t inv_cmds[4];
+    iotinval_batch_t inv;
+    page_pool_stats_t ppn_stats, gppn_stats;
+    uint64_t ppns[4];
+    char *image;
+    char image_path[] = "/tmp/iommu_imageXXXXXX";
+    struct stat st;
+    int fd;
+    iohgatp_t iohgatp;
+    iosatp_t iosatp;
+    process_context_t PC;
+    table_violation_t violations[8], violations_1[8];
+    uint32_t cause;
+    char rec_path[] = "/tmp/iommu_recXXXXXX";
+    rec_reader_t rec_reader;
+    rec_t rec, rec_1;
+    uint64_t num_ok, ppn_sum, start_clock;
+    uint32_t num_events;
+#ifdef IOMMU_COST_STATS
+    cost_hist_t cost;
+    char json[1024];
+    FILE *fp;
+#endif
+    pqcsr_t pqcsr;
+    page_rec_t prec;
+    ats_msg_t pr[6];
     cqcsr_t cqcsr;
     cqb_t cqb;
     cqt_t cqt;
@@ -73,7 +134,7 @@ main(void) {
     cap.amo = cap.ats = cap.t2gpa = cap.hpm = cap.msi_flat = cap.msi_mrif = 1;
     cap.dbg = 1;
     cap.pas = 50;
-    if ( reset_iommu(8, 40, 0xff, 4, Off, cap, fctrl) < 0 ) return -1;
+    if ( reset_iommu(8, 40, 0x7fff, 4, Off, cap, fctrl) < 0 ) return -1;
 
     // When Fault queue is not enabled, no logging should occur
     pid_valid = exec_req = priv_req = no_write = 1;
@@ -631,7 +692,1172 @@ main(void) {
     }
     printf("PASS\n");
 
+    printf("Test 9: ATS invalidation ITAG tracking:");
+    // Use up all ITAGs - the last invalidation request stalls for an ITAG
+    num_msgs_sent = 0;
+    for ( i = 0; i < MAX_ITAGS + 1; i++ ) {
+        ats_command(INVAL, 0, 0, 0, 0, 0x2345, (i << 12));
+        if ( i < MAX_ITAGS && (num_msgs_sent != (i + 1) || exp_msg.TAG != i ||
+             exp_msg.MSGCODE != INVAL_REQ_MSG_CODE) ) return -1;
+    }
+    if ( num_msgs_sent != MAX_ITAGS ) return -1;
+    if ( any_ats_invalidation_requests_pending() != 1 ) return -1;
+    // IOFENCE must wait for the invalidations to complete
+    iofence_data = 0x1234567812345678;
+    write_memory((char *)&iofence_data, (iofence_PPN * PAGESIZE), 8);
+    iofence(IOFENCE_C, 0, 0, 1, 0, (iofence_PPN * PAGESIZE), 0xDEADBEEF);
+    if ( (read_register(CQH_OFFSET, 4) + 1) != read_register(CQT_OFFSET, 4) ) return -1;
+    // Completion from a unexpected requester
+    exp_msg.MSGCODE = INVAL_COMPL_MSG_CODE;
+    exp_msg.RID = 0x2346;
+    exp_msg.DSV = 0;
+    exp_msg.PAYLOAD = (1UL << 32) | 0xFFFFFFFF;
+    if ( handle_invalidation_completion(&exp_msg) != 1 ) return -1;
+    // Complete all ITAGs - frees up an ITAG for the stalled request. The
+    // stalled request is resumed when the commands are next processed.
+    exp_msg.RID = 0x2345;
+    if ( handle_invalidation_completion(&exp_msg) != 0 ) return -1;
+    if ( num_msgs_sent != MAX_ITAGS ) return -1;
+    process_commands();
+    if ( num_msgs_sent != (MAX_ITAGS + 1) || exp_msg.TAG != 0 ) return -1;
+    // The IOFENCE is now fetched and waits for the ITAG 0 completion
+    process_commands();
+    if ( (read_register(CQH_OFFSET, 4) + 1) != read_register(CQT_OFFSET, 4) ) return -1;
+    // Completion for an ITAG that is not busy
+    exp_msg.MSGCODE = INVAL_COMPL_MSG_CODE;
+    exp_msg.RID = 0x2345;
+    exp_msg.PAYLOAD = (2UL << 32) | 0x2;
+    if ( handle_invalidation_completion(&exp_msg) != 1 ) return -1;
+    // ITAG 0 expects two completions
+    exp_msg.PAYLOAD = (2UL << 32) | 0x1;
+    if ( handle_invalidation_completion(&exp_msg) != 0 ) return -1;
+    if ( any_ats_invalidation_requests_pending() != 1 ) return -1;
+    if ( handle_invalidation_completion(&exp_msg) != 0 ) return -1;
+    if ( any_ats_invalidation_requests_pending() != 0 ) return -1;
+    // The IOFENCE completes when the commands are next processed
+    if ( (read_register(CQH_OFFSET, 4) + 1) != read_register(CQT_OFFSET, 4) ) return -1;
+    process_commands();
+    if ( read_register(CQH_OFFSET, 4) != read_register(CQT_OFFSET, 4) ) return -1;
+    read_memory((iofence_PPN * PAGESIZE), 8, (char *)&iofence_data);
+    if ( iofence_data != 0x12345678DEADBEEF )  return -1;
+    printf("PASS\n");
+
+    printf("Test 10: ATS invalidation timeout:");
+    iommu_set_ats_inv_req_timeout(100);
+    ats_command(INVAL, 0, 0, 0, 0, 0x2345, 0);
+    iommu_advance_clock(50);
+    ats_command(INVAL, 0, 0, 0, 0, 0x2345, 0);
+    iofence(IOFENCE_C, 0, 0, 0, 0, 0, 0);
+    if ( (read_register(CQH_OFFSET, 4) + 1) != read_register(CQT_OFFSET, 4) ) return -1;
+    // First request times out - IOFENCE waits for the second
+    iommu_advance_clock(60);
+    if ( any_ats_invalidation_requests_pending() != 1 ) return -1;
+    cqcsr.raw = read_register(CQCSR_OFFSET, 4);
+    if ( cqcsr.cmd_to != 0 ) return -1;
+    // Second request times out - IOFENCE reports the timeout
+    iommu_advance_clock(1000);
+    if ( any_ats_invalidation_requests_pending() != 0 ) return -1;
+    cqcsr.raw = read_register(CQCSR_OFFSET, 4);
+    if ( cqcsr.cmd_to != 1 ) return -1;
+    if ( (read_register(CQH_OFFSET, 4) + 1) != read_register(CQT_OFFSET, 4) ) return -1;
+    // Clear the timeout - the IOFENCE now completes
+    write_register(CQCSR_OFFSET, 4, cqcsr.raw);
+    process_commands();
+    if ( read_register(CQH_OFFSET, 4) != read_register(CQT_OFFSET, 4) ) return -1;
+    // Completed requests do not time out
+    ats_command(INVAL, 0, 0, 0, 0, 0x2345, 0);
+    exp_msg.MSGCODE = INVAL_COMPL_MSG_CODE;
+    exp_msg.PAYLOAD = (1UL << 32) | (1UL << exp_msg.TAG);
+    if ( handle_invalidation_completion(&exp_msg) != 0 ) return -1;
+    iommu_advance_clock(1000);
+    iofence(IOFENCE_C, 0, 0, 0, 0, 0, 0);
+    cqcsr.raw = read_register(CQCSR_OFFSET, 4);
+    if ( cqcsr.cmd_to != 0 ) return -1;
+    if ( read_register(CQH_OFFSET, 4) != read_register(CQT_OFFSET, 4) ) return -1;
+    iommu_set_ats_inv_req_timeout(0);
+    printf("PASS\n");
+
+    printf("Test 11: Fault record write combining:");
+    if ( iommu_set_fault_write_combining(3) != 1 ) return -1;
+    if ( iommu_set_fault_write_combining(4) != 0 ) return -1;
+    j = read_register(FQT_OFFSET, 4);
+    for ( i = 0; i < 8; i++ ) {
+        send_translation_request(0x7F0000, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 (0x1000 * i), 16, READ, 0, &req, &rsp);
+        if ( rsp.status != UNSUPPORTED_REQUEST ) return -1;
+        // fqt advances only when a aligned burst of 4 records is written
+        if ( read_register(FQT_OFFSET, 4) != ((j + i + 1) & ~3) &&
+             read_register(FQT_OFFSET, 4) != j ) return -1;
+        if ( ((j + i + 1) & 3) == 0 && read_register(FQT_OFFSET, 4) != (j + i + 1) ) return -1;
+    }
+    flush_fault_queue();
+    if ( read_register(FQT_OFFSET, 4) != (j + 8) ) return -1;
+    for ( i = 0; i < 8; i++ ) {
+        req.tr.iova = 0x1000 * i;
+        if ( check_rsp_and_faults(&req, &rsp, UNSUPPORTED_REQUEST, 258, 0) < 0 ) return -1;
+    }
+    // Align the tail to a burst boundary and discard the records
+    while ( read_register(FQT_OFFSET, 4) & 3 )
+        send_translation_request(0x7F0000, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 0, 16, READ, 0, &req, &rsp);
+    j = read_register(FQT_OFFSET, 4);
+    write_register(FQH_OFFSET, 4, j);
+    // A memory fault when writing the burst discards the records from
+    // the faulting one
+    for ( i = 0; i < 3; i++ ) {
+        send_translation_request(0x7F0000, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 (0x1000 * i), 16, READ, 0, &req, &rsp);
+    }
+    if ( read_register(FQT_OFFSET, 4) != j ) return -1;
+    fqb.raw = read_register(FQB_OFFSET, 8);
+    access_viol_addr = (fqb.ppn * PAGESIZE) | (j * 32);
+    flush_fault_queue();
+    fqcsr.raw = read_register(FQCSR_OFFSET, 4);
+    if ( fqcsr.fqmf != 1 ) return -1;
+    if ( read_register(FQT_OFFSET, 4) != j ) return -1;
+    access_viol_addr = -1;
+    write_register(FQCSR_OFFSET, 4, fqcsr.raw);
+    // The queue is full when fqt is one behind fqh, also when fqh is 0.
+    // Advance fqt to 4 records short of the end of the queue and make the
+    // entries before it unread.
+    j = (1UL << (fqb.log2szm1 + 1)) - 1;
+    while ( read_register(FQT_OFFSET, 4) != (j - 3) ) {
+        write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+        send_translation_request(0x7F0000, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 0, 16, READ, 0, &req, &rsp);
+    }
+    write_register(FQH_OFFSET, 4, 0);
+    for ( i = 0; i < 4; i++ )
+        send_translation_request(0x7F0000, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 0, 16, READ, 0, &req, &rsp);
+    fqcsr.raw = read_register(FQCSR_OFFSET, 4);
+    if ( fqcsr.fqof != 1 || read_register(FQT_OFFSET, 4) != j ) return -1;
+    write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+    write_register(FQCSR_OFFSET, 4, fqcsr.raw);
+    if ( iommu_set_fault_write_combining(0) != 0 ) return -1;
+    // Wrap the tail to the start of the queue for the tests that follow
+    send_translation_request(0x7F0000, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0, 16, READ, 0, &req, &rsp);
+    if ( read_register(FQT_OFFSET, 4) != 0 ) return -1;
+    write_register(FQH_OFFSET, 4, 0);
+    printf("PASS\n");
+
+    printf("Test 12: Fault suppression:");
+    write_register(FSUPP_CTRL_OFFSET, 8, (100UL << 16) | 1);
+    write_register(FSUPP_COUNT_OFFSET, 8, 0);
+    j = read_register(FQT_OFFSET, 4);
+    for ( i = 0; i < 5; i++ ) {
+        send_translation_request(0x7F0000, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 0x1000 + (i * 8), 16, READ, 0, &req, &rsp);
+        if ( rsp.status != UNSUPPORTED_REQUEST ) return -1;
+    }
+    // A different page is not suppressed
+    send_translation_request(0x7F0000, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x2000, 16, READ, 0, &req, &rsp);
+    if ( read_register(FQT_OFFSET, 4) != (j + 2) ) return -1;
+    if ( read_register(FSUPP_COUNT_OFFSET, 8) != 4 ) return -1;
+    req.tr.iova = 0x1000;
+    if ( check_rsp_and_faults(&req, &rsp, UNSUPPORTED_REQUEST, 258, 0) < 0 ) return -1;
+    req.tr.iova = 0x2000;
+    if ( check_rsp_and_faults(&req, &rsp, UNSUPPORTED_REQUEST, 258, 0) < 0 ) return -1;
+    // Past the window the fault is reported with the count of suppressed faults
+    iommu_advance_clock(100);
+    send_translation_request(0x7F0000, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 16, READ, 0, &req, &rsp);
+    if ( read_register(FQT_OFFSET, 4) != (j + 3) ) return -1;
+    fqb.raw = read_register(FQB_OFFSET, 8);
+    read_memory(((fqb.ppn * PAGESIZE) | ((j + 2) * 32)), 32, (char *)&fault_rec);
+    if ( fault_rec.custom != 4 ) return -1;
+    if ( check_rsp_and_faults(&req, &rsp, UNSUPPORTED_REQUEST, 258, 0) < 0 ) return -1;
+    write_register(FSUPP_CTRL_OFFSET, 8, 0);
+    printf("PASS\n");
+
+    printf("Test 13: Batched page requests:");
+    add_device(0x000100, 0, 1, 1, 0, 0, 0, IOHGATP_Bare, IOSATP_Bare, PDTP_Bare,
+               MSIPTP_Bare, 0, 0, 0);
+    memset(pr, 0, sizeof(pr));
+    for ( i = 0; i < 6; i++ ) {
+        pr[i].MSGCODE = PAGE_REQ_MSG_CODE;
+        pr[i].RID = 0x0100;
+        // Read requests of PRG 5 and PRG 2 interleaved with the last of each
+        // PRG marked
+        pr[i].PAYLOAD = ((0x1000UL * i) << 12) | (((i & 1) ? 2 : 5) << 3) | 1;
+    }
+    pr[4].PAYLOAD |= 4;
+    pr[5].PAYLOAD |= 4;
+    // A request from a device with no device context
+    pr[1].RID = 0x7F00;
+    pr[1].DSV = 1;
+    pr[1].DSEG = 0xFF;
+    pr[1].PAYLOAD |= 4;
+    num_msgs_sent = 0;
+    fqcsr.raw = read_register(FQCSR_OFFSET, 4);
+    j = read_register(PQT_OFFSET, 4);
+    handle_page_requests(pr, 6);
+    if ( read_register(PQT_OFFSET, 4) != (j + 5) ) return -1;
+    // Response Failure for the request with no device context
+    if ( num_msgs_sent != 1 || exp_msg.MSGCODE != PRGR_MSG_CODE ) return -1;
+    if ( get_bits(15, 12, exp_msg.PAYLOAD) != RESPONSE_FAILURE ) return -1;
+    write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+    // Records of PRG 2 precede PRG 5 and each PRG retains its order
+    pqb.raw = read_register(PQB_OFFSET, 8);
+    for ( i = 0; i < 5; i++ ) {
+        read_memory(((pqb.ppn * PAGESIZE) | ((j + i) * 16)), 16, (char *)&prec);
+        if ( prec.DID != 0x100 ) return -1;
+        if ( prec.PAYLOAD != pr[(i < 2) ? (3 + (i * 2)) : ((i - 2) * 2)].PAYLOAD ) return -1;
+    }
+    // A Stop Marker is not moved ahead of an earlier request with a larger
+    // PRGI and the request after it is not moved ahead of it
+    for ( i = 0; i < 3; i++ ) {
+        pr[i].RID = 0x0100;
+        pr[i].DSV = 0;
+    }
+    pr[0].PAYLOAD = (0x1000UL << 12) | (7 << 3) | 1;
+    pr[1].PAYLOAD = (3 << 3) | 4;
+    pr[2].PAYLOAD = (0x2000UL << 12) | (3 << 3) | 5;
+    j = read_register(PQT_OFFSET, 4);
+    handle_page_requests(pr, 3);
+    if ( read_register(PQT_OFFSET, 4) != (j + 3) ) return -1;
+    for ( i = 0; i < 3; i++ ) {
+        read_memory(((pqb.ppn * PAGESIZE) | ((j + i) * 16)), 16, (char *)&prec);
+        if ( prec.PAYLOAD != pr[i].PAYLOAD ) return -1;
+    }
+    // Overflow - only two more requests fit in the queue
+    j = read_register(PQT_OFFSET, 4);
+    write_register(PQH_OFFSET, 4, (j + 3) & 0x3FF);
+    for ( i = 0; i < 4; i++ ) {
+        pr[i].RID = 0x0100;
+        pr[i].DSV = 0;
+        pr[i].PAYLOAD = ((0x1000UL * i) << 12) | (i << 3) | 4;
+    }
+    num_msgs_sent = 0;
+    handle_page_requests(pr, 4);
+    if ( read_register(PQT_OFFSET, 4) != ((j + 2) & 0x3FF) ) return -1;
+    pqcsr.raw = read_register(PQCSR_OFFSET, 4);
+    if ( pqcsr.pqof != 1 ) return -1;
+    // The requests that overflowed are responded to with Success
+    if ( num_msgs_sent != 2 || get_bits(15, 12, exp_msg.PAYLOAD) != SUCCESS ) return -1;
+    write_register(PQCSR_OFFSET, 4, pqcsr.raw);
+    write_register(PQH_OFFSET, 4, read_register(PQT_OFFSET, 4));
+    printf("PASS\n");
+
+    printf("Test 14: HPM event counting:");
+    // Counter 1 counts untranslated requests from devices 0x100-0x107
+    iohpmevt.raw = 0;
+    iohpmevt.eventID = UNTRANSLATED_REQUEST;
+    iohpmevt.dv_gscv = 1;
+    iohpmevt.dmask = 1;
+    iohpmevt.did_gscid = 0x000103;
+    write_register(IOHPMEVT1_OFFSET, 8, iohpmevt.raw);
+    // Counter 2 counts all untranslated requests
+    iohpmevt.raw = 0;
+    iohpmevt.eventID = UNTRANSLATED_REQUEST;
+    write_register(IOHPMEVT2_OFFSET, 8, iohpmevt.raw);
+    // Counter 3 counts all untranslated requests but is inhibited
+    write_register(IOHPMEVT3_OFFSET, 8, iohpmevt.raw);
+    write_register(IOCNTINH_OFFSET, 4, (1 << 3));
+    for ( i = 1; i <= 3; i++ )
+        write_register(IOHPMCTR1_OFFSET + ((i - 1) * 8), 8, 0);
+    send_translation_request(0x000100, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( rsp.status != SUCCESS ) return -1;
+    send_translation_request(0x000200, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+    if ( read_register(IOHPMCTR1_OFFSET, 8) != 1 ) return -1;
+    if ( read_register(IOHPMCTR2_OFFSET, 8) != 2 ) return -1;
+    if ( read_register(IOHPMCTR3_OFFSET, 8) != 0 ) return -1;
+    // Uninhibit counter 3 and stop counter 2
+    write_register(IOCNTINH_OFFSET, 4, 0);
+    write_register(IOHPMEVT2_OFFSET, 8, 0);
+    send_translation_request(0x000107, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+    if ( read_register(IOHPMCTR1_OFFSET, 8) != 2 ) return -1;
+    if ( read_register(IOHPMCTR2_OFFSET, 8) != 2 ) return -1;
+    if ( read_register(IOHPMCTR3_OFFSET, 8) != 1 ) return -1;
+    // Translated requests are not counted by these counters
+    send_translation_request(0x000100, 0, 0, 0, 0, 0, 0, ADDR_TYPE_TRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+    if ( read_register(IOHPMCTR1_OFFSET, 8) != 2 ) return -1;
+    if ( read_register(IOHPMCTR3_OFFSET, 8) != 1 ) return -1;
+    for ( i = 1; i <= 3; i++ )
+        write_register(IOHPMEVT1_OFFSET + ((i - 1) * 8), 8, 0);
+    printf("PASS\n");
+
+    printf("Test 15: HPM cycles counter:");
+    write_register(IOHPMCYCLES_OFFSET, 8, 0);
+    iommu_advance_clock(100);
+    if ( read_register(IOHPMCYCLES_OFFSET, 8) != 100 ) return -1;
+    // Inhibited cycles are not counted
+    write_register(IOCNTINH_OFFSET, 4, 1);
+    iommu_advance_clock(50);
+    if ( read_register(IOHPMCYCLES_OFFSET, 8) != 100 ) return -1;
+    write_register(IOCNTINH_OFFSET, 4, 0);
+    iommu_advance_clock(50);
+    if ( read_register(IOHPMCYCLES_OFFSET, 8) != 150 ) return -1;
+    // Overflow interrupt is generated when the clock reaches the overflow
+    ipsr.raw = 0;
+    ipsr.pmip = 1;
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    write_register(IOHPMCYCLES_OFFSET, 8, (1UL << 40) - 10);
+    iommu_advance_clock(9);
+    ipsr.raw = read_register(IPSR_OFFSET, 4);
+    if ( ipsr.pmip != 0 ) return -1;
+    iommu_advance_clock(11);
+    ipsr.raw = read_register(IPSR_OFFSET, 4);
+    if ( ipsr.pmip != 1 ) return -1;
+    iocountovf.raw = read_register(IOCNTOVF_OFFSET, 4);
+    if ( iocountovf.cy != 1 ) return -1;
+    if ( read_register(IOHPMCYCLES_OFFSET, 8) != ((1UL << 63) | 10) ) return -1;
+    ipsr.raw = 0;
+    ipsr.pmip = 1;
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    // Cycles counted against an embedder clock source
+    test_clock = 1000;
+    iommu_set_hpm_cycles_clock(test_clock_fn);
+    write_register(IOHPMCYCLES_OFFSET, 8, 0);
+    test_clock += 25;
+    iommu_advance_clock(1000);
+    if ( read_register(IOHPMCYCLES_OFFSET, 8) != 25 ) return -1;
+    iommu_set_hpm_cycles_clock(NULL);
+    iommu_advance_clock(5);
+    if ( read_register(IOHPMCYCLES_OFFSET, 8) != 30 ) return -1;
+    write_register(IOCNTINH_OFFSET, 4, 1);
+    printf("PASS\n");
+
+    printf("Test 16: Custom HPM events:");
+    iohpmevt.raw = 0;
+    iohpmevt.eventID = DDT_CACHE_MISS;
+    iohpmevt.dv_gscv = 1;
+    iohpmevt.did_gscid = 0x000100;
+    write_register(IOHPMEVT1_OFFSET, 8, iohpmevt.raw);
+    if ( read_register(IOHPMEVT1_OFFSET, 8) != iohpmevt.raw ) return -1;
+    iohpmevt.eventID = DDT_CACHE_HIT;
+    write_register(IOHPMEVT2_OFFSET, 8, iohpmevt.raw);
+    iohpmevt.raw = 0;
+    iohpmevt.eventID = FAULTS_WRITTEN;
+    write_register(IOHPMEVT3_OFFSET, 8, iohpmevt.raw);
+    write_register(IOCNTINH_OFFSET, 4, 0);
+    for ( i = 1; i <= 3; i++ )
+        write_register(IOHPMCTR1_OFFSET + ((i - 1) * 8), 8, 0);
+    iodir(INVAL_DDT, 1, 0x000100, 0);
+    for ( i = 0; i < 2; i++ ) {
+        send_translation_request(0x000100, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 0x1000, 8, READ, 0, &req, &rsp);
+        if ( rsp.status != SUCCESS ) return -1;
+    }
+    if ( read_register(IOHPMCTR1_OFFSET, 8) != 1 ) return -1;
+    if ( read_register(IOHPMCTR2_OFFSET, 8) != 1 ) return -1;
+    if ( read_register(IOHPMCTR3_OFFSET, 8) != 0 ) return -1;
+    // Faults reported for a device with no device context
+    send_translation_request(0x000200, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+    if ( read_register(IOHPMCTR1_OFFSET, 8) != 1 ) return -1;
+    if ( read_register(IOHPMCTR3_OFFSET, 8) != 1 ) return -1;
+    for ( i = 1; i <= 3; i++ )
+        write_register(IOHPMEVT1_OFFSET + ((i - 1) * 8), 8, 0);
+    write_register(IOCNTINH_OFFSET, 4, 1);
+    printf("PASS\n");
+
+#ifdef IOMMU_COST_STATS
+    printf("Test 17: Translation cost statistics:");
+    iommu_clear_cost_stats();
+    iodir(INVAL_DDT, 1, 0x000100, 0);
+    for ( i = 0; i < 2; i++ ) {
+        send_translation_request(0x000100, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 0x1000, 8, READ, 0, &req, &rsp);
+        if ( rsp.status != SUCCESS ) return -1;
+    }
+    // Two DDT entries and the device context are read by the first request
+    if ( iommu_get_ttyp_cost(UNTRANSLATED_READ_TRANSACTION, &cost) != 0 ) return -1;
+    if ( cost.requests != 2 || cost.mem_reads != 3 || cost.g_walks != 0 ) return -1;
+    if ( cost.hist[0] != 1 || cost.hist[2] != 1 ) return -1;
+    if ( iommu_get_device_cost(0x000100, &cost) != 0 ) return -1;
+    if ( cost.requests != 2 || cost.hist[0] != 1 || cost.hist[2] != 1 ) return -1;
+    if ( iommu_get_device_cost(0x000999, &cost) != 1 ) return -1;
+    memset(json, 0, sizeof(json));
+    fp = fmemopen(json, sizeof(json) - 1, "w");
+    iommu_dump_cost_stats(fp);
+    fclose(fp);
+    if ( strstr(json, "\"0x000100\": {\"requests\": 2, \"mem_reads\": 3") == NULL ) return -1;
+    printf("PASS\n");
+#endif
+
+    printf("Test 18: Trace ring:");
+    if ( iommu_trace_init(trace_ring, 6, TRACE_ALL) != 1 ) return -1;
+    if ( iommu_trace_init(trace_ring, 8, TRACE_ALL) != 0 ) return -1;
+    iodir(INVAL_DDT, 1, 0x000100, 0);
+    send_translation_request(0x000100, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    send_translation_request(0x000200, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x2000, 8, READ, 0, &req, &rsp);
+    write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+    if ( iommu_trace_drain(trace_recs, 1) != 1 ) return -1;
+    if ( trace_recs[0].type != TRACE_COMMAND || trace_recs[0].a != IODIR ||
+         trace_recs[0].b != INVAL_DDT ) return -1;
+    if ( iommu_trace_drain(trace_recs, 8) != 5 ) return -1;
+    if ( trace_recs[0].type != TRACE_REQUEST || trace_recs[0].device_id != 0x100 ||
+         trace_recs[0].d0 != 0x1000 ) return -1;
+    if ( trace_recs[1].type != TRACE_RESULT || trace_recs[1].a != SUCCESS ||
+         trace_recs[1].d0 != 0x1000 ) return -1;
+    if ( trace_recs[2].type != TRACE_REQUEST || trace_recs[2].device_id != 0x200 ) return -1;
+    if ( trace_recs[3].type != TRACE_FAULT || trace_recs[3].device_id != 0x200 ||
+         trace_recs[3].a != UNTRANSLATED_READ_TRANSACTION ) return -1;
+    if ( trace_recs[4].type != TRACE_RESULT || trace_recs[4].a != UNSUPPORTED_REQUEST ) return -1;
+    if ( iommu_trace_dropped() != 0 ) return -1;
+    // Records are dropped when the ring is full
+    for ( i = 0; i < 5; i++ )
+        send_translation_request(0x000100, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 0x1000, 8, READ, 0, &req, &rsp);
+    if ( iommu_trace_dropped() != 2 ) return -1;
+    if ( iommu_trace_drain(trace_recs, 16) != 8 ) return -1;
+    // Records produced by concurrent producers are each drained once and
+    // in the order produced by each producer
+    mp_ring = malloc(4096 * sizeof(trace_rec_t));
+    mp_recs = malloc(4096 * sizeof(trace_rec_t));
+    if ( mp_ring == NULL || mp_recs == NULL ) return -1;
+    if ( iommu_trace_init(mp_ring, 4096, TRACE_ALL) != 0 ) return -1;
+    for ( i = 0; i < TRACE_PRODUCERS; i++ )
+        if ( pthread_create(&producers[i], NULL, trace_producer, (void *)(uintptr_t)i) != 0 )
+            return -1;
+    for ( i = 0; i < TRACE_PRODUCERS; i++ ) {
+        pthread_join(producers[i], NULL);
+        next_d0[i] = 0;
+    }
+    if ( iommu_trace_drain(mp_recs, 4096) != (TRACE_PRODUCERS * TRACE_PRODUCER_RECORDS) ||
+         iommu_trace_dropped() != 0 ) return -1;
+    for ( i = 0; i < (TRACE_PRODUCERS * TRACE_PRODUCER_RECORDS); i++ ) {
+        j = mp_recs[i].device_id;
+        if ( j >= TRACE_PRODUCERS || mp_recs[i].d0 != next_d0[j] ) return -1;
+        next_d0[j]++;
+    }
+    free(mp_ring);
+    free(mp_recs);
+    if ( iommu_trace_init(NULL, 0, 0) != 0 ) return -1;
+    send_translation_request(0x000100, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( iommu_trace_drain(trace_recs, 16) != 0 ) return -1;
+    printf("PASS\n");
+
+    printf("Test 19: Register access descriptors:");
+    // 4B writes to each half of a 8B register
+    write_register(FSUPP_CTRL_OFFSET, 8, 0);
+    write_register(FSUPP_CTRL_OFFSET + 4, 4, 0x12345678);
+    if ( read_register(FSUPP_CTRL_OFFSET, 8) != 0x1234567800000000 ) return -1;
+    write_register(FSUPP_CTRL_OFFSET, 4, 0xFFFFFFFF);
+    if ( read_register(FSUPP_CTRL_OFFSET, 8) != 0x12345678FFFF0001 ) return -1;
+    if ( read_register(FSUPP_CTRL_OFFSET + 4, 4) != 0x12345678 ) return -1;
+    write_register(FSUPP_CTRL_OFFSET, 8, 0);
+    // Read-only registers are not written
+    i = read_register(CQH_OFFSET, 4);
+    write_register(CQH_OFFSET, 4, i + 1);
+    if ( read_register(CQH_OFFSET, 4) != i ) return -1;
+    // Accesses that span registers or to reserved offsets are not valid
+    if ( read_register(CQH_OFFSET, 8) != 0xFFFFFFFFFFFFFFFF ) return -1;
+    if ( read_register(RESERVED_OFFSET, 4) != 0xFFFFFFFFFFFFFFFF ) return -1;
+    // Writable bits of the queue index follow the size of the queue
+    cqcsr.raw = read_register(CQCSR_OFFSET, 4);
+    cqcsr.cqen = 0;
+    write_register(CQCSR_OFFSET, 4, cqcsr.raw);
+    cqb.raw = read_register(CQB_OFFSET, 8);
+    temp = cqb.raw;
+    cqb.log2szm1 = 1;
+    write_register(CQB_OFFSET, 8, cqb.raw);
+    write_register(CQT_OFFSET, 4, 0xFF);
+    if ( read_register(CQT_OFFSET, 4) != 0x3 ) return -1;
+    write_register(CQB_OFFSET, 8, temp);
+    cqcsr.cqen = 1;
+    write_register(CQCSR_OFFSET, 4, cqcsr.raw);
+    printf("PASS\n");
+
+    printf("Test 20: Debug translation interface:");
+    iodir(INVAL_DDT, 1, 0x000100, 0);
+    // A non-caching translation does not fill the IOATC
+    write_register(TR_REQ_IOVA_OFFSET, 8, 0x5000);
+    tr_req_ctrl.raw = 0;
+    tr_req_ctrl.DID = 0x000100;
+    tr_req_ctrl.RWn = 1;
+    tr_req_ctrl.NoCache = 1;
+    tr_req_ctrl.go_busy = 1;
+    write_register(TR_REQ_CTRL_OFFSET, 8, tr_req_ctrl.raw);
+    tr_req_ctrl.raw = read_register(TR_REQ_CTRL_OFFSET, 8);
+    if ( tr_req_ctrl.go_busy != 0 || tr_req_ctrl.NoCache != 1 ) return -1;
+    tr_response.raw = read_register(TR_RESPONSE_OFFSET, 8);
+    // The translation in Bare mode spans the address space
+    if ( tr_response.fault != 0 || tr_response.S != 1 ) return -1;
+    temp = tr_response.raw;
+    if ( ddt_cache[0].valid == 1 ) return -1;
+    // A caching translation fills the IOATC
+    tr_req_ctrl.NoCache = 0;
+    tr_req_ctrl.go_busy = 1;
+    write_register(TR_REQ_CTRL_OFFSET, 8, tr_req_ctrl.raw);
+    tr_response.raw = read_register(TR_RESPONSE_OFFSET, 8);
+    if ( tr_response.raw != temp ) return -1;
+    if ( ddt_cache[0].valid == 0 || ddt_cache[0].DID != 0x000100 ) return -1;
+    // A batch of translations with a fault that is not reported
+    iodir(INVAL_DDT, 1, 0x000100, 0);
+    for ( i = 0; i < 4; i++ ) {
+        dbg_reqs[i].iova.raw = 0x1000 * (i + 1);
+        dbg_reqs[i].ctrl.raw = 0;
+        dbg_reqs[i].ctrl.DID = ( i == 2 ) ? 0x000200 : 0x000100;
+        dbg_reqs[i].ctrl.RWn = i & 1;
+    }
+    j = read_register(FQT_OFFSET, 4);
+    if ( iommu_debug_translate(dbg_reqs, dbg_rsps, 4, DBG_TR_NO_CACHE | DBG_TR_NO_FAULT) != 1 )
+        return -1;
+    if ( read_register(FQT_OFFSET, 4) != j ) return -1;
+    if ( ddt_cache[0].valid == 1 ) return -1;
+    for ( i = 0; i < 4; i++ ) {
+        if ( dbg_rsps[i].fault != (( i == 2 ) ? 1 : 0) ) return -1;
+        if ( i != 2 && dbg_rsps[i].raw != temp ) return -1;
+    }
+    printf("PASS\n");
+
+    printf("Test 21: Interrupt moderation:");
+    // Signal fault-queue interrupts on vector 1
+    gpa = get_free_ppn(1) * PAGESIZE;
+    write_register(MSI_ADDR_1_OFFSET, 8, gpa);
+    write_register(MSI_DATA_1_OFFSET, 4, 0x55);
+    write_register(MSI_VEC_CTRL_1_OFFSET, 4, 0);
+    icvec.raw = read_register(ICVEC_OFFSET, 4);
+    icvec.fiv = 1;
+    write_register(ICVEC_OFFSET, 4, icvec.raw);
+    imod.raw = 0;
+    imod.interval = 100;
+    imod.threshold = 3;
+    write_register(IMOD_SEL_OFFSET, 4, 1);
+    write_register(IMOD_OFFSET, 8, imod.raw);
+    write_register(IMOD_SEL_OFFSET, 4, 0);
+    if ( read_register(IMOD_OFFSET, 8) != 0 ) return -1;
+    write_register(IMOD_SEL_OFFSET, 4, 1);
+    if ( read_register(IMOD_OFFSET, 8) != imod.raw ) return -1;
+    ipsr.raw = 0;
+    ipsr.fip = 1;
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    // The first interrupt on the vector is not held
+    temp = 0;
+    write_memory((char *)&temp, gpa, 4);
+    send_translation_request(0x000200, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    read_memory(gpa, 4, (char *)&temp);
+    if ( temp != 0x55 ) return -1;
+    // The next interrupt is held till the threshold is reached
+    temp = 0;
+    write_memory((char *)&temp, gpa, 4);
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    for ( i = 0; i < 3; i++ ) {
+        send_translation_request(0x000200, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 0x1000, 8, READ, 0, &req, &rsp);
+        if ( (read_register(IPSR_OFFSET, 4) & 0x2) == 0 ) return -1;
+        read_memory(gpa, 4, (char *)&temp);
+        if ( temp != ((i == 2) ? 0x55 : 0) ) return -1;
+    }
+    // The next interrupt is held till the interval elapses
+    temp = 0;
+    write_memory((char *)&temp, gpa, 4);
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    send_translation_request(0x000200, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    iommu_advance_clock(99);
+    read_memory(gpa, 4, (char *)&temp);
+    if ( temp != 0 ) return -1;
+    iommu_advance_clock(1);
+    read_memory(gpa, 4, (char *)&temp);
+    if ( temp != 0x55 ) return -1;
+    // A held interrupt that is no longer pending is not signaled
+    temp = 0;
+    write_memory((char *)&temp, gpa, 4);
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    send_translation_request(0x000200, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    iommu_advance_clock(100);
+    read_memory(gpa, 4, (char *)&temp);
+    if ( temp != 0 ) return -1;
+    write_register(IMOD_OFFSET, 8, 0);
+    icvec.fiv = 0;
+    write_register(ICVEC_OFFSET, 4, icvec.raw);
+    write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+    printf("PASS\n");
+
+    printf("Test 22: Interrupt sink:");
+    sink.send_msis = test_send_msis;
+    sink.set_wire = test_set_wire;
+    if ( iommu_set_interrupt_sink(&sink, 0) != 1 ) return -1;
+    if ( iommu_set_interrupt_sink(&sink, MAX_MSI_BATCH + 1) != 1 ) return -1;
+    if ( iommu_set_interrupt_sink(&sink, 2) != 0 ) return -1;
+    icvec.fiv = 1;
+    write_register(ICVEC_OFFSET, 4, icvec.raw);
+    temp = 0;
+    write_memory((char *)&temp, gpa, 4);
+    // MSIs are delivered to the sink when the batch fills up
+    for ( i = 0; i < 2; i++ ) {
+        write_register(IPSR_OFFSET, 4, ipsr.raw);
+        send_translation_request(0x000200, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 0x1000, 8, READ, 0, &req, &rsp);
+        if ( num_test_msis != ((i == 1) ? 2 : 0) ) return -1;
+    }
+    for ( i = 0; i < 2; i++ )
+        if ( test_msis[i].addr != gpa || test_msis[i].data != 0x55 ||
+             test_msis[i].vec != 1 ) return -1;
+    read_memory(gpa, 4, (char *)&temp);
+    if ( temp != 0 ) return -1;
+    // A partial batch is delivered when the clock advances
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    send_translation_request(0x000200, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( num_test_msis != 2 ) return -1;
+    iommu_advance_clock(1);
+    if ( num_test_msis != 3 ) return -1;
+    // Without a sink the MSIs are written to memory
+    if ( iommu_set_interrupt_sink(NULL, 0) != 0 ) return -1;
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    send_translation_request(0x000200, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    read_memory(gpa, 4, (char *)&temp);
+    if ( temp != 0x55 || num_test_msis != 3 ) return -1;
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+    // Wire based interrupts are level signaled. All inbound transactions
+    // are disallowed and fault after reset.
+    cap.igs = WIS;
+    fctrl.wis = 1;
+    if ( reset_iommu(8, 40, 0x7fff, 4, Off, cap, fctrl) < 0 ) return -1;
+    if ( enable_fq(4) < 0 ) return -1;
+    if ( iommu_set_interrupt_sink(&sink, 1) != 0 ) return -1;
+    write_register(ICVEC_OFFSET, 4, icvec.raw);
+    for ( i = 0; i < 2; i++ ) {
+        send_translation_request(0x012345, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 0x1000, 8, READ, 0, &req, &rsp);
+        if ( test_wires[1] != 1 || num_wire_changes != 1 ) return -1;
+    }
+    // Changing the sink deasserts the wires on the old sink and asserts
+    // the wires still pending on the new sink
+    if ( iommu_set_interrupt_sink(NULL, 0) != 0 ) return -1;
+    if ( test_wires[1] != 0 || num_wire_changes != 2 ) return -1;
+    if ( iommu_set_interrupt_sink(&sink, 1) != 0 ) return -1;
+    if ( test_wires[1] != 1 || num_wire_changes != 3 ) return -1;
+    // The wire stays asserted while a cause mapped to the vector is pending
+    write_register(IPSR_OFFSET, 4, 0);
+    if ( test_wires[1] != 1 || num_wire_changes != 3 ) return -1;
+    write_register(IPSR_OFFSET, 4, ipsr.raw);
+    if ( test_wires[1] != 0 || num_wire_changes != 4 ) return -1;
+    if ( num_test_msis != 3 ) return -1;
+    iommu_set_interrupt_sink(NULL, 0);
+    printf("PASS\n");
+
+    printf("Test 23: Bare mode passthrough:");
+    write_register(FQH_OFFSET, 4, read_register(FQT_OFFSET, 4));
+    if ( enable_iommu(DDT_Bare) < 0 ) return -1;
+    // The IOVA is identity mapped by the largest supported page
+    temp = 512UL * 512UL * 512UL * 512UL * PAGESIZE;
+    send_translation_request(0x012345, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0xdeadbeef000, 8, WRITE, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    if ( rsp.trsp.S != 1 || rsp.trsp.PBMT != PMA ||
+         rsp.trsp.PPN != (((0xdeadbeef000UL & ~(temp - 1)) | ((temp / 2) - 1)) / PAGESIZE) )
+        return -1;
+    // Requests with a process_id and ATS requests are disallowed
+    send_translation_request(0x012345, 1, 0x99, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0xdeadbeef000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, UNSUPPORTED_REQUEST, 260, 0) < 0 ) return -1;
+    send_translation_request(0x012345, 0, 0, 0, 0, 0, 0, ADDR_TYPE_PCIE_ATS_TRANSLATION_REQUEST,
+                             0xdeadbeef000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, UNSUPPORTED_REQUEST, 0, 0) < 0 ) return -1;
+    printf("PASS\n");
+
+    printf("Test 24: Range mapping:");
+    cap.Svnapot = 1;
+    if ( reset_iommu(8, 40, 0x7fff, 4, Off, cap, fctrl) < 0 ) return -1;
+    if ( enable_fq(4) < 0 ) return -1;
+    if ( enable_iommu(DDT_3LVL) < 0 ) return -1;
+    DC_addr = add_device(0x000300, 5, 0, 0, 0, 0, 0, IOHGATP_Sv48x4, IOSATP_Sv48, PDTP_Bare,
+                         MSIPTP_Bare, 0, 0, 0);
+    read_memory(DC_addr, 64, (char *)&DC);
+    // Map 1G + 2M + 68K of guest physical memory at 2G. The level 2 table
+    // exists and the level 1 and level 0 tables are allocated.
+    gpte.raw = 0;
+    gpte.R = gpte.W = gpte.X = gpte.U = gpte.A = gpte.D = 1;
+    gpte.PBMT = PMA;
+    num_tables = map_g_stage_range(DC.iohgatp, 0x80000000UL, 0xC0000000UL,
+                                   (0x40000000UL + 0x200000UL + 0x11000UL), gpte);
+    if ( num_tables != 2 ) return -1;
+    if ( map_g_stage_range(DC.iohgatp, 0x1000, 0x1001, PAGESIZE, gpte) != -1 ) return -1;
+    if ( translate_gpa(DC.iohgatp, 0x92345678UL, &temp) != 0 || temp != 0xD2345678UL ) return -1;
+    if ( translate_gpa(DC.iohgatp, 0xC0001234UL, &temp) != 0 || temp != 0x100001234UL ) return -1;
+    if ( translate_gpa(DC.iohgatp, 0xC0210123UL, &temp) != 0 || temp != 0x100210123UL ) return -1;
+    // Map a 2M page, a 64K NAPOT page and a 4K page. The level 2, 1 and 0
+    // tables are allocated.
+    pte.raw = 0;
+    pte.R = pte.W = pte.U = pte.A = pte.D = pte.N = 1;
+    pte.PBMT = PMA;
+    num_tables = map_vs_stage_range(DC.fsc.iosatp, 0x200000, 0x80000000UL,
+                                    (0x200000 + 0x11000), pte, DC.iohgatp);
+    if ( num_tables != 3 ) return -1;
+    send_translation_request(0x000300, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x201234, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    if ( rsp.trsp.S != 1 || rsp.trsp.PPN != ((0xC0000000UL | 0xFFFFF) / PAGESIZE) ) return -1;
+    send_translation_request(0x000300, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x405678, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    if ( rsp.trsp.S != 1 || rsp.trsp.PPN != ((0xC0200000UL | 0x7FFF) / PAGESIZE) ) return -1;
+    send_translation_request(0x000300, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x410010, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    if ( rsp.trsp.S != 0 || rsp.trsp.PPN != (0xC0210000UL / PAGESIZE) ) return -1;
+    // A range that is already mapped, by a leaf or by a table, is not
+    // mapped over. Map a 4K page and then a 2M page over it.
+    pte.N = 0;
+    if ( map_vs_stage_range(DC.fsc.iosatp, 0x600000, 0x80600000UL, PAGESIZE,
+                            pte, DC.iohgatp) != 1 ) return -1;
+    if ( map_vs_stage_range(DC.fsc.iosatp, 0x600000, 0x80600000UL, 0x200000,
+                            pte, DC.iohgatp) != -1 ) return -1;
+    if ( map_vs_stage_range(DC.fsc.iosatp, 0x600000, 0x80600000UL, PAGESIZE,
+                            pte, DC.iohgatp) != -1 ) return -1;
+    send_translation_request(0x000300, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x600010, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    if ( rsp.trsp.S != 0 || rsp.trsp.PPN != (0xC0600000UL / PAGESIZE) ) return -1;
+    // A range whose last page is mapped is not partially mapped
+    if ( map_vs_stage_range(DC.fsc.iosatp, 0x5FF000, 0x805FF000UL, (2 * PAGESIZE),
+                            pte, DC.iohgatp) != -1 ) return -1;
+    if ( map_vs_stage_range(DC.fsc.iosatp, 0x5FF000, 0x805FF000UL, PAGESIZE,
+                            pte, DC.iohgatp) != 0 ) return -1;
+    if ( unmap_vs_stage_range(DC.fsc.iosatp, 0x5FF000, PAGESIZE, DC.iohgatp, NULL) != 0 )
+        return -1;
+    printf("PASS\n");
+
+    printf("Test 25: Range unmap and protect:");
+    if ( enable_cq(4) < 0 ) return -1;
+    cqb.raw = read_register(CQB_OFFSET, 8);
+    memset(&inv, 0, sizeof(inv));
+    inv.cmds = inv_cmds;
+    inv.max_cmds = 4;
+    inv.PSCV = 1;
+    inv.PSCID = DC.ta.PSCID;
+    // The cached translation is used till the IOTINVAL commands are processed
+    send_translation_request(0x000300, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x201234, 8, WRITE, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    pte.raw = 0;
+    pte.R = pte.U = 1;
+    if ( protect_vs_stage_range(DC.fsc.iosatp, 0x200000, 0x200000, pte, DC.iohgatp, &inv) != 1 )
+        return -1;
+    if ( inv.num_cmds != 1 || inv_cmds[0].iotinval.opcode != IOTINVAL ||
+         inv_cmds[0].iotinval.func3 != VMA || inv_cmds[0].iotinval.av != 1 ||
+         inv_cmds[0].iotinval.gv != 1 || inv_cmds[0].iotinval.gscid != 5 ||
+         inv_cmds[0].iotinval.addr_63_12 != 0x200 ) return -1;
+    send_translation_request(0x000300, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x201234, 8, WRITE, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    for ( i = 0; i < inv.num_cmds; i++ ) {
+        cqt.raw = read_register(CQT_OFFSET, 4);
+        write_memory((char *)&inv_cmds[i], ((cqb.ppn * PAGESIZE) | (cqt.index * 16)), 16);
+        cqt.index++;
+        write_register(CQT_OFFSET, 4, cqt.raw);
+    }
+    process_commands();
+    send_translation_request(0x000300, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x201234, 8, WRITE, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, UNSUPPORTED_REQUEST, 15, 0) < 0 ) return -1;
+    // Adding permissions needs no invalidation
+    inv.num_cmds = 0;
+    pte.W = 1;
+    if ( protect_vs_stage_range(DC.fsc.iosatp, 0x200000, 0x200000, pte, DC.iohgatp, &inv) != 1 )
+        return -1;
+    if ( inv.num_cmds != 0 ) return -1;
+    // The permissions must be valid for a leaf
+    pte.R = pte.W = pte.X = 0;
+    if ( protect_vs_stage_range(DC.fsc.iosatp, 0x200000, 0x200000, pte, DC.iohgatp, &inv) != -1 )
+        return -1;
+    pte.W = 1;
+    if ( protect_vs_stage_range(DC.fsc.iosatp, 0x200000, 0x200000, pte, DC.iohgatp, &inv) != -1 )
+        return -1;
+    if ( inv.num_cmds != 0 ) return -1;
+    // A part of a leaf cannot be unmapped
+    if ( unmap_vs_stage_range(DC.fsc.iosatp, 0x200000, PAGESIZE, DC.iohgatp, &inv) != -1 )
+        return -1;
+    // Unmapping the NAPOT and 4K pages frees the level 0 table and
+    // invalidates the address space. The guest physical page of the table
+    // is unmapped from the G-stage and invalidated.
+    get_page_pool_stats(0, 0, &ppn_stats);
+    get_page_pool_stats(1, DC.iohgatp.GSCID, &gppn_stats);
+    if ( unmap_vs_stage_range(DC.fsc.iosatp, 0x400000, 0x11000, DC.iohgatp, &inv) != 1 )
+        return -1;
+    if ( check_pool_frees(0, 0, &ppn_stats, 1) < 0 ) return -1;
+    if ( check_pool_frees(1, DC.iohgatp.GSCID, &gppn_stats, 1) < 0 ) return -1;
+    if ( inv.num_cmds != 2 || inv_cmds[0].iotinval.av != 1 ||
+         inv_cmds[0].iotinval.func3 != GVMA || inv_cmds[0].iotinval.gscid != 5 ||
+         inv_cmds[0].iotinval.pscv != 0 || inv_cmds[1].iotinval.av != 0 ||
+         inv_cmds[1].iotinval.func3 != VMA ) return -1;
+    for ( i = 0; i < inv.num_cmds; i++ ) {
+        cqt.raw = read_register(CQT_OFFSET, 4);
+        write_memory((char *)&inv_cmds[i], ((cqb.ppn * PAGESIZE) | (cqt.index * 16)), 16);
+        cqt.index++;
+        write_register(CQT_OFFSET, 4, cqt.raw);
+    }
+    process_commands();
+    send_translation_request(0x000300, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x405678, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, UNSUPPORTED_REQUEST, 13, 0) < 0 ) return -1;
+    // The G-stage leaves must have U permission
+    gpte.U = 0;
+    if ( protect_g_stage_range(DC.iohgatp, 0x80000000UL, 0x40000000UL, gpte, &inv) != -1 )
+        return -1;
+    gpte.U = 1;
+    // The G-stage leaves overflow the batch and the level 1 and level 0
+    // tables are freed
+    inv.num_cmds = 0;
+    inv.max_cmds = 2;
+    get_page_pool_stats(0, 0, &ppn_stats);
+    if ( unmap_g_stage_range(DC.iohgatp, 0x80000000UL,
+                             (0x40000000UL + 0x200000UL + 0x11000UL), &inv) != 2 )
+        return -1;
+    if ( check_pool_frees(0, 0, &ppn_stats, 2) < 0 ) return -1;
+    if ( inv.num_cmds != 1 || inv_cmds[0].iotinval.av != 0 ||
+         inv_cmds[0].iotinval.func3 != GVMA || inv_cmds[0].iotinval.gscid != 5 ) return -1;
+    if ( translate_gpa(DC.iohgatp, 0x92345678UL, &temp) != 1 ) return -1;
+    printf("PASS\n");
+
+    printf("Test 26: Page pool allocation:");
+    // Each GSCID has its own guest physical address space
+    DC.iohgatp.GSCID = 6;
+    if ( init_guest_page_pool(6, 0x100, 0x20) != 0 ) return -1;
+    ppns[0] = get_free_gppn(1, DC.iohgatp);
+    ppns[1] = get_free_gppn(1, DC.iohgatp);
+    ppns[2] = get_free_gppn(1, DC.iohgatp);
+    if ( ppns[0] != 0x100 || ppns[1] != 0x101 || ppns[2] != 0x102 ) return -1;
+    // Freed pages are reused
+    free_gppn(ppns[0], 1, DC.iohgatp);
+    free_gppn(ppns[1], 1, DC.iohgatp);
+    if ( get_free_gppn(1, DC.iohgatp) != 0x100 ) return -1;
+    if ( get_free_gppn(1, DC.iohgatp) != 0x101 ) return -1;
+    free_gppn(ppns[0], 1, DC.iohgatp);
+    free_gppn(ppns[1], 1, DC.iohgatp);
+    // Multi-page allocations are aligned to their size and the pages
+    // skipped to align them are free
+    if ( get_free_gppn(4, DC.iohgatp) != 0x104 ) return -1;
+    get_page_pool_stats(1, 6, &gppn_stats);
+    if ( gppn_stats.free_pages != 3 || gppn_stats.pages_in_use != 5 ) return -1;
+    // Free pages are coalesced and allocated from when large enough
+    free_gppn(ppns[2], 1, DC.iohgatp);
+    if ( get_free_gppn(2, DC.iohgatp) != 0x100 ) return -1;
+    if ( get_free_gppn(8, DC.iohgatp) != 0x108 ) return -1;
+    if ( get_free_gppn(16, DC.iohgatp) != 0x110 ) return -1;
+    if ( get_free_gppn(1, DC.iohgatp) != 0x102 ) return -1;
+    if ( get_free_gppn(4, DC.iohgatp) != INVALID_PPN ) return -1;
+    get_page_pool_stats(1, 6, &gppn_stats);
+    if ( gppn_stats.pages_in_use != 31 || gppn_stats.peak_pages_in_use != 31 ||
+         gppn_stats.free_pages != 1 || gppn_stats.allocs != 10 ||
+         gppn_stats.frees != 5 || gppn_stats.failed_allocs != 1 ) return -1;
+    if ( get_page_pool_stats(1, 7, &gppn_stats) != 1 ) return -1;
+    // The builders fail when a table cannot be allocated. The root of the
+    // PDT takes the last guest physical page.
+    DC.fsc.pdtp.MODE = PD20;
+    DC.fsc.pdtp.PPN = get_free_gppn(1, DC.iohgatp);
+    gpte.raw = 0;
+    gpte.V = gpte.R = gpte.W = gpte.U = 1;
+    gpte.PBMT = PMA;
+    gpte.PPN = get_free_ppn(1);
+    if ( add_g_stage_pte(DC.iohgatp, (DC.fsc.pdtp.PPN * PAGESIZE), gpte, 0) <= 1 ) return -1;
+    memset(&PC, 0, sizeof(PC));
+    if ( add_process_context(&DC, &PC, 0x20000) != 1 ) return -1;
+    // Supervisor physical pages are allocated from the memory
+    get_page_pool_stats(0, 0, &ppn_stats);
+    ppns[3] = get_free_ppn(4);
+    if ( (ppns[3] & 0x3) != 0 || ((ppns[3] + 4) * PAGESIZE) > (1024UL * 1024UL * 1024UL) )
+        return -1;
+    free_ppn(ppns[3], 4);
+    if ( check_pool_frees(0, 0, &ppn_stats, 0) < 0 ) return -1;
+    printf("PASS\n");
+
+    printf("Test 27: Parallel table building:");
+    // Building fails when pages cannot be allocated
+    if ( build_test_tables(0x24000, 0x10, 2) == 0 ) return -1;
+    // The tables built in parallel must be identical to those built serially
+    if ( (image = malloc(0x4000 * PAGESIZE)) == NULL ) return -1;
+    if ( build_test_tables(0x20000, 0x4000, 0) < 0 ) return -1;
+    memcpy(image, &memory[0x20000 * PAGESIZE], (0x4000 * PAGESIZE));
+    if ( build_test_tables(0x20000, 0x4000, 4) < 0 ) return -1;
+    if ( memcmp(image, &memory[0x20000 * PAGESIZE], (0x4000 * PAGESIZE)) != 0 ) return -1;
+    free(image);
+    send_translation_request(0x000400, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    send_translation_request(0x000481, 1, 0x2, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    // The guest physical page holding the level 0 PDT is mapped
+    send_translation_request(0x000402, 1, 0x10105, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    printf("PASS\n");
 
+    printf("Test 28: Table image snapshot:");
+    if ( reset_iommu(8, 40, 0x7fff, 4, Off, cap, fctrl) < 0 ) return -1;
+    if ( build_test_tables(0x20000, 0x4000, 4) < 0 ) return -1;
+    if ( enable_fq(4) < 0 ) return -1;
+    get_page_pool_stats(0, 0, &ppn_stats);
+    if ( (fd = mkstemp(image_path)) < 0 ) return -1;
+    close(fd);
+    if ( save_table_image(image_path) != 0 ) return -1;
+    // Restore the image over clobbered memory and page pools
+    if ( reset_iommu(8, 40, 0x7fff, 4, Off, cap, fctrl) < 0 ) return -1;
+    memset(&memory[0x20000 * PAGESIZE], 0xFF, (0x100 * PAGESIZE));
+    init_page_pool(0, 0x10);
+    if ( restore_table_image(image_path, memory, (1024UL * 1024UL * 1024UL)) != 0 ) return -1;
+    get_page_pool_stats(0, 0, &gppn_stats);
+    if ( gppn_stats.pages_in_use != ppn_stats.pages_in_use ||
+         gppn_stats.allocs != ppn_stats.allocs ) return -1;
+    if ( get_page_pool_stats(1, 7, &gppn_stats) != 0 ) return -1;
+    send_translation_request(0x000400, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    send_translation_request(0x000402, 1, 0x10105, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    // Faults are reported to the restored fault queue
+    send_translation_request(0x000403, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, UNSUPPORTED_REQUEST, 258, 0) < 0 ) return -1;
+    // Writes to the restored memory do not modify the image
+    memset(&memory[0x20000 * PAGESIZE], 0, (0x4000 * PAGESIZE));
+    if ( reset_iommu(8, 40, 0x7fff, 4, Off, cap, fctrl) < 0 ) return -1;
+    if ( restore_table_image(image_path, memory, (1024UL * 1024UL * 1024UL)) != 0 ) return -1;
+    send_translation_request(0x000400, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    // The image must match the capabilities of the IOMMU
+    cap.Svnapot = 0;
+    if ( reset_iommu(8, 40, 0x7fff, 4, Off, cap, fctrl) < 0 ) return -1;
+    if ( restore_table_image(image_path, memory, (1024UL * 1024UL * 1024UL)) != 1 ) return -1;
+    cap.Svnapot = 1;
+    if ( reset_iommu(8, 40, 0x7fff, 4, Off, cap, fctrl) < 0 ) return -1;
+    if ( restore_table_image(image_path, memory, (1024UL * 1024UL * 1024UL)) != 0 ) return -1;
+    // A truncated image is rejected without changing the memory
+    memory[0x30000 * PAGESIZE] = 0x5A;
+    if ( stat(image_path, &st) != 0 || truncate(image_path, (st.st_size - 8)) != 0 ) return -1;
+    if ( restore_table_image(image_path, memory, (1024UL * 1024UL * 1024UL)) != 1 ) return -1;
+    if ( memory[0x30000 * PAGESIZE] != 0x5A ) return -1;
+    unlink(image_path);
+    printf("PASS\n");
+
+    printf("Test 29: GPA translation memoisation:");
+    iohgatp.raw = 0;
+    iohgatp.MODE = IOHGATP_Sv39x4;
+    iohgatp.GSCID = 8;
+    iohgatp.PPN = get_free_ppn(4);
+    gpte.raw = 0;
+    gpte.R = gpte.W = gpte.U = 1;
+    gpte.PBMT = PMA;
+    if ( map_g_stage_range(iohgatp, 0x10000000UL, 0x30000000UL, 0x201000UL, gpte) < 0 ) return -1;
+    if ( translate_gpa(iohgatp, 0x10200123UL, &temp) != 0 || temp != 0x30200123UL ) return -1;
+    if ( translate_gpa(iohgatp, 0x10200456UL, &temp) != 0 || temp != 0x30200456UL ) return -1;
+    // Modifications made by libtables invalidate the memoised translations
+    gpte.V = 1;
+    gpte.PPN = 0x40000;
+    gpa = add_g_stage_pte(iohgatp, 0x10200000UL, gpte, 0);
+    if ( translate_gpa(iohgatp, 0x10200123UL, &temp) != 0 || temp != 0x40000123UL ) return -1;
+    // Other modifications must be followed by an invalidation
+    gpte.PPN = 0x50000;
+    write_memory((char *)&gpte.raw, gpa, 8);
+    if ( translate_gpa(iohgatp, 0x10200123UL, &temp) != 0 || temp != 0x40000123UL ) return -1;
+    invalidate_gpa_cache(iohgatp);
+    if ( translate_gpa(iohgatp, 0x10200123UL, &temp) != 0 || temp != 0x50000123UL ) return -1;
+    inv.cmds = inv_cmds;
+    inv.max_cmds = 4;
+    inv.num_cmds = 0;
+    if ( unmap_g_stage_range(iohgatp, 0x10200000UL, PAGESIZE, &inv) < 0 ) return -1;
+    if ( translate_gpa(iohgatp, 0x10200123UL, &temp) != 1 ) return -1;
+    if ( translate_gpa(iohgatp, 0x10000123UL, &temp) != 0 || temp != 0x30000123UL ) return -1;
+    // Sv39 tables have three levels
+    iosatp.raw = 0;
+    iosatp.MODE = IOSATP_Sv39;
+    iosatp.PPN = get_free_ppn(1);
+    pte.raw = 0;
+    pte.V = pte.R = 1;
+    gpa = add_s_stage_pte(iosatp, 0x12345000UL, pte, 0);
+    read_memory((iosatp.PPN * PAGESIZE), 8, (char *)&pte.raw);
+    if ( pte.V != 1 || pte.R != 0 || (gpa / PAGESIZE) == iosatp.PPN ||
+         (gpa & (PAGESIZE - 1)) != (0x145 * 8) ) return -1;
+    printf("PASS\n");
+    printf("Test 30: Table verification:");
+    if ( build_test_tables(0x20000, 0x4000, 4) != 0 ) return -1;
+    if ( verify_tables(violations, 8, 4) != 0 ) return -1;
+    // Two devices share a S-stage table with bad entries
+    memset(&DC, 0, sizeof(DC));
+    DC.tc.V = 1;
+    DC.fsc.iosatp.MODE = IOSATP_Sv39;
+    DC.fsc.iosatp.PPN = get_free_ppn(1);
+    add_dev_context(&DC, 0x000404);
+    add_dev_context(&DC, 0x000403);
+    pte.raw = 0;
+    pte.V = pte.R = pte.W = 1;
+    pte.PPN = 0x100;
+    add_s_stage_pte(DC.fsc.iosatp, 0x1000, pte, 0);
+    pte.PPN = 0x201;
+    add_s_stage_pte(DC.fsc.iosatp, 0x200000, pte, 1);
+    pte.R = 0;
+    add_s_stage_pte(DC.fsc.iosatp, 0x3000, pte, 0);
+    pte.W = 0;
+    add_s_stage_pte(DC.fsc.iosatp, 0x4000, pte, 0);
+    // A device context and a process context are misconfigured
+    memset(&DC, 0, sizeof(DC));
+    DC.tc.V = 1;
+    DC.tc.reserved = 1;
+    DC_addr = add_dev_context(&DC, 0x000401);
+    if ( locate_device_context(&DC, 0x000481, 0, 0, &cause) != 0 ) return -1;
+    memset(&PC, 0, sizeof(PC));
+    PC.ta.V = 1;
+    PC.fsc.iosatp.MODE = 1;
+    gpa = add_process_context(&DC, &PC, 2);
+    if ( verify_tables(violations, 8, 4) != 5 ) return -1;
+    if ( violations[0].table != VERIFY_DDT || violations[0].device_id != 0x000401 ||
+         violations[0].addr != DC_addr || violations[0].cause != 259 ) return -1;
+    for ( i = 1; i < 4; i++ ) {
+        if ( violations[i].table != VERIFY_S_STAGE || violations[i].device_id != 0x000403 ||
+             violations[i].pid_valid != 0 || violations[i].cause != 13 ) return -1;
+    }
+    if ( violations[1].level != 1 || violations[1].va != 0x200000 ||
+         violations[1].check != PTE_MISALIGNED ) return -1;
+    if ( violations[2].level != 0 || violations[2].va != 0x3000 ||
+         violations[2].check != PTE_W_WITHOUT_R ) return -1;
+    if ( violations[3].level != 0 || violations[3].va != 0x4000 ||
+         violations[3].check != PTE_NOT_LEAF ) return -1;
+    if ( violations[4].table != VERIFY_PDT || violations[4].device_id != 0x000481 ||
+         violations[4].pid_valid != 1 || violations[4].process_id != 2 ||
+         violations[4].addr != gpa || violations[4].cause != 267 ) return -1;
+    // The violations do not depend on the number of threads
+    if ( verify_tables(violations_1, 2, 1) != 5 ) return -1;
+    for ( i = 0; i < 2; i++ ) {
+        if ( violations_1[i].table != violations[i].table ||
+             violations_1[i].addr != violations[i].addr ||
+             violations_1[i].cause != violations[i].cause ||
+             violations_1[i].check != violations[i].check ) return -1;
+    }
+    // Correct the entries
+    temp = 0;
+    write_memory((char *)&temp, violations[1].addr, 8);
+    write_memory((char *)&temp, violations[2].addr, 8);
+    write_memory((char *)&temp, violations[3].addr, 8);
+    PC.fsc.iosatp.MODE = IOSATP_Bare;
+    add_process_context(&DC, &PC, 2);
+    memset(&DC, 0, sizeof(DC));
+    DC.tc.V = 1;
+    add_dev_context(&DC, 0x000401);
+    if ( verify_tables(violations, 8, 3) != 0 ) return -1;
+    printf("PASS\n");
+
+    printf("Test 31: Record and replay:");
+    if ( reset_iommu(8, 40, 0x7fff, 4, Off, cap, fctrl) < 0 ) return -1;
+    if ( build_test_tables(0x20000, 0x4000, 4) < 0 ) return -1;
+    if ( enable_cq(4) < 0 ) return -1;
+    if ( enable_fq(4) < 0 ) return -1;
+    iofence_data = 0;
+    write_memory((char *)&iofence_data, (iofence_PPN * PAGESIZE), 8);
+    strcpy(image_path, "/tmp/iommu_imageXXXXXX");
+    if ( (fd = mkstemp(image_path)) < 0 ) return -1;
+    close(fd);
+    if ( save_table_image(image_path) != 0 ) return -1;
+    if ( (fd = mkstemp(rec_path)) < 0 ) return -1;
+    close(fd);
+    if ( iommu_record_start(rec_path) != 0 ) return -1;
+    if ( iommu_record_start(rec_path) != 1 ) return -1;
+    // Enough requests to span several chunks
+    num_ok = ppn_sum = 0;
+    for ( i = 0; i < 20000; i++ ) {
+        send_translation_request(0x000400, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                                 ((i * 7919) % 4096) * PAGESIZE, 8, (i & 1), i, &req, &rsp);
+        if ( rsp.status == SUCCESS ) num_ok++;
+        ppn_sum += rsp.trsp.PPN;
+    }
+    send_translation_request(0x000481, 1, 0x2, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, SUCCESS, 0, 0) < 0 ) return -1;
+    send_translation_request(0x000403, 0, 0, 0, 0, 0, 0, ADDR_TYPE_UNTRANSLATED,
+                             0x1000, 8, READ, 0, &req, &rsp);
+    if ( check_rsp_and_faults(&req, &rsp, UNSUPPORTED_REQUEST, 258, 0) < 0 ) return -1;
+    iofence(IOFENCE_C, 1, 0, 1, 0, (iofence_PPN * PAGESIZE), 0xDEADBEEF);
+    // The timeout, the ATS invalidation completions, the timer expiries
+    // and the clock advances are recorded
+    iommu_set_ats_inv_req_timeout(100);
+    num_msgs_sent = 0;
+    ats_command(INVAL, 0, 0, 0, 0, 0x2345, 0);
+    if ( num_msgs_sent != 1 ) return -1;
+    exp_msg.MSGCODE = INVAL_COMPL_MSG_CODE;
+    exp_msg.RID = 0x2345;
+    exp_msg.DSV = 0;
+    exp_msg.PAYLOAD = (1UL << 32) | (1UL << exp_msg.TAG);
+    if ( handle_invalidation_completion(&exp_msg) != 0 ) return -1;
+    do_ats_timer_expiry(1UL << exp_msg.TAG);
+    iommu_advance_clock(10);
+    iommu_set_ats_inv_req_timeout(0);
+    if ( any_ats_invalidation_requests_pending() != 0 ) return -1;
+    if ( iommu_record_stop() != 0 ) return -1;
+    if ( iommu_record_stop() != 1 ) return -1;
+    read_memory((iofence_PPN * PAGESIZE), 8, (char *)&iofence_data);
+    if ( iofence_data != 0xDEADBEEF ) return -1;
+    temp = read_register(FQT_OFFSET, 4);
+    if ( temp == 0 || read_register(FQH_OFFSET, 4) != temp ) return -1;
+
+    // Replay over the restored tables
+    if ( iommu_replay_open(&rec_reader, rec_path) != 0 ) return -1;
+    if ( rec_reader.hdr->num_chunks < 3 || rec_reader.hdr->reset.capabilities != cap.raw ||
+         rec_reader.hdr->reset.num_hpm != 8 || rec_reader.hdr->reset.hpmctr_bits != 40 ||
+         rec_reader.hdr->reset.eventID_mask != 0x7fff || rec_reader.hdr->reset.num_vec_bits != 4 ||
+         rec_reader.hdr->reset.reset_iommu_mode != Off ||
+         rec_reader.hdr->reset.fctrl != fctrl.raw ) return -1;
+    if ( reset_iommu(8, 40, 0x7fff, 4, Off, cap, fctrl) < 0 ) return -1;
+    start_clock = iommu_get_clock();
+    num_msgs_sent = 0;
+    num_events = 0;
+    iofence_data = 0;
+    write_memory((char *)&iofence_data, (iofence_PPN * PAGESIZE), 8);
+    if ( restore_table_image(image_path, memory, (1024UL * 1024UL * 1024UL)) != 0 ) return -1;
+    i = 0;
+    while ( iommu_replay_next(&rec_reader, &rec) == 0 ) {
+        iommu_replay_apply(&rec, &rsp);
+        if ( i < 20000 ) {
+            if ( rec.type != REC_UNTRANSLATED || rec.req.device_id != 0x000400 ||
+                 rec.req.tr.iova != ((i * 7919) % 4096) * PAGESIZE ||
+                 rec.req.tr.read_writeAMO != (i & 1) ||
+                 rec.req.tr.msi_wr_data != ((i & 1) ? i : 0) ) return -1;
+            if ( rsp.status == SUCCESS ) num_ok--;
+            ppn_sum -= rsp.trsp.PPN;
+        }
+        if ( rec.type == REC_EVENT ) num_events |= (1UL << rec.event);
+        i++;
+    }
+    if ( num_ok != 0 || ppn_sum != 0 ) return -1;
+    if ( i != rec_reader.hdr->num_records ) return -1;
+    if ( num_events != ((1UL << REC_EV_CLOCK) | (1UL << REC_EV_INV_COMPLETION) |
+                        (1UL << REC_EV_ATS_TIMER_EXPIRY) | (1UL << REC_EV_ATS_TIMEOUT)) )
+        return -1;
+    // The invalidation is completed and the clock advanced by the replay
+    if ( rec.type != REC_EVENT || rec.event != REC_EV_ATS_TIMEOUT || rec.data != 0 ) return -1;
+    if ( num_msgs_sent != 1 || any_ats_invalidation_requests_pending() != 0 ) return -1;
+    if ( iommu_get_clock() != (start_clock + 10) ) return -1;
+    // The fault, the fault queue head updates and the fence are replayed
+    if ( read_register(FQT_OFFSET, 4) != temp || read_register(FQH_OFFSET, 4) != temp ) return -1;
+    read_memory((iofence_PPN * PAGESIZE), 8, (char *)&iofence_data);
+    if ( iofence_data != 0xDEADBEEF ) return -1;
+    // Seek to a record in a later chunk
+    if ( iommu_replay_seek(&rec_reader, (rec_reader.index[2].first_record + 5)) != 0 ) return -1;
+    if ( iommu_replay_next(&rec_reader, &rec) != 0 ) return -1;
+    i = rec_reader.index[2].first_record + 5;
+    if ( rec.req.tr.iova != ((i * 7919) % 4096) * PAGESIZE ) return -1;
+    if ( iommu_replay_seek(&rec_reader, 20000) != 0 ) return -1;
+    if ( iommu_replay_next(&rec_reader, &rec_1) != 0 ) return -1;
+    if ( rec_1.req.device_id != 0x000481 || rec_1.req.process_id != 0x2 ) return -1;
+    if ( iommu_replay_seek(&rec_reader, (rec_reader.hdr->num_records + 1)) != 1 ) return -1;
+    iommu_replay_close(&rec_reader);
+    unlink(rec_path);
+    unlink(image_path);
+    printf("PASS\n");
 
 #if 0
     memset(&DC, 0, sizeof(DC));
@@ -964,26 +2190,86 @@ main(void) {
 int8_t
 reset_system(
     uint8_t mem_gb, uint16_t num_vms) {
-    uint32_t gscid;
-    // Create memory
-    if ( (memory = malloc((mem_gb * 1024UL * 1024UL * 1024UL))) == NULL )
+    // Create memory. The memory is mapped so that table images may be
+    // restored into it.
+    if ( (memory = mmap(NULL, (mem_gb * 1024UL * 1024UL * 1024UL), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED )
         return -1;
 
-    // Initialize free list of pages
-    for ( gscid = 0; gscid < 65536; gscid++ ) next_free_gpage[gscid] = 0;
-    next_free_page = 0;
+    // Allocate pages from the memory
+    init_page_pool(0, ((mem_gb * 1024UL * 1024UL * 1024UL) / PAGESIZE));
     return 0;
 }
-uint64_t
-get_free_gppn(uint64_t num_gppn, iohgatp_t iohgatp) {
-    uint64_t free_gppn = next_free_gpage[iohgatp.GSCID];
+// Build a set of devices and processes in a region of memory either
+// serially or, if num_threads is not 0, using the parallel table builder
+int8_t
+build_test_tables(
+    uint64_t base_ppn, uint64_t num_ppns, uint32_t num_threads) {
+    uint32_t dev_ids[6] = {0x000400, 0x000401, 0x000480, 0x000402, 0x000481, 0x020600};
+    uint32_t pids[3][3] = {{0x00001, 0x00105, 0x10105},
+                           {0x00001, 0x00002, 0x000FF},
+                           {0x80000, 0x00001, 0x7FFFF}};
+    uint8_t pdt_modes[3] = {PD17, PD8, PD20};
+    device_context_t DC[6];
+    process_context_t PC[3][3];
+    dev_tables_desc_t devs[6];
+    gpte_t gpte;
+    uint32_t i, j;
 
-    if ( free_gppn & (num_gppn -1) ) {
-        free_gppn = free_gppn + (num_gppn -1);
-        free_gppn = free_gppn & ~(num_gppn -1);
+    memset(&memory[base_ppn * PAGESIZE], 0, (num_ppns * PAGESIZE));
+    init_page_pool(base_ppn, num_ppns);
+    enable_iommu(DDT_3LVL);
+    memset(DC, 0, sizeof(DC));
+    memset(PC, 0, sizeof(PC));
+    memset(devs, 0, sizeof(devs));
+    for ( i = 0; i < 6; i++ ) {
+        DC[i].tc.V = 1;
+        devs[i].device_id = dev_ids[i];
+        devs[i].DC = &DC[i];
+        if ( i < 3 ) continue;
+        // The last three devices have process directory tables
+        DC[i].tc.PDTV = 1;
+        DC[i].fsc.pdtp.MODE = pdt_modes[i - 3];
+        if ( i == 3 ) {
+            DC[i].iohgatp.MODE = IOHGATP_Sv48x4;
+            DC[i].iohgatp.GSCID = 7;
+            DC[i].iohgatp.PPN = get_free_ppn(4);
+            DC[i].fsc.pdtp.PPN = get_free_gppn(1, DC[i].iohgatp);
+            gpte.raw = 0;
+            gpte.V = gpte.R = gpte.W = gpte.U = 1;
+            gpte.PBMT = PMA;
+            gpte.PPN = get_free_ppn(1);
+            add_g_stage_pte(DC[i].iohgatp, (PAGESIZE * DC[i].fsc.pdtp.PPN), gpte, 0);
+        } else {
+            DC[i].fsc.pdtp.PPN = get_free_ppn(1);
+        }
+        devs[i].num_processes = 3;
+        devs[i].process_ids = pids[i - 3];
+        devs[i].PC = PC[i - 3];
+        for ( j = 0; j < 3; j++ ) {
+            PC[i - 3][j].ta.V = 1;
+            PC[i - 3][j].ta.PSCID = j + 1;
+        }
+    }
+    if ( num_threads != 0 )
+        return ( build_device_tables(devs, 6, num_threads) == 0 ) ? 0 : -1;
+    for ( i = 0; i < 6; i++ ) {
+        add_dev_context(&DC[i], dev_ids[i]);
+        for ( j = 0; j < devs[i].num_processes; j++ )
+            if ( add_process_context(&DC[i], &PC[i - 3][j], devs[i].process_ids[j]) == 1 )
+                return -1;
     }
-    next_free_gpage[iohgatp.GSCID] = free_gppn + num_gppn;
-    return free_gppn; 
+    return 0;
+}
+// Check the number of pages freed to a pool since the stats were read
+int8_t
+check_pool_frees(
+    uint8_t GV, uint16_t GSCID, page_pool_stats_t *prev, uint64_t num_ppns) {
+    page_pool_stats_t stats;
+
+    if ( get_page_pool_stats(GV, GSCID, &stats) != 0 ) return -1;
+    if ( (prev->pages_in_use - stats.pages_in_use) != num_ppns ) return -1;
+    return 0;
 }
 int8_t enable_cq(
     uint32_t nppn) {
@@ -1311,17 +2597,28 @@ iofence(
     process_commands();
     return;
 }
-uint64_t
-get_free_ppn(
-    uint64_t num_ppn) {
-    uint64_t free_ppn;
-    if ( next_free_page & (num_ppn -1) ) {
-        next_free_page = next_free_page + (num_ppn -1);
-        next_free_page = next_free_page & ~(num_ppn -1);
-    }
-    free_ppn = next_free_page;
-    next_free_page += num_ppn;
-    return free_ppn; 
+void
+ats_command(
+    uint8_t f3, uint8_t DSV, uint8_t PV, uint32_t PID, uint8_t DSEG, uint16_t RID, uint64_t payload) {
+    command_t cmd;
+    cqb_t cqb;
+    cqt_t cqt;
+    cmd.low = cmd.high = 0;
+    cmd.ats.opcode = ATS;
+    cmd.ats.func3 = f3;
+    cmd.ats.dsv = DSV;
+    cmd.ats.pv = PV;
+    cmd.ats.pid = PID;
+    cmd.ats.dseg = DSEG;
+    cmd.ats.rid = RID;
+    cmd.ats.payload = payload;
+    cqb.raw = read_register(CQB_OFFSET, 8);
+    cqt.raw = read_register(CQT_OFFSET, 4);
+    write_memory((char *)&cmd, ((cqb.ppn * PAGESIZE) | (cqt.index * 16)), 16);
+    cqt.index++;
+    write_register(CQT_OFFSET, 4, cqt.raw);
+    process_commands();
+    return;
 }
 uint8_t read_memory(
     uint64_t addr, uint8_t size, char *data){
@@ -1346,4 +2643,24 @@ void iommu_to_hb_do_global_observability_sync(uint8_t PR, uint8_t PW){
     pr_go_requested = PR;
     pw_go_requested = PW;
 }
-void send_msg_iommu_to_hb(ats_msg_t *prgr){}
+uint64_t test_clock_fn(void) {
+    return test_clock;
+}
+void test_send_msis(iommu_msi_t *msis, uint32_t num_msis) {
+    memcpy(&test_msis[num_test_msis], msis, num_msis * sizeof(iommu_msi_t));
+    num_test_msis += num_msis;
+}
+void *trace_producer(void *arg) {
+    uint32_t i;
+    for ( i = 0; i < TRACE_PRODUCER_RECORDS; i++ )
+        trace_record(TRACE_COMMAND, 0, 0, (uint32_t)(uintptr_t)arg, 0, 0, i, 0);
+    return NULL;
+}
+void test_set_wire(uint8_t vec, uint8_t level) {
+    test_wires[vec] = level;
+    num_wire_changes++;
+}
+void send_msg_iommu_to_hb(ats_msg_t *msg){
+    exp_msg = *msg;
+    num_msgs_sent++;
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+// Decode a file of binary trace records drained from the IOMMU trace ring
+// Usage: trace_decode <trace file>
+#include <stdio.h>
+#include <stdint.h>
+#include "iommu_trace.h"
+
+static const char *at_names[] = { "UNTRANSLATED", "ATS_TRANSLATION_REQUEST", "TRANSLATED" };
+static const char *unit_names[] = { "CQ", "FQ", "HPM", "PQ" };
+static const char *ioatc_names[] = { "-", "HIT", "MISS" };
+
+static void
+decode_record(
+    trace_rec_t *rec) {
+    printf("%12lu ", rec->clock);
+    switch ( rec->type ) {
+        case TRACE_REQUEST:
+            printf("REQ  did=%06x pv=%u pid=%05x at=%s %s%s%s%s iova=%016lx len=%u\n",
+                   rec->device_id, rec->b & 1, rec->process_id,
+                   (rec->a < 3) ? at_names[rec->a] : "?",
+                   (rec->b & 0x10) ? "W" : "R", (rec->b & 0x2) ? " no_write" : "",
+                   (rec->b & 0x4) ? " exec" : "", (rec->b & 0x8) ? " priv" : "",
+                   rec->d0, rec->c);
+            break;
+        case TRACE_RESULT:
+            printf("RSP  did=%06x pid=%05x status=%u perm=%c%c%c%c ioatc=%s pa=%016lx size=%lx\n",
+                   rec->device_id, rec->process_id, rec->a,
+                   (rec->b & 1) ? 'R' : '-', (rec->b & 2) ? 'W' : '-',
+                   (rec->b & 4) ? 'X' : '-', (rec->b & 8) ? 'U' : '-',
+                   (rec->c < 3) ? ioatc_names[rec->c] : "?", rec->d0, rec->d1);
+            break;
+        case TRACE_COMMAND:
+            printf("CMD  opcode=%u func3=%u cqh=%u cmd=%016lx_%016lx\n",
+                   rec->a, rec->b, rec->c, rec->d1, rec->d0);
+            break;
+        case TRACE_FAULT:
+            printf("FLT  did=%06x pv=%u pid=%05x priv=%u dtf=%u ttyp=%u cause=%u iotval=%016lx iotval2=%016lx\n",
+                   rec->device_id, rec->c & 1, rec->process_id, (rec->c >> 1) & 1,
+                   (rec->c >> 2) & 1, rec->a, rec->b, rec->d0, rec->d1);
+            break;
+        case TRACE_INTERRUPT:
+            printf("INT  unit=%s vector=%u %s\n", (rec->a < 4) ? unit_names[rec->a] : "?",
+                   rec->b, (rec->c == 1) ? "WSI" : "MSI");
+            break;
+        default:
+            printf("???  type=%u\n", rec->type);
+            break;
+    }
+    return;
+}
+int
+main(
+    int argc, char **argv) {
+    trace_rec_t rec;
+    FILE *fp;
+
+    if ( argc != 2 ) {
+        fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+    if ( (fp = fopen(argv[1], "rb")) == NULL ) {
+        perror(argv[1]);
+        return 1;
+    }
+    while ( fread(&rec, sizeof(rec), 1, fp) == 1 )
+        decode_record(&rec);
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,133 @@
+// Copyright (c) 2022 by Rivos Inc.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+// Author: ved@rivosinc.com
+// Replay a recording of the transactions presented to the IOMMU. The IOMMU
+// is reset with the reset arguments of the recording, the tables and the
+// registers are restored from the table image saved when the recording was
+// started, and the records are applied as fast as they can be decoded.
+// Usage: trace_replay [-m <memory GiB>] [-s <first record>] [-n <records>]
+//                     <table image> <recording>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "iommu.h"
+#include "tables_api.h"
+
+static char *memory;
+static uint64_t mem_size = (1024UL * 1024UL * 1024UL);
+
+uint8_t
+read_memory(
+    uint64_t addr, uint8_t size, char *data) {
+    if ( (addr + size) > mem_size ) return ACCESS_FAULT;
+    memcpy(data, &memory[addr], size);
+    return 0;
+}
+uint8_t
+read_memory_for_AMO(
+    uint64_t addr, uint8_t size, char *data) {
+    return read_memory(addr, size, data);
+}
+uint8_t
+write_memory(
+    char *data, uint64_t addr, uint8_t size) {
+    if ( (addr + size) > mem_size ) return ACCESS_FAULT;
+    memcpy(&memory[addr], data, size);
+    return 0;
+}
+void
+iommu_to_hb_do_global_observability_sync(
+    uint8_t PR, uint8_t PW) {
+    return;
+}
+void
+send_msg_iommu_to_hb(
+    ats_msg_t *msg) {
+    return;
+}
+static void
+usage(
+    const char *name) {
+    fprintf(stderr, "Usage: %s [options] <table image> <recording>\n", name);
+    fprintf(stderr, "  -m <GiB>      Size of the memory (default 1)\n");
+    fprintf(stderr, "  -s <record>   Number of the first record to replay (default 0)\n");
+    fprintf(stderr, "  -n <records>  Number of records to replay (default all)\n");
+    return;
+}
+int
+main(
+    int argc, char **argv) {
+    uint64_t first, count, n, requests, failures;
+    struct timespec start, end;
+    iommu_to_hb_rsp_t rsp;
+    capabilities_t cap;
+    rec_reader_t r;
+    fctrl_t fctrl;
+    double seconds;
+    rec_t rec;
+    int opt;
+
+    first = 0;
+    count = UINT64_MAX;
+    while ( (opt = getopt(argc, argv, "m:s:n:h")) != -1 ) {
+        switch ( opt ) {
+            case 'm': mem_size = strtoull(optarg, NULL, 0) * 1024UL * 1024UL * 1024UL; break;
+            case 's': first = strtoull(optarg, NULL, 0); break;
+            case 'n': count = strtoull(optarg, NULL, 0); break;
+            default:
+                usage(argv[0]);
+                return ( opt == 'h' ) ? 0 : 1;
+        }
+    }
+    if ( (argc - optind) != 2 || mem_size == 0 ) {
+        usage(argv[0]);
+        return 1;
+    }
+    if ( iommu_replay_open(&r, argv[optind + 1]) != 0 ) {
+        fprintf(stderr, "%s: not a valid recording\n", argv[optind + 1]);
+        return 1;
+    }
+    if ( (memory = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED ) {
+        fprintf(stderr, "Could not allocate memory\n");
+        return 1;
+    }
+    cap.raw = r.hdr->reset.capabilities;
+    fctrl.raw = r.hdr->reset.fctrl;
+    if ( reset_iommu(r.hdr->reset.num_hpm, r.hdr->reset.hpmctr_bits, r.hdr->reset.eventID_mask,
+                     r.hdr->reset.num_vec_bits, r.hdr->reset.reset_iommu_mode, cap, fctrl) < 0 ) {
+        fprintf(stderr, "Could not reset the IOMMU with the recorded reset arguments\n");
+        return 1;
+    }
+    if ( restore_table_image(argv[optind], memory, mem_size) != 0 ) {
+        fprintf(stderr, "%s: could not restore the table image\n", argv[optind]);
+        return 1;
+    }
+    if ( iommu_replay_seek(&r, first) != 0 ) {
+        fprintf(stderr, "No record %"PRIu64" in the recording\n", first);
+        return 1;
+    }
+
+    requests = failures = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for ( n = 0; n < count && iommu_replay_next(&r, &rec) == 0; n++ ) {
+        iommu_replay_apply(&rec, &rsp);
+        if ( rec.type <= REC_TRANSLATED ) {
+            requests++;
+            if ( rsp.status != SUCCESS ) failures++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1e9);
+
+    printf("records %"PRIu64", requests %"PRIu64", failures %"PRIu64"\n", n, requests, failures);
+    printf("%.3f seconds, %.0f requests/sec\n", seconds,
+           ( seconds > 0 ) ? (requests / seconds) : 0);
+    iommu_replay_close(&r);
+    return 0;
+}